@@ -0,0 +1,180 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "fake_camera_device.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include "trace.hpp"
+
+namespace wmr {
+
+namespace {
+
+// The wire format read by Camera
+constexpr uint32_t kMagic = 0x2b6f6c44;
+constexpr std::size_t kFooterTimestampOffset = 0;
+constexpr std::size_t kFooterMagicOffset = 20;
+constexpr std::size_t kFooterTypeOffset = 24;
+constexpr uint16_t kFrameTypeRoom = 0;
+constexpr uint16_t kFrameTypeController = 2;
+constexpr std::size_t kSegmentFrameNumberOffset = 4;
+
+}  // namespace
+
+FakeCameraDevice::FakeCameraDevice(const HeadsetSpec& spec, SoftCameraTransport& transport,
+                                   const Options& options)
+    : spec_(spec),
+      plan_(spec),
+      transport_(transport),
+      options_(options),
+      frame_period_ticks_(std::llround(
+          1e7 / (options.frame_rate > 0 ? options.frame_rate : kNominalFrameRate))),
+      frame_(spec.camera_frame_size),
+      rng_(options.seed) {
+  // Noise for pixels, so that nothing downstream gets to take shortcuts
+  std::generate(frame_.begin(), frame_.end(), [this]() { return static_cast<uint8_t>(rng_()); });
+
+  for (std::size_t i = 0; i < plan_.Segments().size(); ++i) {
+    uint32_t header[3] = {kMagic, 0, static_cast<uint32_t>(i)};
+    std::memcpy(frame_.data() + plan_.Segments()[i].header_offset, header, sizeof(header));
+  }
+  std::memcpy(frame_.data() + spec_.camera_frame_footer_offset + kFooterMagicOffset, &kMagic,
+              sizeof(kMagic));
+}
+
+FakeCameraDevice::~FakeCameraDevice() { Stop(); }
+
+bool FakeCameraDevice::Send(bool wait) {
+  // Pick the fault, if any, up front, since the status goes in along with the data
+  struct {
+    libusbcpp::c::libusb_transfer_status status = libusbcpp::c::LIBUSB_TRANSFER_COMPLETED;
+    bool cut_short = false;
+    uint64_t dropped = 0;
+  } fault;
+  auto roll = Chance();
+  if ((roll -= options_.stall_probability) < 0) {
+    fault.status = libusbcpp::c::LIBUSB_TRANSFER_STALL;
+  } else if ((roll -= options_.cancel_probability) < 0) {
+    fault.status = libusbcpp::c::LIBUSB_TRANSFER_CANCELLED;
+  } else {
+    fault.cut_short = (roll -= options_.short_probability) < 0;
+  }
+
+  // Captures no more than std::function holds without allocating, so that sending doesn't either
+  bool sent = transport_.CompleteInPlace(
+      [this, &fault](uint8_t* buffer, std::size_t capacity) -> std::size_t {
+        while (options_.drop_probability > 0 && Chance() < options_.drop_probability) {
+          ++frame_number_;
+          ++fault.dropped;
+        }
+        ++frame_number_;
+
+        if (fault.status != libusbcpp::c::LIBUSB_TRANSFER_COMPLETED) return 0;
+        auto size = FillFrame(buffer, capacity);
+        if (fault.cut_short) size = std::uniform_int_distribution<std::size_t>(1, size - 1)(rng_);
+        return size;
+      },
+      fault.status, wait);
+
+  std::lock_guard l{m_};
+  stats_.dropped += fault.dropped;
+  if (!sent) return false;
+  switch (fault.status) {
+    case libusbcpp::c::LIBUSB_TRANSFER_STALL:
+      ++stats_.stalls;
+      break;
+    case libusbcpp::c::LIBUSB_TRANSFER_CANCELLED:
+      ++stats_.cancellations;
+      break;
+    default:
+      ++(fault.cut_short ? stats_.short_transfers : stats_.frames);
+      break;
+  }
+  return true;
+}
+
+void FakeCameraDevice::Start() {
+  assert(!thread_.joinable());
+  thread_ = std::thread([this]() { Run(); });
+}
+
+void FakeCameraDevice::Stop() {
+  {
+    std::lock_guard l{m_};
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+
+  std::lock_guard l{m_};
+  stopping_ = false;
+}
+
+FakeCameraDevice::Stats FakeCameraDevice::GetStats() const {
+  std::lock_guard l{m_};
+  return stats_;
+}
+
+double FakeCameraDevice::Chance() { return std::uniform_real_distribution<double>()(rng_); }
+
+std::size_t FakeCameraDevice::FillFrame(uint8_t* buffer, std::size_t capacity) {
+  if (capacity < frame_.size()) {
+    // Let the transport flag the overflow
+    std::copy_n(frame_.data(), capacity, buffer);
+    return frame_.size();
+  }
+
+  // Only the frame number, type and timestamp change from frame to frame, which saves copying
+  // the whole frame every time
+  if (initialized_.insert(buffer).second) std::copy_n(frame_.data(), frame_.size(), buffer);
+  for (const auto& segment : plan_.Segments()) {
+    std::memcpy(buffer + segment.header_offset + kSegmentFrameNumberOffset, &frame_number_,
+                sizeof(frame_number_));
+  }
+  auto footer = buffer + spec_.camera_frame_footer_offset;
+  uint64_t timestamp = frame_number_ * frame_period_ticks_;
+  std::memcpy(footer + kFooterTimestampOffset, &timestamp, sizeof(timestamp));
+  uint16_t type = frame_number_ % 2 ? kFrameTypeController : kFrameTypeRoom;
+  std::memcpy(footer + kFooterTypeOffset, &type, sizeof(type));
+
+  return frame_.size();
+}
+
+void FakeCameraDevice::Run() {
+  WMR_TRACE_THREAD_NAME("Fake camera");
+
+  std::unique_lock l{m_};
+  if (options_.frame_rate <= 0) {
+    while (!stopping_) {
+      l.unlock();
+      bool sent = Send(false);
+      l.lock();
+      if (!sent) stop_cv_.wait_for(l, kPollInterval, [this]() { return stopping_; });
+    }
+    return;
+  }
+
+  // Keep to the schedule even when falling behind, like the real thing
+  auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(1 / options_.frame_rate));
+  auto next = std::chrono::steady_clock::now();
+  while (!stop_cv_.wait_until(l, next, [this]() { return stopping_; })) {
+    l.unlock();
+    bool sent = Send(false);
+    l.lock();
+    if (!sent) {
+      // The frame went out anyways, and was lost
+      ++frame_number_;
+      ++stats_.missed;
+    }
+    next += period;
+  }
+}
+
+}  // namespace wmr
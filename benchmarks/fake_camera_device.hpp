@@ -0,0 +1,128 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <wmr/headset_spec.hpp>
+
+#include "copy_plan.hpp"
+#include "soft_camera_transport.hpp"
+
+namespace wmr {
+
+/** Stands in for the headset's camera, for stress testing Camera without hardware.
+ * Completes the receive transfers of a SoftCameraTransport with synthesized frames, either one at
+ * a time, or at a steady rate from a thread of its own. Faults are mixed in at random: dropped
+ * frames, short transfers, stalls and cancellations. Stalls and cancellations end the stream, just
+ * like they would with a real device.
+ */
+class FakeCameraDevice {
+ public:
+  struct Options {
+    /** Frames a second to send once started, or zero to send each as soon as there's a transfer in
+     * flight to take it.
+     */
+    double frame_rate = 90;
+
+    /** Chance that a frame is dropped, leaving a gap in the frame numbers. */
+    double drop_probability = 0;
+
+    /** Chance that a frame is cut short, at a random length. */
+    double short_probability = 0;
+
+    /** Chance that a transfer completes with LIBUSB_TRANSFER_STALL instead of a frame. */
+    double stall_probability = 0;
+
+    /** Chance that a transfer completes with LIBUSB_TRANSFER_CANCELLED instead of a frame. */
+    double cancel_probability = 0;
+
+    uint32_t seed = 1;
+  };
+
+  struct Stats {
+    uint64_t frames;          /**< Whole frames sent. */
+    uint64_t dropped;         /**< Frames never sent. */
+    uint64_t short_transfers; /**< Frames sent cut short. */
+    uint64_t stalls;
+    uint64_t cancellations;
+
+    /** Frames that came due while no transfer was in flight, or the transport was stopped. Only
+     * counted when sending at a fixed rate.
+     */
+    uint64_t missed;
+  };
+
+  /** transport must outlive this. */
+  FakeCameraDevice(const HeadsetSpec& spec, SoftCameraTransport& transport,
+                   const Options& options);
+
+  /** Calls Stop. */
+  ~FakeCameraDevice();
+
+  FakeCameraDevice(const FakeCameraDevice&) = delete;
+  FakeCameraDevice& operator=(const FakeCameraDevice&) = delete;
+
+  /** Complete the oldest transfer in flight with the next frame, or with the fault picked in its
+   * place. Dropped frames are skipped over. If no transfer is in flight, waits for one if wait is
+   * set. Returns false if nothing was completed. Don't call while started.
+   */
+  bool Send(bool wait);
+
+  /** Send frames at Options::frame_rate from a thread of its own, until Stop. */
+  void Start();
+  void Stop();
+
+  Stats GetStats() const;
+
+ private:
+  /** Fallback frame period, used for timestamps when sending as fast as possible. */
+  static constexpr double kNominalFrameRate = 90;
+
+  /** While sending as fast as possible, how long to wait for a transfer before checking whether
+   * it's time to stop.
+   */
+  static constexpr std::chrono::microseconds kPollInterval{100};
+
+  /** Copy the synthetic frame into buffer if it isn't there already, and stamp it with the current
+   * frame number and timestamp. Returns the frame size.
+   */
+  std::size_t FillFrame(uint8_t* buffer, std::size_t capacity);
+
+  /** A number picked uniformly from [0, 1). */
+  double Chance();
+
+  void Run();
+
+  HeadsetSpec spec_;
+  CopyPlan plan_;
+  SoftCameraTransport& transport_;
+  Options options_;
+  int64_t frame_period_ticks_;  // Device clock ticks (Timestamp) between frames
+
+  // Only touched by whichever thread is sending
+  std::vector<uint8_t> frame_;
+  std::set<uint8_t*> initialized_;  // Receive buffers that hold a copy of frame_
+  uint32_t frame_number_{};
+  std::mt19937 rng_;
+
+  mutable std::mutex m_;
+  std::condition_variable stop_cv_;
+  bool stopping_{};
+  Stats stats_{};
+
+  std::thread thread_;
+};
+
+}  // namespace wmr
@@ -0,0 +1,116 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spsc_queue.hpp"
+#include "waiter.hpp"
+
+using namespace wmr;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/** Producer paces its messages like a fast camera, leaving the consumer idle in between. */
+constexpr auto kInterval = std::chrono::microseconds(200);
+constexpr std::size_t kQueueCapacity = 16;
+
+/** The Camera::Stream handoff as it used to be: std::queue, mutex and condition variable. */
+std::vector<int64_t> RunMutexCv(std::size_t count) {
+  std::queue<Clock::time_point> queue;
+  std::mutex m;
+  std::condition_variable cv;
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(count);
+
+  std::thread consumer([&]() {
+    for (std::size_t i = 0; i < count; ++i) {
+      std::unique_lock l{m};
+      cv.wait(l, [&]() { return !queue.empty(); });
+      auto t = queue.front();
+      queue.pop();
+      l.unlock();
+
+      latencies.push_back((Clock::now() - t).count());
+    }
+  });
+
+  for (std::size_t i = 0; i < count; ++i) {
+    std::this_thread::sleep_for(kInterval);
+    {
+      std::lock_guard l{m};
+      queue.push(Clock::now());
+    }
+    cv.notify_one();
+  }
+
+  consumer.join();
+  return latencies;
+}
+
+std::vector<int64_t> RunSpsc(std::size_t count, WaitStrategy strategy) {
+  SpscQueue<Clock::time_point> queue(kQueueCapacity);
+  Waiter waiter(strategy, 4096);
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(count);
+
+  std::thread consumer([&]() {
+    for (std::size_t i = 0; i < count; ++i) {
+      Clock::time_point t;
+      waiter.Wait([&]() { return !queue.Empty(); });
+      queue.TryPop(t);
+
+      latencies.push_back((Clock::now() - t).count());
+    }
+  });
+
+  for (std::size_t i = 0; i < count; ++i) {
+    std::this_thread::sleep_for(kInterval);
+    while (!queue.TryPush(Clock::now())) CpuRelax();
+    waiter.Notify();
+  }
+
+  consumer.join();
+  return latencies;
+}
+
+void Report(const std::string& name, std::vector<int64_t> latencies) {
+  std::sort(latencies.begin(), latencies.end());
+  auto pct = [&](double p) {
+    auto idx = static_cast<std::size_t>(p / 100 * static_cast<double>(latencies.size() - 1));
+    return latencies[idx];
+  };
+
+  std::cout << name << ": p50=" << pct(50) << "ns p90=" << pct(90) << "ns p99=" << pct(99)
+            << "ns p99.9=" << pct(99.9) << "ns max=" << latencies.back() << "ns" << std::endl;
+}
+
+}  // namespace
+
+/** Measure the latency of handing a timestamp from one thread to another, across the available
+ * wait strategies. Usage: handoff_latency [message count]
+ */
+int main(int argc, char** argv) {
+  std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+
+  Report("mutex+cv", RunMutexCv(count));
+  Report("spsc/blocking", RunSpsc(count, WaitStrategy::kBlocking));
+  Report("spsc/spin-then-park", RunSpsc(count, WaitStrategy::kSpinThenPark));
+  Report("spsc/busy-poll", RunSpsc(count, WaitStrategy::kBusyPoll));
+
+  return 0;
+}
@@ -0,0 +1,299 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <wmr/calibration.hpp>
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+#include <wmr/types.hpp>
+
+#include "camera.hpp"
+#include "clock_sync.hpp"
+#include "fake_camera_device.hpp"
+#include "frame_pool.hpp"
+#include "metrics_registry.hpp"
+#include "oasis_hid.hpp"
+#include "soft_camera_transport.hpp"
+#include "soft_hid_device.hpp"
+
+using namespace wmr;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x2b6f6c44;
+
+// Raw layouts, as read by OasisHid
+constexpr std::size_t kImuReportSize = 381;
+constexpr std::size_t kImuGyroTimestampOffset = 0x009;
+constexpr std::size_t kImuAccelTimestampOffset = 0x0E9;
+constexpr std::size_t kImuMagicOffset = 0x179;
+constexpr uint8_t kFwReportId = 0x02;
+constexpr std::size_t kFwReportSize = 64;
+
+/** Distribution of the time one operation took. */
+struct Result {
+  double p50_ns;
+  double p99_ns;
+};
+
+/** Time iterations samples of batch calls to op each, after a tenth as many warm-up samples. */
+template <class Op>
+Result Measure(std::size_t iterations, std::size_t batch, Op&& op) {
+  std::vector<double> samples;
+  samples.reserve(iterations);
+  for (std::size_t i = 0; i < iterations + iterations / 10; ++i) {
+    auto start = Clock::now();
+    for (std::size_t j = 0; j < batch; ++j) op();
+    auto end = Clock::now();
+
+    if (i >= iterations / 10) {
+      samples.push_back(static_cast<double>((end - start).count()) / static_cast<double>(batch));
+    }
+  }
+
+  std::sort(samples.begin(), samples.end());
+  return {samples[samples.size() / 2], samples[samples.size() * 99 / 100]};
+}
+
+/** Print a result. If bytes is non-zero, also how fast each operation moved that many bytes. */
+void Report(const std::string& name, const std::string& unit, Result result, double bytes = 0) {
+  std::cout << std::left << std::setw(40) << name << std::right << std::fixed
+            << std::setprecision(1) << " p50=" << result.p50_ns << "ns/" << unit
+            << " p99=" << result.p99_ns << "ns/" << unit;
+  if (bytes > 0) std::cout << " (" << bytes / result.p50_ns << " GB/s at p50)";
+  std::cout << std::endl;
+}
+
+/** Feeds a Camera synthetic frames through a SoftCameraTransport, processing them inline. */
+class CameraBench {
+ public:
+  explicit CameraBench(const HeadsetSpec& spec) {
+    CameraOptions options;
+    options.dispatch = FrameDispatch::kInline;
+    auto transport = std::make_unique<SoftCameraTransport>();
+    device_ = std::make_unique<FakeCameraDevice>(spec, *transport, FakeCameraDevice::Options{});
+    camera_ = std::make_unique<Camera>(spec, options, std::move(transport),
+                                       std::make_shared<ClockSync>(),
+                                       std::make_shared<MetricsRegistry>());
+  }
+
+  CameraInterface& camera() { return *camera_; }
+
+  /** Complete one transfer with the next frame. The device only copies a whole frame into each
+   * receive buffer once, so that the measurement isn't swamped by a copy the device would have
+   * done.
+   */
+  void Feed() { device_->Send(true); }
+
+ private:
+  std::unique_ptr<Camera> camera_;
+
+  // After the camera, so that it's destroyed before the transport it feeds
+  std::unique_ptr<FakeCameraDevice> device_;
+};
+
+/** Exit if the camera didn't accept every frame it was fed, which would make its numbers bogus. */
+void CheckFrames(CameraInterface& camera, std::size_t fed) {
+  auto frames = camera.GetStats().frames;
+  if (frames != fed) {
+    std::cerr << "Camera accepted " << frames << " of " << fed << " synthetic frames" << std::endl;
+    std::exit(1);
+  }
+}
+
+/** Frame validation, unpacking and dispatch, measured per frame. */
+void BenchCamera(const HeadsetSpec& spec, std::size_t iterations) {
+  auto frame_bytes = static_cast<double>(spec.camera_frame_size);
+  auto fed = iterations + iterations / 10;
+
+  {
+    // Without subscribers, a frame is only validated
+    CameraBench bench(spec);
+    bench.camera().StartStream();
+    Report("camera/validate", "frame", Measure(iterations, 1, [&]() { bench.Feed(); }),
+           frame_bytes);
+    bench.camera().StopStream();
+    CheckFrames(bench.camera(), fed);
+  }
+
+  for (std::size_t subscribers : {1, 4, 16}) {
+    CameraBench bench(spec);
+    std::atomic<uint64_t> delivered{};
+    for (std::size_t i = 0; i < subscribers; ++i) {
+      bench.camera().RegisterFrameCallback([&](const auto&) {
+        delivered.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      });
+    }
+    bench.camera().StartStream();
+    Report("camera/validate+copy+dispatch/" + std::to_string(subscribers), "frame",
+           Measure(iterations, 1, [&]() { bench.Feed(); }), frame_bytes);
+    bench.camera().StopStream();
+    CheckFrames(bench.camera(), fed);
+    if (delivered != fed * subscribers) {
+      std::cerr << "Camera delivered " << delivered << " of " << fed * subscribers << " frames"
+                << std::endl;
+      std::exit(1);
+    }
+  }
+}
+
+/** HidDevice that reports are dispatched to synchronously, on the calling thread. Firmware
+ * commands are acknowledged right away.
+ */
+class DirectHidDevice : public SoftHidDevice {
+ public:
+  DirectHidDevice()
+      : SoftHidDevice(std::make_shared<MetricsRegistry>(), "bench", [](auto& dev, auto report) {
+          if (report.size() < 2 || report[0] != kFwReportId) return;
+          std::array<uint8_t, kFwReportSize> ack{kFwReportId, report[1]};
+          dev.Inject({ack.data(), ack.size()});
+        }) {}
+
+  using HidDevice::DispatchReport;
+};
+
+/** IMU report decoding, measured per report. */
+void BenchImu(std::size_t iterations) {
+  for (std::size_t subscribers : {1, 4}) {
+    auto device = std::make_unique<DirectHidDevice>();
+    auto direct = device.get();
+    OasisHid oasis(std::move(device), {}, std::make_shared<ClockSync>(),
+                   std::make_shared<MetricsRegistry>());
+    OasisHidInterface& imu = oasis;
+    for (std::size_t i = 0; i < subscribers; ++i) {
+      imu.RegisterImuFrameCallback([](const auto&) { return true; });
+    }
+    imu.StartImu();
+
+    std::array<uint8_t, kImuReportSize> report{};
+    report[0] = 0x01;
+    std::memcpy(report.data() + kImuMagicOffset, &kMagic, sizeof(kMagic));
+
+    uint64_t sample = 0;
+    Report("imu/decode+dispatch/" + std::to_string(subscribers), "report",
+           Measure(iterations, 16,
+                   [&]() {
+                     for (std::size_t k = 0; k < 4; ++k) {
+                       uint64_t timestamp = 10000 * ++sample;
+                       std::memcpy(report.data() + kImuAccelTimestampOffset + 8 * k, &timestamp,
+                                   sizeof(timestamp));
+                       std::memcpy(report.data() + kImuGyroTimestampOffset + 8 * k, &timestamp,
+                                   sizeof(timestamp));
+                     }
+                     direct->DispatchReport({report.data(), report.size()}, Clock::now());
+                   }),
+           kImuReportSize);
+
+    imu.StopImu();
+  }
+}
+
+/** FramePool Allocate and release by several threads at once, measured per pair. */
+void BenchFramePool(std::size_t iterations) {
+  struct Frame {
+    std::array<uint8_t, 64> data;
+  };
+
+  auto max_threads = std::max(2u, std::thread::hardware_concurrency());
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    FramePoolOptions options;
+    options.size = threads;
+    FramePool<Frame> pool(options);
+
+    std::vector<Result> results(threads);
+    std::atomic<std::size_t> ready{};
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t]() {
+        // Start together, so that the threads contend
+        ++ready;
+        while (ready < threads) std::this_thread::yield();
+        results[t] = Measure(iterations, 256, [&]() {
+          auto frame = pool.Allocate();
+          if (frame) frame->data[0] = 1;
+        });
+      });
+    }
+    for (auto& worker : workers) worker.join();
+
+    // The slowest thread's view
+    Result worst{};
+    for (const auto& result : results) {
+      worst.p50_ns = std::max(worst.p50_ns, result.p50_ns);
+      worst.p99_ns = std::max(worst.p99_ns, result.p99_ns);
+    }
+    Report("frame_pool/allocate+release/" + std::to_string(threads), "pair", worst);
+  }
+}
+
+/** Calibration JSON shaped like the headset's, with plausible values for each camera. */
+std::string MakeCalibrationJson(const HeadsetSpec& spec) {
+  std::ostringstream json;
+  json << R"({"CalibrationInformation":{"Cameras":[)";
+  for (std::size_t i = 0; i < spec.n_cameras; ++i) {
+    if (i > 0) json << ",";
+    json << R"({"Location":"CALIBRATION_CameraLocationHT)" << i << R"(","Purpose":"Tracking",)"
+         << R"("SensorWidth":)" << spec.camera_width << R"(,"SensorHeight":)"
+         << spec.camera_height << ","
+         << R"("Intrinsics":{"ModelType":"CALIBRATION_LensDistortionModelRational6KT",)"
+         << R"("ModelParameterCount":15,"ModelParameters":[)";
+    for (std::size_t p = 0; p < 15; ++p) {
+      json << (p > 0 ? "," : "") << 0.5 + 0.0123456789 * static_cast<double>(p + i);
+    }
+    json << R"(]},"Rt":{"Rotation":[0.9998,-0.0123,0.0156,0.0122,0.9999,0.0034,-0.0156,)"
+         << R"(-0.0032,0.9998],"Translation":[)" << 0.05 * static_cast<double>(i)
+         << R"(,-0.0012,0.0034]}})";
+  }
+  json << "]}}";
+  return json.str();
+}
+
+/** Calibration parsing, measured per parse. */
+void BenchCalibration(const HeadsetSpec& spec, std::size_t iterations) {
+  auto json = MakeCalibrationJson(spec);
+  Report("calibration/parse_json", "parse", Measure(iterations, 1, [&]() {
+           Calibration calibration;
+           calibration.ParseJson(json);
+         }),
+         static_cast<double>(json.size()));
+}
+
+}  // namespace
+
+/** Microbenchmarks of the driver's hot paths, on synthetic inputs for the HP Reverb G2.
+ * Usage: hot_paths [iterations]
+ */
+int main(int argc, char** argv) {
+  std::size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+  iterations = std::max<std::size_t>(iterations, 10);
+
+  // Keep per-frame logging out of the measurements
+  spdlog::set_level(spdlog::level::err);
+
+  auto& spec = headset_specifications::kHpReverbG2;
+  BenchCamera(spec, iterations);
+  BenchImu(iterations);
+  BenchFramePool(iterations);
+  BenchCalibration(spec, iterations);
+
+  return 0;
+}
@@ -0,0 +1,235 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+
+#include "camera.hpp"
+#include "clock_sync.hpp"
+#include "fake_camera_device.hpp"
+#include "metrics_registry.hpp"
+#include "soft_camera_transport.hpp"
+
+using namespace wmr;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+/** Frames a second the headset's cameras send, which the soak test runs a multiple of. */
+constexpr double kRealTimeFrameRate = 90;
+
+/** How often the soak test restarts the stream cleanly, on top of the restarts faults force. */
+constexpr std::chrono::milliseconds kRestartInterval{250};
+
+struct Config {
+  std::string name;
+  FrameDispatch dispatch;
+  bool zero_copy;
+};
+
+/** A Camera fed by a FakeCameraDevice. */
+struct Rig {
+  Rig(const HeadsetSpec& spec, const Config& config,
+      const FakeCameraDevice::Options& device_options) {
+    CameraOptions options;
+    options.dispatch = config.dispatch;
+    options.zero_copy = config.zero_copy;
+    auto transport_ptr = std::make_unique<SoftCameraTransport>();
+    transport = transport_ptr.get();
+    device = std::make_unique<FakeCameraDevice>(spec, *transport, device_options);
+    camera = std::make_unique<Camera>(spec, options, std::move(transport_ptr),
+                                      std::make_shared<ClockSync>(),
+                                      std::make_shared<MetricsRegistry>());
+  }
+
+  CameraInterface& cam() { return *camera; }
+
+  SoftCameraTransport* transport;
+  std::unique_ptr<Camera> camera;
+
+  // After the camera, so that it's destroyed before the transport it feeds
+  std::unique_ptr<FakeCameraDevice> device;
+};
+
+/** Print a failed check and return false, or just return true. */
+bool Check(const Config& config, bool ok, const std::string& what) {
+  if (!ok) std::cerr << config.name << ": FAILED " << what << std::endl;
+  return ok;
+}
+
+/** Stream speedup times faster than real time for the given time, with every kind of fault mixed
+ * in. Whenever a fault ends the stream, it's restarted while the device keeps sending. Every
+ * kRestartInterval, it's also restarted cleanly: the device is stopped first, like
+ * ReplayHeadset::Close does. Then check that what the camera saw adds up with what the device
+ * sent.
+ */
+bool Soak(const HeadsetSpec& spec, const Config& config, std::chrono::seconds duration,
+          double speedup) {
+  FakeCameraDevice::Options device_options;
+  device_options.frame_rate = kRealTimeFrameRate * speedup;
+  device_options.drop_probability = 0.01;
+  device_options.short_probability = 0.01;
+  device_options.stall_probability = 0.002;
+  device_options.cancel_probability = 0.002;
+  Rig rig(spec, config, device_options);
+
+  // One subscriber that holds up dispatch as little as possible, and one slow enough to back up
+  std::atomic<uint64_t> delivered{};
+  rig.cam().RegisterFrameCallback([&](const auto&) {
+    delivered.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  });
+  FrameSubscription slow;
+  slow.queue.async = true;
+  rig.cam().RegisterFrameCallback(
+      [&](const auto&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return true;
+      },
+      slow);
+
+  uint64_t fault_restarts = 0;
+  uint64_t clean_restarts = 0;
+  rig.cam().StartStream();
+  rig.device->Start();
+  auto end = Clock::now() + duration;
+  auto next_restart = Clock::now() + kRestartInterval;
+  while (Clock::now() < end) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (!rig.transport->Running()) {
+      // Races the device, which may be completing a transfer while StopRx cancels the rest
+      rig.cam().StopStream();
+      rig.cam().StartStream();
+      ++fault_restarts;
+    } else if (Clock::now() >= next_restart) {
+      rig.device->Stop();
+      rig.cam().StopStream();
+      rig.cam().StartStream();
+      rig.device->Start();
+      ++clean_restarts;
+      next_restart += kRestartInterval;
+    }
+  }
+  rig.device->Stop();
+  rig.cam().StopStream();
+
+  auto sent = rig.device->GetStats();
+  auto stats = rig.cam().GetStats();
+
+  std::cout << std::left << std::setw(24) << config.name << std::right << " sent=" << sent.frames
+            << " received=" << stats.frames << " (" << std::fixed << std::setprecision(1)
+            << static_cast<double>(stats.frames) / static_cast<double>(duration.count())
+            << " frames/s), dropped=" << sent.dropped << " missed=" << sent.missed
+            << " gaps=" << stats.frame_gaps << ", short=" << sent.short_transfers
+            << " size_errors=" << stats.size_errors << ", stalls=" << sent.stalls
+            << " cancellations=" << sent.cancellations << " restarts=" << fault_restarts << "+"
+            << clean_restarts
+            << ", pool_drops=" << stats.frame_pool_drops << std::endl;
+
+  // Whatever was in flight, or waiting for the stream thread, when a fault ended the stream is
+  // reaped without being looked at
+  auto unseen = (fault_restarts + clean_restarts + 1) * stats.rx_capacity;
+
+  bool ok = true;
+  ok &= Check(config, stats.frames <= sent.frames && stats.frames + unseen >= sent.frames,
+              "every whole frame sent is received");
+  ok &= Check(config,
+              stats.size_errors <= sent.short_transfers &&
+                  stats.size_errors + unseen >= sent.short_transfers,
+              "every short transfer is caught");
+  ok &= Check(config,
+              stats.footer_errors == 0 && stats.segment_magic_errors == 0 &&
+                  stats.frame_number_errors == 0,
+              "no other frame errors");
+  ok &= Check(config, stats.frame_gaps <= sent.dropped + sent.missed,
+              "frame gaps only where frames went missing");
+  ok &= Check(config, fault_restarts <= sent.stalls + sent.cancellations,
+              "the stream only ends on a stall or cancellation");
+  ok &= Check(config, delivered + stats.frame_pool_drops == stats.frames,
+              "every frame is delivered, or counted as dropped");
+  ok &= Check(config, stats.rx_in_flight == 0, "nothing in flight once stopped");
+  return ok;
+}
+
+/** Send frames as fast as the camera takes them, without faults, and report how many it gets
+ * through a second, delivering them to one subscriber. Zero-copy frames aren't unpacked, so there
+ * that's mostly the overhead of each frame.
+ */
+void Throughput(const HeadsetSpec& spec, const Config& config, std::chrono::seconds duration) {
+  FakeCameraDevice::Options device_options;
+  device_options.frame_rate = 0;
+  Rig rig(spec, config, device_options);
+  rig.cam().RegisterFrameCallback([](const auto&) { return true; });
+
+  rig.cam().StartStream();
+  auto start = Clock::now();
+  rig.device->Start();
+  std::this_thread::sleep_for(duration);
+  rig.device->Stop();
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  rig.cam().StopStream();
+
+  auto frames = static_cast<double>(rig.cam().GetStats().frames);
+  auto rate = frames / elapsed;
+  std::cout << std::left << std::setw(24) << config.name << std::right << std::fixed
+            << std::setprecision(1) << " max=" << rate << " frames/s ("
+            << rate / kRealTimeFrameRate << "x real time, "
+            << rate * static_cast<double>(spec.camera_frame_size) / 1e9 << " GB/s)" << std::endl;
+}
+
+}  // namespace
+
+/** Soak test the camera stream faster than real time with faults injected, then measure the most
+ * frames a second it can sustain, in each dispatch mode. Usage:
+ * stream_soak [soak|throughput] [seconds] [speedup], which does both by default, for 10 seconds
+ * per configuration, soaking at 4x real time. Exits non-zero if the camera miscounted anything
+ * during the soak.
+ */
+int main(int argc, char** argv) {
+  std::string mode = "both";
+  if (argc > 1 && (std::string(argv[1]) == "soak" || std::string(argv[1]) == "throughput")) {
+    mode = argv[1];
+    --argc;
+    ++argv;
+  }
+  std::chrono::seconds duration(argc > 1 ? std::atoi(argv[1]) : 10);
+  double speedup = argc > 2 ? std::atof(argv[2]) : 4;
+
+  // The faults are injected on purpose, so the driver's complaints about them are noise
+  spdlog::set_level(spdlog::level::off);
+
+  const auto& spec = headset_specifications::kHpReverbG2;
+  const Config configs[] = {
+      {"stream_thread", FrameDispatch::kStreamThread, false},
+      {"stream_thread/zero_copy", FrameDispatch::kStreamThread, true},
+      {"inline", FrameDispatch::kInline, false},
+      {"inline/zero_copy", FrameDispatch::kInline, true},
+  };
+
+  bool ok = true;
+  if (mode != "throughput") {
+    std::cout << "Soak at " << speedup << "x real time (" << kRealTimeFrameRate * speedup
+              << " frames/s):" << std::endl;
+    for (const auto& config : configs) ok &= Soak(spec, config, duration, speedup);
+  }
+
+  if (mode != "soak") {
+    std::cout << "Sustained throughput:" << std::endl;
+    for (const auto& config : configs) Throughput(spec, config, duration);
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+#include <wmr/types.hpp>
+
+#include "copy_plan.hpp"
+#include "frame_unpacker.hpp"
+#include "thread_pool.hpp"
+
+using namespace wmr;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x2b6f6c44;
+
+/** A raw frame full of noise, with valid segment headers. */
+std::vector<uint8_t> MakeRawFrame(const HeadsetSpec& spec, const CopyPlan& plan) {
+  std::vector<uint8_t> frame(spec.camera_xfer_size);
+  std::mt19937 rng(1234);
+  std::generate(frame.begin(), frame.end(), [&]() { return static_cast<uint8_t>(rng()); });
+
+  for (std::size_t i = 0; i < plan.Segments().size(); ++i) {
+    uint32_t header[3] = {kMagic, 1, static_cast<uint32_t>(i)};
+    std::memcpy(frame.data() + plan.Segments()[i].header_offset, header, sizeof(header));
+  }
+
+  return frame;
+}
+
+bool ValidateSegmentHeader(const uint8_t* frame, const CopyPlan& plan, std::size_t segment_idx) {
+  uint32_t header[3];
+  std::memcpy(header, frame + plan.Segments()[segment_idx].header_offset, sizeof(header));
+  return header[0] == kMagic && header[1] == 1 && header[2] == segment_idx;
+}
+
+}  // namespace
+
+/** Measure CopyFrame's unpack latency as the number of unpack threads increases.
+ * Usage: unpack_scaling [max threads] [min chunk size] [iterations] [pyramid levels]
+ */
+int main(int argc, char** argv) {
+  std::size_t max_threads =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+  std::size_t min_chunk_size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 128 * 1024;
+  std::size_t iterations = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 500;
+  auto pyramid_levels = static_cast<uint8_t>(argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 0);
+
+  auto& spec = headset_specifications::kHpReverbG2;
+  CopyPlan plan(spec);
+  auto raw_frame = MakeRawFrame(spec, plan);
+
+  CameraFrame frame(spec.camera_width, spec.camera_height, spec.n_cameras, nullptr,
+                    pyramid_levels);
+
+  auto validator = [&](const uint8_t* f, std::size_t segment_idx) {
+    return ValidateSegmentHeader(f, plan, segment_idx);
+  };
+
+  auto bytes_per_frame = static_cast<double>(plan.ImageSize() * plan.ImageCount());
+
+  for (std::size_t threads = 1; threads <= std::max<std::size_t>(max_threads, 1); ++threads) {
+    auto pool = threads > 1 ? std::make_unique<ThreadPool>(threads) : nullptr;
+    // Pyramid levels are built from rows read back out of the images, so they need to be cached
+    FrameUnpacker unpacker(plan, pyramid_levels == 0, pool.get(), min_chunk_size, validator);
+
+    std::vector<int64_t> latencies;
+    for (std::size_t i = 0; i < iterations + iterations / 10; ++i) {
+      auto start = Clock::now();
+      if (!unpacker.Unpack(raw_frame.data(), frame)) {
+        std::cerr << "Unpack failed" << std::endl;
+        return 1;
+      }
+      auto end = Clock::now();
+
+      // Discard warm-up iterations
+      if (i >= iterations / 10) latencies.push_back((end - start).count());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto p50 = latencies[latencies.size() / 2];
+    auto p99 = latencies[latencies.size() * 99 / 100];
+
+    std::cout << "threads=" << threads << " chunks=" << unpacker.ChunkCount() << " p50=" << p50
+              << "ns p99=" << p99 << "ns (" << bytes_per_frame / static_cast<double>(p50)
+              << " GB/s at p50)" << std::endl;
+  }
+
+  return 0;
+}
@@ -5,9 +5,17 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <future>
+#include <utility>
+#include <vector>
 
+#include "headset_options.hpp"
+#include "latency.hpp"
+#include "pooled_ptr.hpp"
 #include "types.hpp"
 
 #ifndef WUMBO_PUBLIC
@@ -20,19 +28,137 @@
 
 namespace wmr {
 
+/** Counters for one registered frame callback. */
+struct SubscriberStats {
+  uint32_t id; /**< Registration order of the callback, counting from 0. */
+  bool async;  /**< Whether it runs on its own thread (CallbackQueueOptions::async). */
+  uint64_t delivered;
+  uint64_t dropped;                 /**< Frames discarded because its queue was full. */
+  std::size_t queued;               /**< Frames waiting in its queue right now. */
+  std::size_t max_queued;           /**< Most frames ever waiting in its queue at once. */
+  std::chrono::nanoseconds max_lag; /**< Longest time a frame waited in its queue. */
+};
+
+/** Counters describing the camera's USB receive ring and the frames that came out of it. */
+struct CameraStats {
+  std::size_t rx_capacity;      /**< Receive transfers allocated. */
+  std::size_t rx_depth;         /**< Receive transfers the ring is trying to keep in flight. */
+  std::size_t rx_in_flight;     /**< Receive transfers submitted right now. */
+  std::size_t rx_held;          /**< Receive transfers being processed, or pinned by frames. */
+  std::size_t rx_min_in_flight; /**< Fewest left in flight after a completion; 0 before any. */
+  uint64_t rx_completions;
+  uint64_t rx_underruns; /**< Completions that left no transfer in flight. */
+  uint64_t rx_depth_increases;
+  uint64_t rx_depth_decreases;
+
+  uint64_t frames;               /**< Valid frames dispatched. */
+  uint64_t size_errors;          /**< Transfers of the wrong size. */
+  uint64_t footer_errors;        /**< Footers with bad magic, no timestamp or bad type. */
+  uint64_t segment_magic_errors; /**< Segment headers with bad magic. */
+  uint64_t frame_number_errors;  /**< Segment headers out of place within their frame. */
+  uint64_t frame_gaps;           /**< Discontinuities in the frame number of valid frames. */
+  uint64_t resyncs;              /**< Times the stream lost sync after having locked on. */
+
+  std::size_t frame_pool_size;       /**< Frames allocated. */
+  std::size_t frame_pool_high_water; /**< Most frames ever in use at once. */
+  uint64_t frame_pool_exhaustions;   /**< Frames that found the pool empty. */
+  uint64_t frame_pool_drops;         /**< Frames dropped for lack of a free one. */
+  std::chrono::nanoseconds frame_pool_wait_time; /**< Total time spent waiting for a frame. */
+
+  /** Callbacks still registered. Collecting these waits for any synchronous frame callback to
+   * return, so don't call GetStats from one.
+   */
+  std::vector<SubscriberStats> subscribers;
+};
+
+/** Where to sample each pixel of one rectified camera image from.
+ * Laid out like the CV_32FC1 map pair produced by cv::initUndistortRectifyMap: map_x and map_y
+ * hold width * height source coordinates each, in row-major order. Sampling is bilinear with 1/32
+ * pixel resolution, and pixels sampled from outside the image are black, as with
+ * cv::remap(..., cv::INTER_LINEAR).
+ */
+struct RectificationMap {
+  uint32_t width;
+  uint32_t height;
+  std::vector<float> map_x;
+  std::vector<float> map_y;
+};
+
+/** Which frames, and which images of them, a frame callback wants.
+ * The driver only unpacks images that at least one subscriber wants, and skips unpacking frames
+ * that nobody wants at all.
+ */
+struct FrameSubscription {
+  static constexpr uint32_t kAll = UINT32_MAX;
+
+  static constexpr uint32_t FrameTypeBit(CameraFrame::Type type) {
+    return uint32_t{1} << static_cast<int>(type);
+  }
+
+  /** Bit n selects image n. Unselected images of delivered frames may hold stale data. */
+  uint32_t image_mask = kAll;
+
+  /** Bit FrameTypeBit(type) selects frames of that type. */
+  uint32_t frame_type_mask = kAll;
+
+  /** Deliver only every decimation'th frame of the selected types. */
+  uint32_t decimation = 1;
+
+  /** By default the callback runs on the thread that dispatches frames, which it holds up. */
+  CallbackQueueOptions queue;
+};
+
 struct WUMBO_PUBLIC CameraInterface {
  public:
-  using FrameHandle = std::shared_ptr<const CameraFrame>;
+  using FrameHandle = PooledPtr<const CameraFrame>;
+  using ImageView = CameraImageView;
 
-  /** Callback shall return true if it should be called again. */
-  using FrameCallback = std::function<bool(FrameHandle)>;
+  /** Callback shall return true if it should be called again.
+   * The frame is passed by reference, so that dispatching it costs nothing; copy the handle to keep
+   * the frame beyond the call.
+   */
+  using FrameCallback = std::function<bool(const FrameHandle&)>;
 
   virtual ~CameraInterface() = default;
 
   virtual void StartStream() = 0;
   virtual void StopStream() = 0;
+
+  /** Set exposure and gain of the given camera type. Doesn't block or allocate: the command is
+   * sent asynchronously, and replaced by any later one for the same camera type that comes in
+   * before it's sent. Failures are only logged.
+   */
   virtual void SetExpGain(uint16_t camera_type, uint16_t exposure, uint16_t gain) = 0;
-  virtual void RegisterFrameCallback(FrameCallback cb) = 0;
+
+  /** Like SetExpGain, but the future becomes ready once this setting or a later one has been sent,
+   * and holds an exception if sending it failed.
+   */
+  virtual std::future<void> SetExpGainAndNotify(uint16_t camera_type, uint16_t exposure,
+                                                uint16_t gain) = 0;
+
+  virtual void RegisterFrameCallback(FrameCallback cb, const FrameSubscription& subscription) = 0;
+
+  /** Subscribe to every image of every frame. */
+  void RegisterFrameCallback(FrameCallback cb) { RegisterFrameCallback(std::move(cb), {}); }
+  virtual CameraStats GetStats() = 0;
+
+  /** Latency of each stage of frame processing, since the camera was created:
+   * - "usb": received_timestamp - host_timestamp of each valid frame, i.e. how much longer it took
+   *   to arrive than the quickest frames.
+   * - "validate": from received_timestamp until the frame was found valid.
+   * - "unpack": from received_timestamp until a frame some subscriber wanted was unpacked.
+   * - "callback_entry" and "callback_exit": from received_timestamp until each frame callback was
+   *   called, and until it returned.
+   * These are also logged at debug level by StopStream.
+   */
+  virtual std::vector<StageLatency> GetLatency() = 0;
+
+  /** Deliver image n of every frame rectified by map, instead of as captured.
+   * Each rectified pixel is interpolated straight from the raw USB frame, so this costs no more
+   * than a plain unpack. An empty map (width or height 0) turns rectification back off. map must
+   * match the image size. Only call while the stream is stopped. Doesn't apply to zero-copy frames.
+   */
+  virtual void SetRectification(uint8_t n, const RectificationMap& map) = 0;
 };
 
 }  // namespace wmr
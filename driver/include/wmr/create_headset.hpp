@@ -8,6 +8,7 @@
 #include <memory>
 
 #include "headset_interface.hpp"
+#include "headset_options.hpp"
 #include "headset_spec.hpp"
 
 #ifndef WUMBO_PUBLIC
@@ -20,6 +21,20 @@
 
 namespace wmr {
 
-WUMBO_PUBLIC std::shared_ptr<HeadsetInterface> CreateHeadset(const HeadsetSpec& spec);
+/** Open the headset described by spec. If options.replay names a capture (or the environment does,
+ * see ReplayOptions::file), returns CreateReplayHeadset(spec, options) instead.
+ */
+WUMBO_PUBLIC std::shared_ptr<HeadsetInterface> CreateHeadset(const HeadsetSpec& spec,
+                                                          const HeadsetOptions& options = {});
+
+/** Virtual headset that plays back the capture named by options.replay (as recorded with
+ * options.capture, e.g. by the capture utility), through the same frame and report decoding as a
+ * real one. Replay starts when the headset is opened, and it goes quiet once the capture runs out.
+ * Commands to the headset are accepted and ignored, except for reads of firmware payloads like the
+ * calibration, which are answered from the capture. Throws std::runtime_error if the capture can't
+ * be read.
+ */
+WUMBO_PUBLIC std::shared_ptr<HeadsetInterface> CreateReplayHeadset(const HeadsetSpec& spec,
+                                                                const HeadsetOptions& options);
 
 }  // namespace wmr
@@ -5,7 +5,10 @@
 
 #pragma once
 
+#include <vector>
+
 #include "camera_interface.hpp"
+#include "metrics.hpp"
 #include "oasis_hid_interface.hpp"
 #include "vendor_hid_interface.hpp"
 
@@ -27,6 +30,12 @@ struct WUMBO_PUBLIC HeadsetInterface {
   virtual CameraInterface& Camera() = 0;
   virtual OasisHidInterface& OasisHid() = 0;
   virtual VendorHidInterface& VendorHid() = 0;
+
+  /** Snapshot of the driver's health metrics: frames received, validated and dropped, USB
+   * transfer statuses, frame pool occupancy, IMU samples and gaps, HID reports per ID, and stage
+   * latencies. Cheap enough to poll, and safe to call from any thread.
+   */
+  virtual std::vector<Metric> GetMetrics() = 0;
 };
 
 }  // namespace wmr
@@ -0,0 +1,230 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifndef WUMBO_PUBLIC
+#if defined _WIN32 || defined __CYGWIN__
+#define WUMBO_PUBLIC __declspec(dllimport)
+#else
+#define WUMBO_PUBLIC
+#endif
+#endif
+
+namespace wmr {
+
+/** How a thread waits for work handed to it by another thread. */
+enum class WaitStrategy {
+  kBlocking,     /**< Sleep on a condition variable right away. */
+  kSpinThenPark, /**< Spin for a while, then sleep. */
+  kBusyPoll,     /**< Never sleep. Burns a core, but has the lowest wakeup latency. */
+};
+
+/** Which thread camera frames are unpacked and dispatched on. */
+enum class FrameDispatch {
+  /** A dedicated stream thread. Slow frame callbacks only delay other frames. */
+  kStreamThread,
+
+  /** The libusb event thread, right inside the transfer callback. Saves a thread hop per frame,
+   * but frame callbacks then hold up all USB traffic (including the IMU), so keep them short.
+   */
+  kInline,
+};
+
+/** What a frame pool does when a new frame arrives while consumers hold every frame. */
+enum class PoolExhaustion {
+  kDropNewest, /**< Drop the new frame. */
+  kBlock,      /**< Wait up to block_timeout for a frame to be released, then drop the new one. */
+  kGrow,       /**< Allocate another frame, up to max_size, then drop new ones. */
+};
+
+struct FramePoolOptions {
+  /** Frames allocated up front. */
+  std::size_t size = 3;
+
+  PoolExhaustion on_exhaustion = PoolExhaustion::kDropNewest;
+
+  /** With PoolExhaustion::kGrow, the most frames the pool may hold. */
+  std::size_t max_size = 8;
+
+  /** With PoolExhaustion::kBlock, how long to wait. This stalls the thread delivering frames. */
+  std::chrono::microseconds block_timeout{5000};
+};
+
+/** What an asynchronous callback's queue does when a new frame arrives while it's full. */
+enum class QueueOverflow {
+  kLatestOnly, /**< Keep only the newest frame, whatever the depth. The callback may skip frames. */
+  kDropOldest, /**< Drop the oldest queued frame. */
+  kBlock,      /**< Wait up to block_timeout for room, then drop the new frame. */
+};
+
+/** How frames are handed to a callback. */
+struct CallbackQueueOptions {
+  /** Run the callback on a worker thread of its own, fed through a bounded queue, instead of on the
+   * driver thread that produced the frame. A slow callback then only delays itself.
+   */
+  bool async = false;
+
+  /** Frames the queue can hold. Each queued frame pins a frame pool entry, or in zero-copy mode a
+   * USB receive buffer, so size the frame pool to match.
+   */
+  std::size_t depth = 2;
+
+  QueueOverflow on_overflow = QueueOverflow::kDropOldest;
+
+  /** With QueueOverflow::kBlock, how long to wait. This stalls the thread delivering frames, and
+   * with FrameDispatch::kInline, all USB traffic.
+   */
+  std::chrono::microseconds block_timeout{5000};
+};
+
+/** Parameters for the driver's auto-exposure loop. */
+struct AutoExposureOptions {
+  /** Adjust exposure and gain of room frames automatically.
+   * Controller frames are left alone, since controller tracking relies on them being dark. While
+   * this is on, don't call CameraInterface::SetExpGain for room frame camera types.
+   */
+  bool enable = false;
+
+  /** Mean pixel value to aim for. */
+  double target_mean = 100;
+
+  /** Adjust only if the mean is off from target_mean by more than this fraction. */
+  double deadband = 0.1;
+
+  /** Reduce brightness if more than this fraction of pixels are saturated. */
+  double max_saturated_fraction = 0.02;
+
+  uint16_t min_exposure = 60;
+  uint16_t max_exposure = 0x1770;
+  uint16_t min_gain = 16;
+  uint16_t max_gain = 0xFF;
+
+  /** Room frames to wait between adjustments, so each one shows up before the next is made. */
+  unsigned interval = 4;
+};
+
+struct CameraOptions {
+  /** Hand out frames that read directly from the USB receive buffers instead of copying them.
+   * Zero-copy frames don't support CameraFrame::GetImage; use CameraFrame::GetImageView. Each
+   * outstanding FrameHandle pins one receive buffer, so don't hold on to frames for long.
+   */
+  bool zero_copy = false;
+
+  /** Number of whole-frame USB transfers to keep in flight.
+   * Each one costs a receive buffer of about 1.2 MB, and buffers are allocated up front for
+   * rx_max_depth of them. On Linux these count against usbfs_memory_mb (16 MB by default).
+   */
+  std::size_t rx_depth = 3;
+  std::size_t rx_min_depth = 2;
+  std::size_t rx_max_depth = 5;
+
+  /** Grow the in-flight depth when the receive ring starves, and shrink it when it has slack. */
+  bool rx_adaptive_depth = true;
+
+  FrameDispatch dispatch = FrameDispatch::kStreamThread;
+
+  /** Number of threads to unpack each frame with, including the dispatching thread.
+   * With more than one, the driver starts a pool of unpack_threads - 1 workers. Doesn't apply to
+   * zero-copy frames, which aren't unpacked.
+   */
+  std::size_t unpack_threads = 1;
+
+  /** Smallest amount of image data (in bytes) worth handing to another unpack thread. */
+  std::size_t unpack_min_chunk_size = 128 * 1024;
+
+  /** Number of 2x downsampled levels to build above each full-resolution image.
+   * Each level is a 2x2 box filter of the one below it, built while the frame is unpacked so that
+   * the source rows are still in cache. Read them with CameraFrame::GetPyramidImage. Clamped so
+   * that no level has zero width or height. Doesn't apply to zero-copy frames.
+   */
+  uint8_t pyramid_levels = 0;
+
+  AutoExposureOptions auto_exposure;
+
+  /** Processed frames. Every FrameHandle held by a consumer pins one of them. In zero-copy mode,
+   * the USB receive ring gets a spare transfer per frame, up to max_size with kGrow.
+   */
+  FramePoolOptions frame_pool;
+
+  /** How the stream thread waits for completed transfers. */
+  WaitStrategy stream_wait = WaitStrategy::kBlocking;
+
+  /** With WaitStrategy::kSpinThenPark, how many times to poll before sleeping. */
+  std::size_t stream_spin_iterations = 4096;
+};
+
+struct ImuOptions {
+  FramePoolOptions frame_pool;
+};
+
+struct MetricsOptions {
+  /** While the headset is open, periodically write its metrics (see HeadsetInterface::GetMetrics)
+   * to this file in the Prometheus text format, e.g. for the node_exporter textfile collector.
+   * The file is replaced atomically. Empty to not write it.
+   */
+  std::string prometheus_file;
+
+  std::chrono::milliseconds prometheus_interval{10000};
+};
+
+struct CaptureOptions {
+  /** Record the raw traffic of the headset to this file: every completed camera transfer and HID
+   * report, stamped with when it was received, plus any firmware payload read through
+   * OasisHidInterface (read the calibration to make the capture replayable). Empty to not record.
+   */
+  std::string file;
+
+  /** Memory set aside up front for records on their way to the file. When the disk falls this far
+   * behind, records are dropped, rather than holding up the headset.
+   */
+  std::size_t buffer_size = 64 << 20;
+
+  /** Records are written in chunks of this size, which must fit the largest camera transfer. */
+  std::size_t chunk_size = 4 << 20;
+};
+
+/** How a replayed capture is paced. */
+enum class ReplayPacing {
+  /** As it was recorded. Camera frames that come in while the driver holds every receive transfer
+   * are dropped, as they would be by the device.
+   */
+  kOriginal,
+
+  /** Back to back, waiting for the driver instead of dropping frames. For throughput benchmarks.
+   * Host timestamps then no longer track the device's clock.
+   */
+  kAsFastAsPossible,
+};
+
+struct ReplayOptions {
+  /** Capture to replay instead of talking to a real headset, see CreateReplayHeadset. If empty,
+   * CreateHeadset takes it from the WMR_REPLAY environment variable, and if that's set, the pacing
+   * from WMR_REPLAY_PACING ("original" or "fast").
+   */
+  std::string file;
+
+  ReplayPacing pacing = ReplayPacing::kOriginal;
+};
+
+struct HeadsetOptions {
+  CameraOptions camera;
+  ImuOptions imu;
+  MetricsOptions metrics;
+  CaptureOptions capture;
+  ReplayOptions replay;
+
+  /** If the driver was built with tracing (see TracingEnabled in wmr/tracing.hpp), write a Chrome
+   * trace of the most recent events here whenever the headset is closed. Empty to not write it.
+   */
+  std::string trace_file;
+};
+
+}  // namespace wmr
@@ -0,0 +1,29 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace wmr {
+
+/** Distribution of the latency of one stage of frame processing.
+ * Latencies are summarized from a histogram whose buckets are at most about 3% wide, so the
+ * percentiles are that accurate. min, max and mean are exact.
+ */
+struct StageLatency {
+  const char* stage; /**< Name of the stage. Points to a string literal. */
+  uint64_t count;    /**< Latencies recorded. The rest is zero if there are none. */
+  std::chrono::nanoseconds min;
+  std::chrono::nanoseconds mean;
+  std::chrono::nanoseconds p50;
+  std::chrono::nanoseconds p90;
+  std::chrono::nanoseconds p99;
+  std::chrono::nanoseconds p999;
+  std::chrono::nanoseconds max;
+};
+
+}  // namespace wmr
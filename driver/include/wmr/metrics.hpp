@@ -0,0 +1,53 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "latency.hpp"
+
+#ifndef WUMBO_PUBLIC
+#if defined _WIN32 || defined __CYGWIN__
+#define WUMBO_PUBLIC __declspec(dllimport)
+#else
+#define WUMBO_PUBLIC
+#endif
+#endif
+
+namespace wmr {
+
+/** Same meaning as the Prometheus metric types. */
+enum class MetricType {
+  kCounter, /**< Only ever goes up. */
+  kGauge,   /**< Current level of something. */
+  kSummary, /**< Distribution of a latency. */
+};
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+/** Value of one driver health metric at the time of a snapshot.
+ * Metrics follow Prometheus naming: they start with wmr_, counters end with _total, and latencies
+ * with _seconds. Several metrics may share a name, with different labels.
+ */
+struct Metric {
+  std::string name;
+  std::string help;
+  MetricType type;
+  MetricLabels labels;
+
+  /** Value of a counter or gauge. */
+  double value;
+
+  /** Distribution of a summary. Its stage is null; the labels tell summaries apart. */
+  StageLatency latency;
+};
+
+/** Format metrics in the Prometheus text exposition format. Latencies are given in seconds. */
+WUMBO_PUBLIC std::string FormatPrometheus(const std::vector<Metric>& metrics);
+
+}  // namespace wmr
@@ -8,7 +8,12 @@
 #include <cstdint>
 #include <functional>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "headset_options.hpp"
+#include "latency.hpp"
+#include "pooled_ptr.hpp"
 #include "types.hpp"
 
 #ifndef WUMBO_PUBLIC
@@ -22,10 +27,12 @@
 namespace wmr {
 
 struct WUMBO_PUBLIC OasisHidInterface {
-  using ImuFrameHandle = std::shared_ptr<const ImuFrame>;
+  using ImuFrameHandle = PooledPtr<const ImuFrame>;
 
-  /** Callback shall return true if it should be called again. */
-  using ImuFrameCallback = std::function<bool(ImuFrameHandle)>;
+  /** Callback shall return true if it should be called again. Copy the handle to keep the frame
+   * beyond the call.
+   */
+  using ImuFrameCallback = std::function<bool(const ImuFrameHandle&)>;
 
   virtual ~OasisHidInterface() = default;
 
@@ -33,7 +40,23 @@ struct WUMBO_PUBLIC OasisHidInterface {
 
   virtual void StopImu() = 0;
 
-  virtual void RegisterImuFrameCallback(ImuFrameCallback cb) = 0;
+  virtual void RegisterImuFrameCallback(ImuFrameCallback cb, const CallbackQueueOptions& queue) = 0;
+
+  /** Run cb on the thread that reads IMU reports. */
+  void RegisterImuFrameCallback(ImuFrameCallback cb) {
+    RegisterImuFrameCallback(std::move(cb), {});
+  }
+
+  /** Latency of each stage of IMU frame processing, since the device was opened:
+   * - "hid": received_timestamp - host_timestamp of each frame, i.e. how much longer it took to
+   *   arrive than the quickest frames.
+   * - "validate": from received_timestamp until the report was found valid.
+   * - "unpack": from received_timestamp until the frame was filled in.
+   * - "callback_entry" and "callback_exit": from received_timestamp until each IMU frame callback
+   *   was called, and until it returned.
+   * These are also logged at debug level by StopImu.
+   */
+  virtual std::vector<StageLatency> GetLatency() = 0;
 
   virtual std::string ReadCalibration() = 0;
 
@@ -0,0 +1,114 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace wmr {
+
+/** Reference count embedded in each entry of a frame pool.
+ * The driver derives its pool entries from this, so that handing out a frame takes no allocation
+ * (unlike std::shared_ptr, which needs a control block per frame).
+ */
+class PooledObject {
+ protected:
+  PooledObject() = default;
+  ~PooledObject() = default;
+
+  PooledObject(const PooledObject&) = delete;
+  PooledObject& operator=(const PooledObject&) = delete;
+
+  /** Called once the last PooledPtr referencing this object is dropped. */
+  virtual void Recycle() noexcept = 0;
+
+  /** Start handing the object out again, with one reference for the caller to adopt. */
+  void ResetRefs() { refs_.store(1, std::memory_order_relaxed); }
+
+ private:
+  template <class T>
+  friend class PooledPtr;
+
+  void AddRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  void Release() {
+    // The sole owner can skip the read-modify-write, since nobody else can be copying its reference
+    if (refs_.load(std::memory_order_acquire) == 1 ||
+        refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      Recycle();
+    }
+  }
+
+  std::atomic<uint32_t> refs_{};
+};
+
+/** Shared reference to a frame that lives in a pool, and goes back to it once the last reference is
+ * dropped. Works like a std::shared_ptr, minus weak references and custom deleters. Copying costs
+ * one atomic increment; moving, and passing by reference, cost nothing.
+ */
+template <class T>
+class PooledPtr {
+ public:
+  PooledPtr() = default;
+  PooledPtr(std::nullptr_t) {}
+
+  /** Adopt a reference to ptr, which is owned by owner. Used by frame pools. */
+  PooledPtr(T* ptr, PooledObject* owner) : ptr_(ptr), owner_(owner) {}
+
+  PooledPtr(const PooledPtr& other) : ptr_(other.ptr_), owner_(other.owner_) {
+    if (owner_) owner_->AddRef();
+  }
+
+  PooledPtr(PooledPtr&& other) noexcept
+      : ptr_(std::exchange(other.ptr_, nullptr)), owner_(std::exchange(other.owner_, nullptr)) {}
+
+  /** E.g. PooledPtr<const Frame> from PooledPtr<Frame>. */
+  template <class U, class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  PooledPtr(const PooledPtr<U>& other) : ptr_(other.ptr_), owner_(other.owner_) {
+    if (owner_) owner_->AddRef();
+  }
+
+  template <class U, class = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  PooledPtr(PooledPtr<U>&& other) noexcept
+      : ptr_(std::exchange(other.ptr_, nullptr)), owner_(std::exchange(other.owner_, nullptr)) {}
+
+  ~PooledPtr() { reset(); }
+
+  PooledPtr& operator=(PooledPtr other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  void reset() {
+    if (owner_) std::exchange(owner_, nullptr)->Release();
+    ptr_ = nullptr;
+  }
+
+  void swap(PooledPtr& other) noexcept {
+    std::swap(ptr_, other.ptr_);
+    std::swap(owner_, other.owner_);
+  }
+
+  T* get() const { return ptr_; }
+  T& operator*() const { return *ptr_; }
+  T* operator->() const { return ptr_; }
+  explicit operator bool() const { return ptr_ != nullptr; }
+
+  friend bool operator==(const PooledPtr& p, std::nullptr_t) { return !p; }
+  friend bool operator!=(const PooledPtr& p, std::nullptr_t) { return static_cast<bool>(p); }
+
+ private:
+  template <class U>
+  friend class PooledPtr;
+
+  T* ptr_{};
+  PooledObject* owner_{};
+};
+
+}  // namespace wmr
@@ -0,0 +1,33 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <string>
+
+#ifndef WUMBO_PUBLIC
+#if defined _WIN32 || defined __CYGWIN__
+#define WUMBO_PUBLIC __declspec(dllimport)
+#else
+#define WUMBO_PUBLIC
+#endif
+#endif
+
+namespace wmr {
+
+/** Whether the driver was built with event tracing (meson configure -Dtracing=true).
+ * With tracing, each driver thread records what it's doing (receiving transfers, validating and
+ * unpacking frames, reading HID reports, running callbacks) into a ring buffer of its own, which
+ * holds the most recent events.
+ */
+WUMBO_PUBLIC bool TracingEnabled();
+
+/** Write the events in every thread's trace buffer to path, as Chrome trace event JSON. Open it in
+ * ui.perfetto.dev or chrome://tracing. Returns false if tracing isn't built in. Throws
+ * std::runtime_error if the file can't be written.
+ */
+WUMBO_PUBLIC bool WriteChromeTrace(const std::string& path);
+
+}  // namespace wmr
@@ -5,10 +5,12 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <memory>
 #include <stdexcept>
 
@@ -25,6 +27,9 @@ namespace wmr {
 /** Timestamp with 100ns precision. */
 using Timestamp = std::chrono::duration<int64_t, std::ratio<1, 10000000>>;
 
+/** Point in time on the host's monotonic clock (CLOCK_MONOTONIC on Linux). */
+using HostTimestamp = std::chrono::steady_clock::time_point;
+
 struct WUMBO_PUBLIC ImuFrame {
   static constexpr std::size_t kSamplesPerFrame = 4;
   static constexpr std::size_t kGyroOversampling = 8;
@@ -50,6 +55,109 @@ struct WUMBO_PUBLIC ImuFrame {
   std::array<GyroSample, kGyroOversampling * kSamplesPerFrame> gyro_samples;
   std::array<MagnetoSample, kSamplesPerFrame> magneto_samples;
   std::size_t magneto_sample_count; /**< Number of samples in magneto_samples. */
+
+  /** Timestamp of the last accelerometer sample, on the host clock.
+   * Sample timestamps are in device time. The driver estimates the offset and drift between the two
+   * clocks from when reports arrive, so device times map to the earliest the host could have
+   * received them: they trail the true sample times by the smallest transport delay. Camera frames
+   * share the mapping. To convert another sample's timestamp t, add
+   * t - accel_samples.back().timestamp.
+   */
+  HostTimestamp host_timestamp;
+
+  /** When the driver read the report carrying this frame from hidapi. */
+  HostTimestamp received_timestamp;
+};
+
+/** Read-only view of one image of a CameraFrame.
+ * Rows are visited in order with RowIterator. Usually each row is a single contiguous run of
+ * pixels, but in zero-copy frames a row that straddles a USB segment boundary is split in two.
+ */
+class WUMBO_PUBLIC CameraImageView {
+ public:
+  using Pixel = uint8_t;
+
+  /** One row of the image, as a head run followed by a (possibly empty) tail run. */
+  struct Row {
+    const Pixel* head;
+    uint32_t head_size;
+    const Pixel* tail;
+    uint32_t tail_size;
+  };
+
+  /** Where to find one row of an image, relative to the start of a raw frame. */
+  struct RowLayout {
+    uint32_t head_offset;
+    uint32_t tail_offset;
+    uint32_t head_size;
+  };
+
+  class RowIterator {
+   public:
+    using iterator_category = std::input_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = Row;
+    using pointer = const Row*;
+    using reference = Row;
+
+    RowIterator(const CameraImageView& view, uint32_t row) : view_(&view), row_(row) {}
+
+    Row operator*() const { return view_->GetRow(row_); }
+
+    RowIterator& operator++() {
+      ++row_;
+      return *this;
+    }
+
+    RowIterator operator++(int) {
+      RowIterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    friend bool operator==(const RowIterator& a, const RowIterator& b) { return a.row_ == b.row_; }
+    friend bool operator!=(const RowIterator& a, const RowIterator& b) { return a.row_ != b.row_; }
+
+   private:
+    const CameraImageView* view_;
+    uint32_t row_;
+  };
+
+  /** View of a contiguous image. */
+  CameraImageView(const Pixel* image, uint32_t width, uint32_t height)
+      : base_(image), rows_(nullptr), width_(width), height_(height) {}
+
+  /** View of an image scattered about a raw frame, as described by one RowLayout per row. */
+  CameraImageView(const Pixel* raw_frame, const RowLayout* rows, uint32_t width, uint32_t height)
+      : base_(raw_frame), rows_(rows), width_(width), height_(height) {}
+
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+
+  Row GetRow(uint32_t n) const {
+    if (!rows_) return {base_ + n * width_, width_, nullptr, 0};
+
+    auto& layout = rows_[n];
+    return {base_ + layout.head_offset, layout.head_size, base_ + layout.tail_offset,
+            width_ - layout.head_size};
+  }
+
+  RowIterator begin() const { return {*this, 0}; }
+  RowIterator end() const { return {*this, height_}; }
+
+  /** Copy the image into dst, which must have room for width() * height() pixels. */
+  void MaterializeContiguous(Pixel* dst) const {
+    for (auto row : *this) {
+      dst = std::copy(row.head, row.head + row.head_size, dst);
+      dst = std::copy(row.tail, row.tail + row.tail_size, dst);
+    }
+  }
+
+ private:
+  const Pixel* base_;
+  const RowLayout* rows_;
+  uint32_t width_;
+  uint32_t height_;
 };
 
 class WUMBO_PUBLIC CameraFrame {
@@ -61,33 +169,171 @@ class WUMBO_PUBLIC CameraFrame {
     kController,
   };
 
+  /** Every image (and pyramid level) starts on a boundary of this many bytes. */
+  static constexpr std::size_t kAlignment = 64;
+
   CameraFrame(uint32_t image_width, uint32_t image_height, uint8_t image_count)
+      : CameraFrame(image_width, image_height, image_count, nullptr) {}
+
+  /** Construct a zero-copy frame, or a regular frame if row_layouts is null.
+   * A zero-copy frame doesn't own any pixels. Its images are read in place from a raw frame, as
+   * described by row_layouts, which holds image_height entries for each image in turn.
+   * A regular frame also has room for pyramid_levels downsampled copies of each image, stored after
+   * the full-resolution images. Zero-copy frames can't have a pyramid.
+   */
+  CameraFrame(uint32_t image_width, uint32_t image_height, uint8_t image_count,
+              const CameraImageView::RowLayout* row_layouts, uint8_t pyramid_levels = 0)
+      : image_width(image_width),
+        image_height(image_height),
+        image_size(image_width * image_height),
+        image_count(image_count),
+        pyramid_levels(row_layouts ? 0 : pyramid_levels),
+        image_mask(AllImages(image_count)),
+        row_layouts_(row_layouts) {
+    if (!row_layouts) {
+      // Left uninitialized, since every frame is written before it's handed out
+      auto size = StorageSize(image_width, image_height, image_count, pyramid_levels);
+      owned_.reset(new Pixel[size + kAlignment - 1]);
+      auto address = reinterpret_cast<std::uintptr_t>(owned_.get());
+      data_ = owned_.get() + (kAlignment - address % kAlignment) % kAlignment;
+    }
+  }
+
+  /** Construct a regular frame whose pixels live in storage.
+   * storage must be aligned to kAlignment, hold at least StorageSize(...) bytes, and outlive the
+   * frame. Lets a pool carve many frames out of a single allocation.
+   */
+  CameraFrame(Pixel* storage, uint32_t image_width, uint32_t image_height, uint8_t image_count,
+              uint8_t pyramid_levels = 0)
       : image_width(image_width),
         image_height(image_height),
         image_size(image_width * image_height),
         image_count(image_count),
-        data_(std::make_unique<Pixel[]>(image_size * image_count)) {}
+        pyramid_levels(pyramid_levels),
+        image_mask(AllImages(image_count)),
+        data_(storage) {}
+
+  /** Bytes of pixel storage a regular frame of the given geometry uses. */
+  static std::size_t StorageSize(uint32_t image_width, uint32_t image_height, uint8_t image_count,
+                                 uint8_t pyramid_levels) {
+    return LevelOffset(image_width, image_height, image_count, pyramid_levels + 1);
+  }
+
+  /** True if each image is stored contiguously, and GetImage may be used. */
+  bool IsContiguous() const { return data_ != nullptr; }
 
   const Pixel* GetImage(uint8_t n) const {
     if (n >= image_count) {
       throw std::out_of_range("CameraFrame::GetImage");
     }
-    return data_.get() + n * image_size;
+    if (!data_) {
+      throw std::logic_error("CameraFrame::GetImage: zero-copy frame, use GetImageView");
+    }
+    return data_ + n * ImageStride(image_width, image_height, 0);
   }
 
   Pixel* GetImage(uint8_t n) {
     return const_cast<Pixel*>(static_cast<const CameraFrame*>(this)->GetImage(n));
   }
 
+  uint32_t PyramidWidth(uint8_t level) const { return image_width >> level; }
+  uint32_t PyramidHeight(uint8_t level) const { return image_height >> level; }
+
+  /** Image n, downsampled by 2x2 box filter level times.
+   * Level 0 is the full-resolution image. Each level is PyramidWidth(level) pixels wide and
+   * PyramidHeight(level) high, stored contiguously.
+   */
+  const Pixel* GetPyramidImage(uint8_t n, uint8_t level) const {
+    if (n >= image_count || level > pyramid_levels) {
+      throw std::out_of_range("CameraFrame::GetPyramidImage");
+    }
+    if (!data_) {
+      throw std::logic_error("CameraFrame::GetPyramidImage: zero-copy frame, use GetImageView");
+    }
+    return data_ + LevelOffset(image_width, image_height, image_count, level) +
+           n * ImageStride(image_width, image_height, level);
+  }
+
+  Pixel* GetPyramidImage(uint8_t n, uint8_t level) {
+    return const_cast<Pixel*>(static_cast<const CameraFrame*>(this)->GetPyramidImage(n, level));
+  }
+
+  /** Works for both regular and zero-copy frames. */
+  CameraImageView GetImageView(uint8_t n) const {
+    if (n >= image_count) {
+      throw std::out_of_range("CameraFrame::GetImageView");
+    }
+    if (data_) {
+      return {GetImage(n), image_width, image_height};
+    } else {
+      return {raw_frame_, row_layouts_ + n * image_height, image_width, image_height};
+    }
+  }
+
   Timestamp timestamp;
+
+  /** timestamp on the host clock. See ImuFrame::host_timestamp. */
+  HostTimestamp host_timestamp;
+
+  /** When the USB transfer carrying this frame completed. */
+  HostTimestamp received_timestamp;
+
   Type type;
   uint32_t image_width;
   uint32_t image_height;
   uint32_t image_size;
   uint8_t image_count;
+  uint8_t pyramid_levels; /**< Number of downsampled levels above the full-resolution images. */
+
+  /** Bit n is set if image n holds this frame's pixels.
+   * Images no subscriber asked for (see FrameSubscription) aren't unpacked, and hold stale data.
+   */
+  uint32_t image_mask;
+
+  /** An image_mask with a bit set for each of image_count images. */
+  static constexpr uint32_t AllImages(uint8_t image_count) {
+    return image_count >= 32 ? UINT32_MAX : (uint32_t{1} << image_count) - 1;
+  }
+
+  /** Only the driver can make one of these, so only it can attach raw frames. */
+  class RawFrameKey;
+
+  /** Read a zero-copy frame's images from raw_frame, held by owner until it's detached. */
+  void AttachRawFrame(const RawFrameKey&, const Pixel* raw_frame, void* owner) {
+    raw_frame_ = raw_frame;
+    raw_owner_ = owner;
+  }
+
+  /** Forget the raw frame, and return what held it. */
+  void* DetachRawFrame(const RawFrameKey&) {
+    raw_frame_ = nullptr;
+    auto owner = raw_owner_;
+    raw_owner_ = nullptr;
+    return owner;
+  }
 
  private:
-  std::unique_ptr<Pixel[]> data_;
+  /** Distance between consecutive images of the given pyramid level. */
+  static std::size_t ImageStride(uint32_t image_width, uint32_t image_height, uint8_t level) {
+    auto size = std::size_t{image_width >> level} * (image_height >> level);
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  /** Offset of the images of the given pyramid level into data_. */
+  static std::size_t LevelOffset(uint32_t image_width, uint32_t image_height, uint8_t image_count,
+                                 uint8_t level) {
+    std::size_t offset = 0;
+    for (uint8_t l = 0; l < level; ++l) {
+      offset += ImageStride(image_width, image_height, l) * image_count;
+    }
+    return offset;
+  }
+
+  std::unique_ptr<Pixel[]> owned_;
+  Pixel* data_{};
+  const CameraImageView::RowLayout* row_layouts_{};
+  const Pixel* raw_frame_{};
+  void* raw_owner_{}; /**< What holds raw_frame_, released along with the frame. */
 };
 
 }  // namespace wmr
\ No newline at end of file
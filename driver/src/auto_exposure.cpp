@@ -0,0 +1,52 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "auto_exposure.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace wmr {
+
+bool AutoExposure::Update(const LumaHistogram& histogram, uint16_t& exposure, uint16_t& gain) {
+  if (++frames_since_update_ < options_.interval || histogram.count == 0) return false;
+  frames_since_update_ = 0;
+
+  // Mean pixel value, taking the center of each bin
+  double sum = 0;
+  for (std::size_t i = 0; i < LumaHistogram::kBinCount; ++i) {
+    sum += (static_cast<double>(i << LumaHistogram::kBinShift) +
+            (1 << LumaHistogram::kBinShift) / 2.0) *
+           histogram.bins[i];
+  }
+  double mean = std::max(sum / histogram.count, 1.0);
+  double saturated = static_cast<double>(histogram.bins.back()) / histogram.count;
+
+  // Back off regardless of the mean if too much of the image is blown out
+  double scale = options_.target_mean / mean;
+  if (saturated > options_.max_saturated_fraction) scale = std::min(scale, 0.8);
+
+  if (std::abs(scale - 1) < options_.deadband) return false;
+
+  // Damp the step, and limit it to a factor of two either way
+  scale = std::clamp(std::sqrt(scale), 0.5, 2.0);
+
+  // Spend the new total on exposure first, then on gain
+  double min_exposure = options_.min_exposure, max_exposure = options_.max_exposure;
+  double min_gain = options_.min_gain, max_gain = options_.max_gain;
+  double total = std::max<double>(exposure, 1) * std::max<double>(gain, 1) * scale;
+
+  auto new_exposure =
+      static_cast<uint16_t>(std::clamp(total / min_gain, min_exposure, max_exposure));
+  auto new_gain = static_cast<uint16_t>(std::clamp(total / new_exposure, min_gain, max_gain));
+
+  if (new_exposure == exposure && new_gain == gain) return false;
+
+  exposure = new_exposure;
+  gain = new_gain;
+  return true;
+}
+
+}  // namespace wmr
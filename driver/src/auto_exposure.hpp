@@ -0,0 +1,35 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstdint>
+
+#include <wmr/headset_options.hpp>
+
+#include "luma_histogram.hpp"
+
+namespace wmr {
+
+/** Exposure and gain controller for one camera type.
+ * Steers the mean pixel value towards a target by scaling the product of exposure and gain. Longer
+ * exposure is preferred over more gain, since gain adds noise. Steps are damped, and only taken
+ * every few frames so that the previous step has had time to show up in the images.
+ */
+class AutoExposure {
+ public:
+  explicit AutoExposure(const AutoExposureOptions& options) : options_(options) {}
+
+  /** Feed the histogram of the latest frame.
+   * Returns true if exposure and gain (which hold the current settings on entry) were changed.
+   */
+  bool Update(const LumaHistogram& histogram, uint16_t& exposure, uint16_t& gain);
+
+ private:
+  AutoExposureOptions options_;
+  unsigned frames_since_update_{};
+};
+
+}  // namespace wmr
@@ -0,0 +1,175 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <wmr/headset_options.hpp>
+
+#include "trace.hpp"
+
+namespace wmr {
+
+/** Runs a frame callback on a worker thread of its own, fed through a bounded queue.
+ * The producer only ever holds the queue's mutex long enough to push a handle, never while the
+ * callback runs, so a slow callback can't hold up the thread delivering frames (except with
+ * QueueOverflow::kBlock, which waits for it on purpose, up to a timeout).
+ */
+template <class Handle>
+class CallbackQueue {
+ public:
+  using Callback = std::function<bool(const Handle&)>;
+
+  struct Stats {
+    uint64_t delivered;               /**< Frames passed to the callback. */
+    uint64_t dropped;                 /**< Frames discarded because the queue was full. */
+    std::size_t queued;               /**< Frames waiting right now. */
+    std::size_t max_queued;           /**< Most frames ever waiting at once. */
+    std::chrono::nanoseconds max_lag; /**< Longest time a frame waited before delivery. */
+  };
+
+  CallbackQueue(Callback callback, const CallbackQueueOptions& options)
+      : callback_(std::move(callback)),
+        options_(options),
+        depth_(options.on_overflow == QueueOverflow::kLatestOnly
+                   ? 1
+                   : std::max<std::size_t>(options.depth, 1)),
+        ring_(depth_),
+        worker_([this]() { Run(); }) {}
+
+  /** Discards any queued frames. Waits for a callback that's already running to return. */
+  ~CallbackQueue() {
+    {
+      std::lock_guard l{m_};
+      stopping_ = true;
+    }
+    ready_cv_.notify_one();
+    room_cv_.notify_all();
+    worker_.join();
+  }
+
+  CallbackQueue(const CallbackQueue&) = delete;
+  CallbackQueue& operator=(const CallbackQueue&) = delete;
+
+  /** Queue handle for the callback.
+   * Returns false once the callback has asked not to be called again, after which the queue may be
+   * destroyed without waiting on it.
+   */
+  bool Push(const Handle& handle) {
+    std::unique_lock l{m_};
+    if (finished_) return false;
+
+    if (count_ == depth_) {
+      switch (options_.on_overflow) {
+        case QueueOverflow::kLatestOnly:
+        case QueueOverflow::kDropOldest:
+          PopFront();
+          ++dropped_;
+          WMR_TRACE_INSTANT("CallbackQueue overflow");
+          break;
+
+        case QueueOverflow::kBlock:
+          if (!room_cv_.wait_for(l, options_.block_timeout, [this]() {
+                return count_ < depth_ || finished_ || stopping_;
+              })) {
+            ++dropped_;
+            return true;
+          }
+          if (finished_) return false;
+          break;
+      }
+    }
+
+    ring_[(head_ + count_++) % depth_] = {handle, std::chrono::steady_clock::now()};
+    max_queued_ = std::max(max_queued_, count_);
+    l.unlock();
+    ready_cv_.notify_one();
+    return true;
+  }
+
+  Stats GetStats() const {
+    std::lock_guard l{m_};
+    return {delivered_, dropped_, count_, max_queued_, max_lag_};
+  }
+
+ private:
+  struct Entry {
+    Handle handle;
+    std::chrono::steady_clock::time_point queued_at;
+  };
+
+  /** Remove the oldest entry and return it. Call with m_ held. */
+  Entry PopFront() {
+    auto entry = std::move(ring_[head_]);
+    ring_[head_].handle = nullptr;
+    head_ = (head_ + 1) % depth_;
+    --count_;
+    return entry;
+  }
+
+  void Run() {
+    WMR_TRACE_THREAD_NAME("CallbackQueue worker");
+
+    std::unique_lock l{m_};
+    while (true) {
+      ready_cv_.wait(l, [this]() { return count_ > 0 || stopping_; });
+      if (stopping_) break;
+
+      auto entry = PopFront();
+      max_lag_ = std::max<std::chrono::nanoseconds>(
+          max_lag_, std::chrono::steady_clock::now() - entry.queued_at);
+      ++delivered_;
+      l.unlock();
+      room_cv_.notify_one();
+
+      bool again = callback_(entry.handle);
+      entry.handle = nullptr;
+
+      l.lock();
+      if (!again) {
+        // Release the queued frames now, rather than whenever the subscriber is next dispatched to
+        finished_ = true;
+        while (count_ > 0) PopFront();
+        room_cv_.notify_all();
+        break;
+      }
+    }
+  }
+
+  Callback callback_;
+  CallbackQueueOptions options_;
+  std::size_t depth_;
+
+  mutable std::mutex m_;
+  std::condition_variable ready_cv_; /**< Signals the worker that ring_ is non-empty. */
+  std::condition_variable room_cv_;  /**< Signals a blocked Push that ring_ has room. */
+
+  // Ring of depth_ entries, allocated up front so that queueing never allocates
+  std::vector<Entry> ring_;
+  std::size_t head_{};
+  std::size_t count_{};
+
+  bool stopping_{};
+  bool finished_{};
+
+  uint64_t delivered_{};
+  uint64_t dropped_{};
+  std::size_t max_queued_{};
+  std::chrono::nanoseconds max_lag_{};
+
+  // Last, so that everything it uses is constructed first
+  std::thread worker_;
+};
+
+}  // namespace wmr
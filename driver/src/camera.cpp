@@ -8,74 +8,81 @@
 #include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <future>
 #include <iterator>
 #include <stdexcept>
 
-#include <libusbcpp/error.hpp>
 #include <libusbcpp/transfer.hpp>
 
+#include "trace.hpp"
+
 namespace wmr {
 
-Camera::Camera(const HeadsetSpec& spec, libusbcpp::Device::Pointer dev)
+Camera::Camera(const HeadsetSpec& spec, const CameraOptions& options,
+               std::unique_ptr<CameraTransport> transport, std::shared_ptr<ClockSync> clock_sync,
+               std::shared_ptr<MetricsRegistry> metrics)
     : spec_(spec),
-      dev_handle_(dev->Open()),
-      frame_pool_(kFramePoolSize, spec_.camera_width, spec.camera_height, spec_.n_cameras) {
-  // Get the config descriptor
-  libusbcpp::Device::ConfigDescriptor config;
-  try {
-    config = dev->GetActiveConfigDescriptor();
-  } catch (libusbcpp::Error<libusbcpp::c::LIBUSB_ERROR_NOT_FOUND>&) {
-    dev_handle_->SetConfiguration(1);
-    config = dev->GetActiveConfigDescriptor();
-  }
-
-  // Find the interface descriptor for kInterfaceNumber
-  const libusbcpp::c::libusb_interface_descriptor* iface_desc = nullptr;
-  for (uint8_t i = 0; i < config->bNumInterfaces; ++i) {
-    auto* d = config->interface[i].altsetting;  // only consider altsetting[0]
-    if (d->bInterfaceNumber == kInterfaceNumber) {
-      iface_desc = d;
-      break;
-    }
-  }
-  if (!iface_desc) {
-    throw std::runtime_error("Device doesn't have interface number kInterfaceNumber");
+      options_(options),
+      copy_plan_(spec_),
+      unpack_pool_(options_.unpack_threads > 1
+                       ? std::make_unique<ThreadPool>(options_.unpack_threads)
+                       : nullptr),
+      // Large frames are copied with non-temporal stores, so they don't evict everything else.
+      // Not when building a pyramid though, which reads each row back right after it's copied.
+      unpacker_(copy_plan_,
+                spec_.camera_frame_size >= kNonTemporalThreshold &&
+                    PyramidLevels(spec_, options_) == 0,
+                unpack_pool_.get(), options_.unpack_min_chunk_size,
+                [this](const uint8_t* frame, std::size_t segment_idx) {
+                  return ValidateSegmentHeader(frame, segment_idx);
+                }),
+      transport_(std::move(transport)),
+      completed_rx_transactions_(RxTransferCount(options_)),
+      completed_rx_transactions_waiter_(options_.stream_wait, options_.stream_spin_iterations),
+      metrics_(std::move(metrics)),
+      rx_errors_(*metrics_),
+      stream_metrics_(*metrics_),
+      frame_pool_(MakeFramePool()),
+      clock_sync_(std::move(clock_sync)),
+      latency_(*metrics_, "wmr_camera_latency_seconds",
+               "Time from USB transfer completion until each stage of camera frame processing",
+               {"usb", "validate", "unpack", "callback_entry", "callback_exit"}) {
+  if (options_.auto_exposure.enable) {
+    auto_exposure_.assign(spec_.n_cameras, AutoExposure(options_.auto_exposure));
   }
 
-  // Search for a read/write pair of bulk endpoints
-  read_ep_ = 0xF0;  // 0xF0 is an invalid address
-  write_ep_ = 0xF0;
-  for (uint8_t j = 0; j < iface_desc->bNumEndpoints; ++j) {
-    auto& ep_desc = iface_desc->endpoint[j];
-    if ((ep_desc.bmAttributes & 0x3) != libusbcpp::c::LIBUSB_TRANSFER_TYPE_BULK) continue;
-
-    if (ep_desc.bEndpointAddress & libusbcpp::c::LIBUSB_ENDPOINT_IN && read_ep_ == 0xF0) {
-      read_ep_ = ep_desc.bEndpointAddress;
-    } else if (write_ep_ == 0xF0) {
-      write_ep_ = ep_desc.bEndpointAddress;
-    } else {
-      throw std::runtime_error("Interface has multiple bulk endpoint pairs");
-    }
-  }
-  if (read_ep_ == 0xF0 || write_ep_ == 0xF0) {
-    throw std::runtime_error("Bulk endpoint pair not found");
+  if (options_.zero_copy && options_.pyramid_levels > 0) {
+    spdlog::warn("Camera: Zero-copy frames can't have an image pyramid, ignoring pyramid_levels");
   }
 
-  spdlog::debug("Camera found endpoints on interface {}: r:{:x} w::{:x}", kInterfaceNumber,
-                read_ep_, write_ep_);
+  if (options_.zero_copy) {
+    // Hand each frame's transfer back to the ring once the last reference to the frame is dropped.
+    // That happens before the frame goes back to the pool, since ~FramePool is what keeps *this
+    // alive until then.
+    frame_pool_->SetRecycleHook([this](CameraFrame& frame) {
+      auto trans = static_cast<libusbcpp::TransferStruct*>(frame.DetachRawFrame({}));
+      if (trans) ReleaseTransfer(trans);
+    });
+  }
 
-  iface_claim_hnd_ = dev_handle_->ClaimInterface(kInterfaceNumber);
+  frame_callbacks_.reserve(kMaxFrameSubscribers);
 
   // Gratuitous stop command
   SendStartStopCommand(false);
 
   // Allocate transfers
-  for (std::size_t i = 0; i < kRxSlotCount; ++i) {
-    auto& trans = rx_transfers_.emplace_back(dev_handle_->AllocTransfer());
-    auto& buff = rx_buffers_.emplace_back(dev_handle_->DevMemAlloc(spec_.camera_xfer_size));
-    trans->FillBulkTransfer(read_ep_, buff.get(), spec_.camera_xfer_size, TransferCallback, this,
-                            0);
-  }
+  CameraTransport::RxConfig rx_config{};
+  rx_config.buffer_size = spec_.camera_xfer_size;
+  rx_config.capacity = RxTransferCount(options_);
+  rx_config.depth = options_.rx_depth;
+  rx_config.min_depth = options_.rx_min_depth;
+  rx_config.max_depth = options_.rx_max_depth;
+  rx_config.adaptive = options_.rx_adaptive_depth;
+  rx_config.callback = TransferCallback;
+  rx_config.user_data = this;
+  transport_->OpenRx(rx_config);
 }
 
 void Camera::StartStream() {
@@ -83,17 +90,16 @@ void Camera::StartStream() {
   spdlog::trace("Camera::StartStream");
 
   // Reset state
-  got_first_frame_ = false;
+  sync_state_ = SyncState::kSearching;
+  streaming_ = true;
 
   // Start looped transfers
-  for (auto& trans : rx_transfers_) {
-    trans->AsStruct()->Submit();
-    ++outstanding_transfer_count_;
-  }
+  transport_->StartRx();
 
-  // Start consuming completed transfers
-  streaming_ = true;
-  stream_thread_ = std::thread([this]() { Stream(); });
+  // Start consuming completed transfers. In inline mode, TransferCallback does that itself.
+  if (options_.dispatch == FrameDispatch::kStreamThread) {
+    stream_thread_ = std::thread([this]() { Stream(); });
+  }
 
   // Start the headset camera
   SendStartStopCommand(true);
@@ -103,165 +109,437 @@ void Camera::StopStream() {
   spdlog::trace("Camera::StopStream");
 
   SendStartStopCommand(false);
-  CancelAllTransfers();
+  streaming_ = false;
+  transport_->StopRx();
+
+  if (options_.dispatch == FrameDispatch::kStreamThread) {
+    // Wake the stream thread, in case there was nothing in flight to cancel
+    completed_rx_transactions_waiter_.Notify();
+    stream_thread_.join();
+  } else {
+    WaitForTransferCallbacks();
+  }
+
+  auto stats = transport_->GetRxStats();
+  spdlog::debug(
+      "Camera::StopStream: rx ring depth={} (min_in_flight={}, underruns={}, increases={}, "
+      "decreases={})",
+      stats.depth, stats.min_in_flight, stats.underruns, stats.depth_increases,
+      stats.depth_decreases);
 
-  stream_thread_.join();
+  auto pool_stats = frame_pool_->GetStats();
+  spdlog::debug(
+      "Camera::StopStream: frame pool size={} (high_water={}, exhaustions={}, drops={}, "
+      "wait_time={}us)",
+      pool_stats.slots, pool_stats.high_water, pool_stats.exhaustions, pool_stats.failures,
+      std::chrono::duration_cast<std::chrono::microseconds>(pool_stats.wait_time).count());
+
+  latency_.Log("Camera::StopStream");
+
+  std::lock_guard l{frame_callbacks_m_};
+  for (auto& subscriber : frame_callbacks_) {
+    if (!subscriber.queue) continue;
+    auto subscriber_stats = subscriber.GetStats();
+    spdlog::debug(
+        "Camera::StopStream: async callback {} delivered={} (dropped={}, max_queued={}, "
+        "max_lag={}us)",
+        subscriber_stats.id, subscriber_stats.delivered, subscriber_stats.dropped,
+        subscriber_stats.max_queued,
+        std::chrono::duration_cast<std::chrono::microseconds>(subscriber_stats.max_lag).count());
+  }
 }
 
 void Camera::SetExpGain(uint16_t camera_type, uint16_t exposure, uint16_t gain) {
+  SendExpGain(camera_type, exposure, gain, nullptr);
+}
+
+std::future<void> Camera::SetExpGainAndNotify(uint16_t camera_type, uint16_t exposure,
+                                              uint16_t gain) {
+  std::promise<void> sent;
+  auto future = sent.get_future();
+  if (!SendExpGain(camera_type, exposure, gain, &sent)) sent.set_value();
+  return future;
+}
+
+bool Camera::SendExpGain(uint16_t camera_type, uint16_t exposure, uint16_t gain,
+                         std::promise<void>* sent) {
+  std::lock_guard l{exp_gain_m_};
   auto& state = exp_gain_state_.at(camera_type);
 
   if (state.exposure == exposure && state.gain == gain && state.cache_use_count < 60) {
     ++state.cache_use_count;
-  } else {
-    spdlog::trace("Camera::SetExpGain: camera_type={} exposure={}, gain={}", camera_type, exposure,
-                  gain);
+    return false;
+  }
 
-    SetExpGainCommand cmd{kMagic, 0x12, 0x80, camera_type, exposure, gain, camera_type};
+  spdlog::trace("Camera::SetExpGain: camera_type={} exposure={}, gain={}", camera_type, exposure,
+                gain);
 
-    int actual_length;
-    dev_handle_->BulkTransfer(write_ep_, reinterpret_cast<uint8_t*>(&cmd), SetExpGainCommand::kSize,
-                              &actual_length, 100);
+  SetExpGainCommand cmd{kMagic, 0x12, 0x80, camera_type, exposure, gain, camera_type};
+  transport_->SendCommand(camera_type, &cmd, SetExpGainCommand::kSize, sent);
 
-    if (actual_length != SetExpGainCommand::kSize) {
-      throw std::runtime_error("BulkTransfer didn't consume all bytes");
-    }
+  state.exposure = exposure;
+  state.gain = gain;
+  state.cache_use_count = 0;
+  return true;
+}
 
-    state.exposure = exposure;
-    state.gain = gain;
-    state.cache_use_count = 0;
+void Camera::SetRectification(uint8_t n, const RectificationMap& map) {
+  if (streaming_) {
+    throw std::runtime_error("Camera::SetRectification: Can't change while streaming");
+  }
+  if (options_.zero_copy) {
+    spdlog::warn("Camera::SetRectification: Zero-copy frames can't be rectified, ignoring");
+    return;
+  }
+
+  if (map.width == 0 || map.height == 0) {
+    unpacker_.SetRemap(n, nullptr);
+  } else {
+    unpacker_.SetRemap(n, std::make_unique<RemapTable>(spec_, copy_plan_, n, map));
   }
 }
 
-void Camera::RegisterFrameCallback(FrameCallback cb) {
+void Camera::RegisterFrameCallback(FrameCallback cb, const FrameSubscription& subscription) {
   std::lock_guard l{frame_callbacks_m_};
-  frame_callbacks_.push_back(std::move(cb));
+  if (frame_callbacks_.size() == kMaxFrameSubscribers) {
+    throw std::runtime_error("Camera::RegisterFrameCallback: Too many frame callbacks");
+  }
+
+  // Time every callback the same way, whichever thread it runs on
+  auto timed_cb = [this, cb = std::move(cb)](const FrameHandle& frame) {
+    WMR_TRACE_SCOPE("Camera frame callback");
+    latency_.RecordSince(kLatencyCallbackEntry, frame->received_timestamp);
+    bool again = cb(frame);
+    latency_.RecordSince(kLatencyCallbackExit, frame->received_timestamp);
+    return again;
+  };
+
+  auto& subscriber = frame_callbacks_.emplace_back();
+  subscriber.id = next_subscriber_id_++;
+  subscriber.subscription = subscription;
+  if (subscription.queue.async) {
+    subscriber.queue =
+        std::make_unique<CallbackQueue<FrameHandle>>(std::move(timed_cb), subscription.queue);
+  } else {
+    subscriber.callback = std::move(timed_cb);
+  }
 }
 
-void Camera::SendStartStopCommand(bool start) {
-  StartStopCommand cmd{kMagic, 0x0c, (uint16_t)(start ? 0x81 : 0x82)};
+CameraStats Camera::GetStats() {
+  auto ring_stats = transport_->GetRxStats();
+
+  CameraStats stats;
+  stats.rx_capacity = ring_stats.capacity;
+  stats.rx_depth = ring_stats.depth;
+  stats.rx_in_flight = ring_stats.in_flight;
+  stats.rx_held = ring_stats.held;
+  stats.rx_min_in_flight = ring_stats.min_in_flight;
+  stats.rx_completions = ring_stats.completions;
+  stats.rx_underruns = ring_stats.underruns;
+  stats.rx_depth_increases = ring_stats.depth_increases;
+  stats.rx_depth_decreases = ring_stats.depth_decreases;
+
+  stats.frames = rx_errors_.frames.Value();
+  stats.size_errors = rx_errors_.size.Value();
+  stats.footer_errors = rx_errors_.footer.Value();
+  stats.segment_magic_errors = rx_errors_.segment_magic.Value();
+  stats.frame_number_errors = rx_errors_.frame_number.Value();
+  stats.frame_gaps = rx_errors_.frame_gaps.Value();
+  stats.resyncs = rx_errors_.resyncs.Value();
+
+  auto pool_stats = frame_pool_->GetStats();
+  stats.frame_pool_size = pool_stats.slots;
+  stats.frame_pool_high_water = pool_stats.high_water;
+  stats.frame_pool_exhaustions = pool_stats.exhaustions;
+  stats.frame_pool_drops = pool_stats.failures;
+  stats.frame_pool_wait_time = pool_stats.wait_time;
+
+  std::lock_guard l{frame_callbacks_m_};
+  for (auto& subscriber : frame_callbacks_) stats.subscribers.push_back(subscriber.GetStats());
+  return stats;
+}
 
-  int actual_length;
-  dev_handle_->BulkTransfer(write_ep_, reinterpret_cast<uint8_t*>(&cmd), StartStopCommand::kSize,
-                            &actual_length, 100);
+uint8_t Camera::PyramidLevels(const HeadsetSpec& spec, const CameraOptions& options) {
+  if (options.zero_copy) return 0;
 
-  if (actual_length != StartStopCommand::kSize) {
-    throw std::runtime_error("BulkTransfer didn't consume all bytes");
+  // Stop before either dimension would shrink to nothing
+  uint8_t levels = 0;
+  while (levels < options.pyramid_levels && (spec.camera_width >> (levels + 1)) > 0 &&
+         (spec.camera_height >> (levels + 1)) > 0) {
+    ++levels;
   }
+  return levels;
 }
 
-void Camera::Stream() {
-  spdlog::trace("Camera::ReadFrames: thread started");
+std::size_t Camera::RxTransferCount(const CameraOptions& options) {
+  // One spare covers the transfer being processed by the stream thread
+  auto& pool = options.frame_pool;
+  auto pool_capacity = pool.on_exhaustion == PoolExhaustion::kGrow
+                           ? std::max(pool.size, pool.max_size)
+                           : pool.size;
+  return options.rx_max_depth + 1 + (options.zero_copy ? pool_capacity : 0);
+}
 
-  while (outstanding_transfer_count_) {
-    std::unique_lock l{completed_rx_transactions_m_};
-    completed_rx_transactions_cv_.wait(l, [this]() { return !completed_rx_transactions_.empty(); });
+std::unique_ptr<FramePool<CameraFrame>> Camera::MakeFramePool() const {
+  if (options_.zero_copy) {
+    return std::make_unique<FramePool<CameraFrame>>(options_.frame_pool, spec_.camera_width,
+                                                    spec_.camera_height, spec_.n_cameras,
+                                                    copy_plan_.RowLayouts());
+  }
 
-    auto trans = completed_rx_transactions_.front();
-    completed_rx_transactions_.pop();
-    l.unlock();
+  auto levels = PyramidLevels(spec_, options_);
+  FramePool<CameraFrame>::SlabStorage storage{
+      CameraFrame::StorageSize(spec_.camera_width, spec_.camera_height, spec_.n_cameras, levels)};
+  return std::make_unique<FramePool<CameraFrame>>(options_.frame_pool, storage, spec_.camera_width,
+                                                  spec_.camera_height, spec_.n_cameras, levels);
+}
 
-    if (trans->status == libusbcpp::c::LIBUSB_TRANSFER_COMPLETED && streaming_) {
-      // Handle then resubmit this transfer
-      HandleFrame(trans);
-      trans->Submit();
-    } else {
-      // Don't resubmit, we're done.
+void Camera::SendStartStopCommand(bool start) {
+  StartStopCommand cmd{kMagic, 0x0c, (uint16_t)(start ? 0x81 : 0x82)};
+  transport_->WriteCommand(&cmd, StartStopCommand::kSize);
+}
 
-      if (outstanding_transfer_count_ == kRxSlotCount) {
-        spdlog::trace("Camera::Stream: Reaping transfers...");
-        SendStartStopCommand(false);
-        CancelAllTransfers();
-        streaming_ = false;
-      }
-      --outstanding_transfer_count_;
-
-      switch (trans->status) {
-        case libusbcpp::c::LIBUSB_TRANSFER_COMPLETED:
-          spdlog::trace(
-              "Camera::Stream: Reap transfer w/ status "
-              "LIBUSB_TRANSFER_COMPLETED");
-          break;
-        case libusbcpp::c::LIBUSB_TRANSFER_CANCELLED:
-          spdlog::trace(
-              "Camera::Stream: Reap transfer w/ status "
-              "LIBUSB_TRANSFER_CANCELLED");
-          break;
-        case libusbcpp::c::LIBUSB_TRANSFER_ERROR:
-          spdlog::error("Camera::Stream: Reap transfer w/ status LIBUSB_TRANSFER_ERROR");
-          break;
-        case libusbcpp::c::LIBUSB_TRANSFER_TIMED_OUT:
-          spdlog::error(
-              "Camera::Stream: Reap transfer w/ status "
-              "LIBUSB_TRANSFER_TIMED_OUT");
-          break;
-        case libusbcpp::c::LIBUSB_TRANSFER_STALL:
-          spdlog::error("Camera::Stream: Reap transfer w/ status LIBUSB_TRANSFER_STALL");
-          break;
-        case libusbcpp::c::LIBUSB_TRANSFER_NO_DEVICE:
-          spdlog::error(
-              "Camera::Stream: Reap transfer w/ status "
-              "LIBUSB_TRANSFER_NO_DEVICE");
-          break;
-        case libusbcpp::c::LIBUSB_TRANSFER_OVERFLOW:
-          spdlog::error(
-              "Camera::Stream: Reap transfer w/ status "
-              "LIBUSB_TRANSFER_OVERFLOW");
-          break;
-      }
-    }
+void Camera::Stream() {
+  spdlog::trace("Camera::ReadFrames: thread started");
+  WMR_TRACE_THREAD_NAME("Camera stream");
+
+  CompletedTransfer completed;
+  while (PopCompletedTransfer(completed)) {
+    ProcessTransfer(completed);
   }
 
   spdlog::trace("Camera::ReadFrames: thread exiting");
 }
 
-void Camera::HandleFrame(const libusbcpp::TransferStruct* trans) {
+void Camera::ProcessTransfer(const CompletedTransfer& completed) {
+  WMR_TRACE_SCOPE("Camera::ProcessTransfer");
+  auto trans = completed.trans;
+  if (static_cast<std::size_t>(trans->status) < StreamMetrics::kTransferStatusCount) {
+    stream_metrics_.transfers[trans->status]->Increment();
+  }
+  if (trans->status == libusbcpp::c::LIBUSB_TRANSFER_COMPLETED && streaming_) {
+    // Handle then recycle this transfer. Zero-copy frames recycle their transfer themselves,
+    // once the last FrameHandle referencing them is dropped, even if HandleFrame throws.
+    bool taken = false;
+    try {
+      HandleFrame(trans, completed.received, taken);
+    } catch (...) {
+      if (!taken) transport_->RecycleRx(trans);
+      throw;
+    }
+    if (!taken) transport_->RecycleRx(trans);
+  } else {
+    // Don't resubmit, we're done.
+    if (streaming_) {
+      spdlog::trace("Camera::ProcessTransfer: Reaping transfers...");
+
+      // Synchronous transfers can't be made from the event thread, so in inline mode the stop
+      // command is left to StopStream.
+      if (options_.dispatch == FrameDispatch::kStreamThread) SendStartStopCommand(false);
+      streaming_ = false;
+      transport_->StopRx();
+    }
+    transport_->RecycleRx(trans);
+
+    switch (trans->status) {
+      case libusbcpp::c::LIBUSB_TRANSFER_COMPLETED:
+        spdlog::trace(
+            "Camera::ProcessTransfer: Reap transfer w/ status "
+            "LIBUSB_TRANSFER_COMPLETED");
+        break;
+      case libusbcpp::c::LIBUSB_TRANSFER_CANCELLED:
+        spdlog::trace(
+            "Camera::ProcessTransfer: Reap transfer w/ status "
+            "LIBUSB_TRANSFER_CANCELLED");
+        break;
+      case libusbcpp::c::LIBUSB_TRANSFER_ERROR:
+        spdlog::error("Camera::ProcessTransfer: Reap transfer w/ status LIBUSB_TRANSFER_ERROR");
+        break;
+      case libusbcpp::c::LIBUSB_TRANSFER_TIMED_OUT:
+        spdlog::error(
+            "Camera::ProcessTransfer: Reap transfer w/ status "
+            "LIBUSB_TRANSFER_TIMED_OUT");
+        break;
+      case libusbcpp::c::LIBUSB_TRANSFER_STALL:
+        spdlog::error("Camera::ProcessTransfer: Reap transfer w/ status LIBUSB_TRANSFER_STALL");
+        break;
+      case libusbcpp::c::LIBUSB_TRANSFER_NO_DEVICE:
+        spdlog::error(
+            "Camera::ProcessTransfer: Reap transfer w/ status "
+            "LIBUSB_TRANSFER_NO_DEVICE");
+        break;
+      case libusbcpp::c::LIBUSB_TRANSFER_OVERFLOW:
+        spdlog::error(
+            "Camera::ProcessTransfer: Reap transfer w/ status "
+            "LIBUSB_TRANSFER_OVERFLOW");
+        break;
+    }
+  }
+}
+
+void Camera::HandleFrame(libusbcpp::TransferStruct* trans, HostTimestamp received, bool& taken) {
+  std::array<LumaHistogram, CopyPlan::kMaxImages> histograms;
+  LumaHistogram* histograms_ptr = nullptr;
+
+  // Held from deciding what to unpack until the frame has been dispatched, so that the set of
+  // subscribers can't change in between
+  std::unique_lock callbacks_lock{frame_callbacks_m_};
+
+  FrameHandle processed_frame;
+  bool valid = false;
+  auto type = CameraFrame::Type::kRoom;
   if (ValidateFrame(trans->buffer, trans->actual_length)) {
-    auto processed_frame = CopyFrame(trans->buffer);
-
-    // Run callbacks
-    std::lock_guard l{frame_callbacks_m_};
-    auto it = frame_callbacks_.begin();
-    while (it != frame_callbacks_.end()) {
-      FrameCallback& cb = *it;
-      auto prev = it;
-      ++it;
-
-      if (!cb(processed_frame)) {
-        frame_callbacks_.erase(prev);
+    auto footer =
+        reinterpret_cast<const FrameFooter*>(trans->buffer + spec_.camera_frame_footer_offset);
+    clock_sync_->AddSample(Timestamp(footer->timestamp), received);
+    latency_.Record(kLatencyUsb, received - clock_sync_->ToHost(Timestamp(footer->timestamp)));
+    latency_.RecordSince(kLatencyValidate, received);
+
+    type = ReadFrameType(trans->buffer);
+    // Auto-exposure only looks at room frames, so don't sample controller frames at all
+    if (type == CameraFrame::Type::kRoom && !auto_exposure_.empty()) {
+      histograms_ptr = histograms.data();
+    }
+
+    uint32_t image_mask;
+    PooledPtr<CameraFrame> pooled_frame;
+    if (WantedImages(type, image_mask)) {
+      pooled_frame = frame_pool_->Allocate();
+      if (pooled_frame) {
+        pooled_frame->received_timestamp = received;
+      } else {
+        stream_metrics_.frames_dropped.Increment();
+        WMR_TRACE_INSTANT("Camera frame pool exhausted");
+        spdlog::warn("Camera::HandleFrame: Frame pool exhausted, dropping frame");
       }
     }
 
-    got_first_frame_ |= true;
+    if (!pooled_frame) {
+      // Nobody wants this frame (or there's nowhere to put it), but it still counts towards sync
+      // and auto-exposure
+      valid = ValidateSegmentHeaders(trans->buffer);
+      if (valid && histograms_ptr) unpacker_.SampleHistograms(trans->buffer, histograms_ptr);
+    } else if (options_.zero_copy) {
+      // Zero-copy frames aren't unpacked, so there's no copy to fuse the sampling into
+      processed_frame = ViewFrame(trans, std::move(pooled_frame));
+      taken = valid = static_cast<bool>(processed_frame);
+      if (valid && histograms_ptr) unpacker_.SampleHistograms(trans->buffer, histograms_ptr);
+    } else if (CopyFrame(trans->buffer, image_mask, histograms_ptr, *pooled_frame)) {
+      processed_frame = std::move(pooled_frame);
+      valid = true;
+    }
+    if (processed_frame) latency_.RecordSince(kLatencyUnpack, received);
+  }
+
+  if (!valid) {
+    // Drop everything until the next complete, valid frame
+    if (sync_state_ == SyncState::kLocked) {
+      spdlog::warn("Camera::HandleFrame: Lost sync, resynchronizing");
+      WMR_TRACE_INSTANT("Camera lost sync");
+      sync_state_ = SyncState::kSearching;
+      rx_errors_.resyncs.Increment();
+    }
+    return;
+  }
 
-  } else if (got_first_frame_) {
-    throw std::runtime_error("Camera::HandleFrame: Encountered invalid frame mid-stream");
+  auto frame_number = reinterpret_cast<const SegmentHeader*>(trans->buffer)->frame_number;
+  switch (sync_state_) {
+    case SyncState::kSearching:
+      spdlog::debug("Camera::HandleFrame: Locked on frame_number={}", frame_number);
+      sync_state_ = SyncState::kLocked;
+      break;
+    case SyncState::kLocked:
+      if (frame_number != prev_frame_number_ + 1) {
+        rx_errors_.frame_gaps.Increment();
+        WMR_TRACE_INSTANT("Camera frame gap");
+        spdlog::warn("Camera::HandleFrame: Dropped frame (prev_frame_number={}, current={})",
+                     prev_frame_number_, frame_number);
+      }
+      break;
   }
+  prev_frame_number_ = frame_number;
+  rx_errors_.frames.Increment();
+
+  DispatchFrame(type, processed_frame);
+  callbacks_lock.unlock();
+
+  stream_metrics_.frame_pool_in_use.Set(frame_pool_->GetStats().in_use);
+  stream_metrics_.rx_in_flight.Set(transport_->RxInFlight());
+
+  if (histograms_ptr) UpdateAutoExposure(histograms_ptr);
 }
 
 void Camera::TransferCallback(libusbcpp::c::libusb_transfer* trans) {
+  WMR_TRACE_SCOPE("Camera::TransferCallback");
   auto cam = static_cast<Camera*>(trans->user_data);
   auto trans_struct = static_cast<libusbcpp::TransferStruct*>(trans);
-  {
-    std::lock_guard l{cam->completed_rx_transactions_m_};
-    cam->completed_rx_transactions_.push(trans_struct);
+  auto received = std::chrono::steady_clock::now();
+
+  ++cam->active_transfer_callbacks_;
+  cam->transport_->OnRxComplete(trans_struct);
+
+  if (cam->capture_) {
+    cam->capture_->Write(capture::RecordType::kCameraTransfer, static_cast<uint16_t>(trans->status),
+                         received,
+                         {trans->buffer, static_cast<std::size_t>(trans->actual_length)});
   }
-  cam->completed_rx_transactions_cv_.notify_one();
-}
 
-void Camera::CancelAllTransfers() {
-  for (auto& trans : rx_transfers_) {
+  if (cam->options_.dispatch == FrameDispatch::kInline) {
+    // Exceptions mustn't unwind into libusb. Stop the stream instead. ProcessTransfer has already
+    // handed trans back, unless a zero-copy frame took it, which does so once it's released.
     try {
-      trans->AsStruct()->Cancel();
-    } catch (libusbcpp::Error<libusbcpp::c::LIBUSB_ERROR_NOT_FOUND>&) {
-      // Transfer is not in progress, already complete, or already cancelled.
+      cam->ProcessTransfer({trans_struct, received});
+    } catch (std::exception& e) {
+      spdlog::error("Camera::TransferCallback: Stopping stream: {}", e.what());
+      cam->streaming_ = false;
+      cam->transport_->StopRx();
     }
+  } else {
+    // Can't fail: the queue has room for every transfer the ring owns
+    cam->completed_rx_transactions_.TryPush({trans_struct, received});
+    cam->completed_rx_transactions_waiter_.Notify();
+  }
+
+  // Once this reaches zero, StopStream may return and *cam go away. Notified with the lock held,
+  // and WaitForTransferCallbacks only reads it with the lock held, so neither StopStream nor the
+  // stream thread can see it before this is done with *cam.
+  std::lock_guard l{cam->transfer_callbacks_m_};
+  if (--cam->active_transfer_callbacks_ == 0) cam->transfer_callbacks_cv_.notify_all();
+}
+
+bool Camera::PopCompletedTransfer(CompletedTransfer& completed) {
+  completed_rx_transactions_waiter_.Wait(
+      [this]() { return !completed_rx_transactions_.Empty() || !streaming_; });
+  if (completed_rx_transactions_.TryPop(completed)) return true;
+
+  // The stream is stopping. Callbacks push before they finish, so once they're all done, whatever
+  // they pushed can be drained without waiting.
+  WaitForTransferCallbacks();
+  return completed_rx_transactions_.TryPop(completed);
+}
+
+void Camera::WaitForTransferCallbacks() {
+  // The order matters here: a callback increments active_transfer_callbacks_ before it leaves
+  // flight
+  std::unique_lock l{transfer_callbacks_m_};
+  transfer_callbacks_cv_.wait(
+      l, [this]() { return !transport_->RxInFlight() && !active_transfer_callbacks_; });
+}
+
+void Camera::ReleaseTransfer(libusbcpp::TransferStruct* trans) noexcept {
+  try {
+    transport_->RecycleRx(trans);
+  } catch (std::exception& e) {
+    spdlog::error("Camera::ReleaseTransfer: Failed to resubmit transfer: {}", e.what());
   }
 }
 
 bool Camera::ValidateFrame(const uint8_t* frame, std::size_t size) {
+  WMR_TRACE_SCOPE("Camera::ValidateFrame");
+
   // Check frame size
   if (size != spec_.camera_frame_size) {
+    rx_errors_.size.Increment();
     spdlog::warn("Camera::ValidateFrame: wrong frame size (expected={:x}, actual={:x})",
                  spec_.camera_frame_size, size);
     return false;
@@ -270,6 +548,7 @@ bool Camera::ValidateFrame(const uint8_t* frame, std::size_t size) {
   // Check frame footer for magic
   auto footer = reinterpret_cast<const FrameFooter*>(frame + spec_.camera_frame_footer_offset);
   if (footer->magic != kMagic) {
+    rx_errors_.footer.Increment();
     spdlog::warn("Camera::ValidateFrame: frame footer has bad magic (magic=0x{:08x})",
                  footer->magic);
     return false;
@@ -277,124 +556,225 @@ bool Camera::ValidateFrame(const uint8_t* frame, std::size_t size) {
 
   // Check frame footer for timestamp
   if (footer->timestamp == 0) {
+    rx_errors_.footer.Increment();
     spdlog::warn("Camera::ValidateFrame: frame footer has no timestamp");
     return false;
   }
 
+  // Check frame footer for a known frame type
+  if (footer->frame_type != FrameFooter::kFrameTypeRoom &&
+      footer->frame_type != FrameFooter::kFrameTypeController) {
+    rx_errors_.footer.Increment();
+    spdlog::warn("Camera::ValidateFrame: frame footer has unknown frame_type={}",
+                 footer->frame_type);
+    return false;
+  }
+
+  // Segment headers are checked by CopyFrame, while it walks the frame anyways. Frame number
+  // continuity is tracked by HandleFrame, once the whole frame is known to be good.
+
+  return true;
+}
+
+bool Camera::ValidateSegmentHeader(const uint8_t* frame, std::size_t segment_idx) {
   auto first_segment_header = reinterpret_cast<const SegmentHeader*>(frame);
+  auto segment_header = reinterpret_cast<const SegmentHeader*>(
+      frame + copy_plan_.Segments()[segment_idx].header_offset);
 
-  // Check for dropped frames
-  if (got_first_frame_ && first_segment_header->frame_number != prev_frame_number_ + 1) {
+  // Cheack header for magic
+  if (segment_header->magic != kMagic) {
+    rx_errors_.segment_magic.Increment();
     spdlog::warn(
-        "Camera::ValidateFrame: Dropped frame (prev_frame_number={}, "
-        "current={})",
-        prev_frame_number_, first_segment_header->frame_number);
+        "Camera::ValidateSegmentHeader: segment header has bad magic "
+        "(segment_idx ={}, magic=0x{:08x})",
+        segment_idx, segment_header->magic);
     return false;
   }
-  prev_frame_number_ = first_segment_header->frame_number;
-
-  // The frame is divided into 24KiB (may vary by device) "segments". Each
-  // segment starts with a 32 byte header.
-  for (std::size_t segment_idx = 0; segment_idx < spec_.camera_segment_count; ++segment_idx) {
-    auto segment_header =
-        reinterpret_cast<const SegmentHeader*>(frame + segment_idx * spec_.camera_segment_size);
-
-    // Cheack header for magic
-    if (segment_header->magic != kMagic) {
-      spdlog::warn(
-          "Camera::ValidateFrame: segment header has bad magic "
-          "(segment_idx ={}, magic=0x{:08x})",
-          segment_idx, segment_header->magic);
-      return false;
-    }
 
-    // All segments belong to the same frame
-    if (segment_header->frame_number != first_segment_header->frame_number) {
-      spdlog::warn(
-          "Camera::ValidateFrame: segment has unexpected frame_number "
-          "(expected={} actual={})",
-          first_segment_header->frame_number, segment_header->frame_number);
-      return false;
-    }
+  // All segments belong to the same frame
+  if (segment_header->frame_number != first_segment_header->frame_number) {
+    rx_errors_.frame_number.Increment();
+    spdlog::warn(
+        "Camera::ValidateSegmentHeader: segment has unexpected frame_number "
+        "(expected={} actual={})",
+        first_segment_header->frame_number, segment_header->frame_number);
+    return false;
+  }
 
-    // Segments are sequential starting at 0
-    if (segment_header->segment_number != segment_idx) {
-      spdlog::warn(
-          "Camera::ValidateFrame: segment has unexpected segment_number "
-          "(expected={} actual={})",
-          segment_idx, segment_header->segment_number);
-      return false;
-    }
+  // Segments are sequential starting at 0
+  if (segment_header->segment_number != segment_idx) {
+    rx_errors_.frame_number.Increment();
+    spdlog::warn(
+        "Camera::ValidateSegmentHeader: segment has unexpected segment_number "
+        "(expected={} actual={})",
+        segment_idx, segment_header->segment_number);
+    return false;
   }
 
   return true;
 }
 
-Camera::FrameHandle Camera::CopyFrame(const uint8_t* frame) {
+void Camera::ReadFooter(const uint8_t* frame, CameraFrame& dst) {
   auto footer = reinterpret_cast<const FrameFooter*>(frame + spec_.camera_frame_footer_offset);
+  dst.type = ReadFrameType(frame);
+  dst.timestamp = Timestamp(footer->timestamp);
+  dst.host_timestamp = clock_sync_->ToHost(dst.timestamp);
+}
 
-  auto processed_frame = frame_pool_.Allocate();
+CameraFrame::Type Camera::ReadFrameType(const uint8_t* frame) {
+  auto footer = reinterpret_cast<const FrameFooter*>(frame + spec_.camera_frame_footer_offset);
 
   switch (footer->frame_type) {
     case FrameFooter::kFrameTypeRoom:
-      processed_frame->type = CameraFrame::Type::kRoom;
-      break;
+      return CameraFrame::Type::kRoom;
     case FrameFooter::kFrameTypeController:
-      processed_frame->type = CameraFrame::Type::kController;
-      break;
+      return CameraFrame::Type::kController;
     default:
-      throw std::runtime_error("Camera::CopyFrame: Unknown frame_type");
+      // Rejected by ValidateFrame
+      throw std::logic_error("Camera::ReadFrameType: Unknown frame_type");
+  }
+}
+
+bool Camera::WantedImages(CameraFrame::Type type, uint32_t& image_mask) const {
+  bool wanted = false;
+  image_mask = 0;
+  for (auto& subscriber : frame_callbacks_) {
+    if (subscriber.Wants(type) && subscriber.Due()) {
+      wanted = true;
+      image_mask |= subscriber.subscription.image_mask;
+    }
+  }
+  image_mask &= CameraFrame::AllImages(spec_.n_cameras);
+  return wanted;
+}
+
+void Camera::DispatchFrame(CameraFrame::Type type, const FrameHandle& frame) {
+  std::size_t i = 0;
+  while (i < frame_callbacks_.size()) {
+    auto& subscriber = frame_callbacks_[i];
+    if (!subscriber.Wants(type)) {
+      ++i;
+      continue;
+    }
+
+    // Nobody was due this frame if it wasn't unpacked
+    bool due = frame && subscriber.Due();
+    ++subscriber.matched;
+
+    bool again = true;
+    if (due && subscriber.queue) {
+      again = subscriber.queue->Push(frame);
+    } else if (due) {
+      ++subscriber.delivered;
+      again = subscriber.callback(frame);
+    }
+
+    if (again) {
+      ++i;
+    } else {
+      frame_callbacks_.erase(frame_callbacks_.begin() + i);
+    }
   }
+}
+
+Camera::RxErrorCounters::RxErrorCounters(MetricsRegistry& metrics)
+    : frames(metrics.GetCounter("wmr_camera_frames_valid_total",
+                                "Camera frames that passed validation and were dispatched")),
+      size(metrics.GetCounter("wmr_camera_frame_errors_total", "Invalid camera frames, by error",
+                              {{"error", "size"}})),
+      footer(metrics.GetCounter("wmr_camera_frame_errors_total", "Invalid camera frames, by error",
+                                {{"error", "footer"}})),
+      segment_magic(metrics.GetCounter("wmr_camera_frame_errors_total",
+                                       "Invalid camera frames, by error",
+                                       {{"error", "segment_magic"}})),
+      frame_number(metrics.GetCounter("wmr_camera_frame_errors_total",
+                                      "Invalid camera frames, by error",
+                                      {{"error", "frame_number"}})),
+      frame_gaps(metrics.GetCounter("wmr_camera_frame_gaps_total",
+                                    "Discontinuities in the frame numbers of valid camera frames")),
+      resyncs(metrics.GetCounter("wmr_camera_resyncs_total",
+                                 "Times the camera stream lost sync after having locked on")) {}
+
+Camera::StreamMetrics::StreamMetrics(MetricsRegistry& metrics)
+    : frames_dropped(metrics.GetCounter("wmr_camera_frames_dropped_total",
+                                        "Valid camera frames dropped for lack of a free frame")),
+      frame_pool_in_use(metrics.GetGauge("wmr_camera_frame_pool_in_use",
+                                         "Camera frames held by the driver or consumers")),
+      rx_in_flight(metrics.GetGauge("wmr_camera_rx_in_flight",
+                                    "Camera USB receive transfers submitted")) {
+  // Same order as libusb_transfer_status
+  static constexpr std::array<const char*, kTransferStatusCount> kStatusNames{
+      "completed", "error", "timed_out", "cancelled", "stall", "no_device", "overflow"};
+  for (std::size_t i = 0; i < kTransferStatusCount; ++i) {
+    transfers[i] = &metrics.GetCounter("wmr_camera_transfers_total",
+                                       "Camera USB receive transfers completed, by status",
+                                       {{"status", kStatusNames[i]}});
+  }
+}
 
-  processed_frame->timestamp = Timestamp(footer->timestamp);
+SubscriberStats Camera::Subscriber::GetStats() const {
+  if (!queue) return {id, false, delivered, 0, 0, 0, {}};
+
+  auto queue_stats = queue->GetStats();
+  return {id,
+          true,
+          queue_stats.delivered,
+          queue_stats.dropped,
+          queue_stats.queued,
+          queue_stats.max_queued,
+          queue_stats.max_lag};
+}
 
-  std::vector<std::size_t> bytes_copied_per_image(spec_.n_cameras, 0);
-  std::size_t frame_offset = kSegmentHeaderSize;
-  std::size_t cam_idx = 0;
+bool Camera::CopyFrame(const uint8_t* frame, uint32_t image_mask, LumaHistogram* histograms,
+                       CameraFrame& dst) {
+  WMR_TRACE_SCOPE("Camera::CopyFrame");
+  ReadFooter(frame, dst);
+  dst.image_mask = image_mask;
+  return unpacker_.Unpack(frame, dst, image_mask, histograms);
+}
 
-  // The first row of each image contains metadata
-  for (; cam_idx < spec_.n_cameras; ++cam_idx) {
-    // TODO what is the metatadata?
-    frame_offset += spec_.camera_width;
-    assert(frame_offset <= spec_.camera_segment_size);
+bool Camera::ValidateSegmentHeaders(const uint8_t* frame) {
+  for (std::size_t segment_idx = 0; segment_idx < copy_plan_.Segments().size(); ++segment_idx) {
+    if (!ValidateSegmentHeader(frame, segment_idx)) return false;
   }
-  cam_idx = 0;
+  return true;
+}
 
-  // The raw frame data has segment headers inserted into it, and the
-  // individual camera images are stacked horizontally. Excise the headers and
-  // un-shuffle the rows from individual images.
-  while (true) {
-    while (frame_offset % spec_.camera_segment_size) {
-      auto block_size =
-          std::min(spec_.camera_segment_size - frame_offset % spec_.camera_segment_size,
-                   spec_.camera_width - bytes_copied_per_image[cam_idx] % spec_.camera_width);
+Camera::FrameHandle Camera::ViewFrame(libusbcpp::TransferStruct* trans,
+                                      PooledPtr<CameraFrame> pooled_frame) {
+  WMR_TRACE_SCOPE("Camera::ViewFrame");
+  const uint8_t* frame = trans->buffer;
 
-      if (frame_offset + block_size >= spec_.camera_frame_size) {
-        throw std::runtime_error("Camera::CopyFrame: Ran out of bytes in raw frame");
-      }
+  if (!ValidateSegmentHeaders(frame)) return nullptr;
 
-      auto src_begin = frame + frame_offset;
-      auto src_end = src_begin + block_size;
-      auto dst_begin = processed_frame->GetImage(cam_idx) + bytes_copied_per_image[cam_idx];
-      std::copy(src_begin, src_end, dst_begin);
+  // From here on, the frame pool's recycle hook hands trans back to the ring
+  ReadFooter(frame, *pooled_frame);
+  pooled_frame->AttachRawFrame({}, frame, trans);
+  return pooled_frame;
+}
 
-      frame_offset += block_size;
-      bytes_copied_per_image[cam_idx] += block_size;
+void Camera::UpdateAutoExposure(const LumaHistogram* histograms) {
+  for (std::size_t i = 0; i < auto_exposure_.size(); ++i) {
+    auto camera_type = static_cast<uint16_t>(i);
 
-      // If we finished reading a row, move to the next camera
-      if (block_size && bytes_copied_per_image[cam_idx] % spec_.camera_width == 0) {
-        cam_idx = (cam_idx + 1) % spec_.n_cameras;
+    uint16_t exposure, gain;
+    {
+      std::lock_guard l{exp_gain_m_};
+      exposure = exp_gain_state_[camera_type].exposure;
+      gain = exp_gain_state_[camera_type].gain;
+    }
 
-        // If the image for the next camera is already complete, we're done
-        if (bytes_copied_per_image[cam_idx] == spec_.camera_width * spec_.camera_height) {
-          return processed_frame;
-        }
-      }
+    // Never set, so start from the brightest allowed settings
+    if (exposure == 0) {
+      exposure = options_.auto_exposure.max_exposure;
+      gain = options_.auto_exposure.max_gain;
     }
 
-    // Seek past the segment header
-    frame_offset += kSegmentHeaderSize;
+    // Doesn't wait for the command to be sent, so this is fine on the libusb event thread
+    if (auto_exposure_[i].Update(histograms[i], exposure, gain)) {
+      SetExpGain(camera_type, exposure, gain);
+    }
   }
 }
 
-}  // namespace wmr
\ No newline at end of file
+}  // namespace wmr
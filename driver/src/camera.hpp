@@ -5,32 +5,66 @@
 
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
 #include <functional>
-#include <list>
+#include <future>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <vector>
 
-#include <libusbcpp/device_handle.hpp>
 #include <libusbcpp/transfer.hpp>
 #include <wmr/camera_interface.hpp>
+#include <wmr/headset_options.hpp>
 #include <wmr/headset_spec.hpp>
 
+#include "auto_exposure.hpp"
+#include "callback_queue.hpp"
+#include "camera_transport.hpp"
+#include "capture_writer.hpp"
+#include "clock_sync.hpp"
+#include "copy_plan.hpp"
 #include "frame_pool.hpp"
+#include "frame_unpacker.hpp"
+#include "latency_histogram.hpp"
+#include "metrics_registry.hpp"
+#include "spsc_queue.hpp"
+#include "thread_pool.hpp"
+#include "waiter.hpp"
 
 namespace wmr {
 
+/** Lets Camera, and nothing outside the driver, point zero-copy frames at its transfers. */
+class CameraFrame::RawFrameKey {
+  friend class Camera;
+  RawFrameKey() {}  // Not defaulted, which would leave it an aggregate anyone could brace-init
+};
+
 class Camera : public CameraInterface {
  public:
-  Camera(const HeadsetSpec& spec_, libusbcpp::Device::Pointer dev);
+  /** transport connects to the camera device, e.g. a UsbCameraTransport. It must have a command
+   * slot for each of kCameraTypeCount camera types. clock_sync maps frame timestamps to the host
+   * clock, and may be shared with the IMU. The camera's health metrics are registered with metrics.
+   */
+  Camera(const HeadsetSpec& spec, const CameraOptions& options,
+         std::unique_ptr<CameraTransport> transport, std::shared_ptr<ClockSync> clock_sync,
+         std::shared_ptr<MetricsRegistry> metrics);
 
- private:
   static constexpr int kCameraTypeCount = 8;
-  static constexpr uint8_t kInterfaceNumber = 3;
+
+  /** Record every receive transfer completed from now on to writer, before it's processed. Call
+   * while the stream is stopped.
+   */
+  void SetCapture(std::shared_ptr<CaptureWriter> writer) { capture_ = std::move(writer); }
+
+ private:
   static constexpr uint32_t kMagic = 0x2b6f6c44;
-  static constexpr std::size_t kRxSlotCount = 3;
-  static constexpr std::size_t kFramePoolSize = 3;
+
+  /** Subscribers are kept in an array of this size, so that dispatch never allocates. */
+  static constexpr std::size_t kMaxFrameSubscribers = 16;
+
+  /** Frames at least this large are unpacked using non-temporal stores. */
+  static constexpr std::size_t kNonTemporalThreshold = 1 << 20;
 
   struct __attribute__((packed)) StartStopCommand {
     static constexpr std::size_t kSize = 12;
@@ -54,6 +88,56 @@ class Camera : public CameraInterface {
   };
   static_assert(sizeof(SetExpGainCommand) == SetExpGainCommand::kSize);
 
+  /** Stages of latency_, in the order GetLatency lists them. */
+  enum LatencyStage : std::size_t {
+    kLatencyUsb,
+    kLatencyValidate,
+    kLatencyUnpack,
+    kLatencyCallbackEntry,
+    kLatencyCallbackExit,
+  };
+
+  /** Whether HandleFrame is tracking frame numbers, or waiting for a good frame to lock on to. */
+  enum class SyncState {
+    kSearching,
+    kLocked,
+  };
+
+  /** Counters behind the frame stats in CameraStats, which are also metrics. Updated from unpack
+   * threads too.
+   */
+  struct RxErrorCounters {
+    explicit RxErrorCounters(MetricsRegistry& metrics);
+
+    MetricsRegistry::Counter& frames;
+    MetricsRegistry::Counter& size;
+    MetricsRegistry::Counter& footer;
+    MetricsRegistry::Counter& segment_magic;
+    MetricsRegistry::Counter& frame_number;
+    MetricsRegistry::Counter& frame_gaps;
+    MetricsRegistry::Counter& resyncs;
+  };
+
+  /** Metrics that don't show up in CameraStats. */
+  struct StreamMetrics {
+    /** Number of libusb_transfer_status values. */
+    static constexpr std::size_t kTransferStatusCount = 7;
+
+    explicit StreamMetrics(MetricsRegistry& metrics);
+
+    /** Indexed by libusb_transfer_status. */
+    std::array<MetricsRegistry::Counter*, kTransferStatusCount> transfers;
+    MetricsRegistry::Counter& frames_dropped;
+    MetricsRegistry::Gauge& frame_pool_in_use;
+    MetricsRegistry::Gauge& rx_in_flight;
+  };
+
+  /** A transfer handed from the libusb event thread to the stream thread. */
+  struct CompletedTransfer {
+    libusbcpp::TransferStruct* trans;
+    HostTimestamp received; /**< When its completion callback ran. */
+  };
+
   struct ExpGainState {
     uint16_t exposure;
     uint16_t gain;
@@ -72,7 +156,7 @@ class Camera : public CameraInterface {
     uint16_t frame_type;
   };
 
-  static constexpr std::size_t kSegmentHeaderSize = 0x20;
+  static constexpr std::size_t kSegmentHeaderSize = CopyPlan::kSegmentHeaderSize;
   struct SegmentHeader {
     uint32_t magic;
     uint32_t frame_number;    // common among segments
@@ -88,43 +172,163 @@ class Camera : public CameraInterface {
   void StartStream() final;
   void StopStream() final;
   void SetExpGain(uint16_t camera_type, uint16_t exposure, uint16_t gain) final;
-  void RegisterFrameCallback(FrameCallback cb) final;
+  std::future<void> SetExpGainAndNotify(uint16_t camera_type, uint16_t exposure,
+                                        uint16_t gain) final;
+  using CameraInterface::RegisterFrameCallback;
+  void RegisterFrameCallback(FrameCallback cb, const FrameSubscription& subscription) final;
+  CameraStats GetStats() final;
+  std::vector<StageLatency> GetLatency() final { return latency_.Summarize(); }
+  void SetRectification(uint8_t n, const RectificationMap& map) final;
+
+  /** Number of pyramid levels frames get for the given options, after clamping. */
+  static uint8_t PyramidLevels(const HeadsetSpec& spec, const CameraOptions& options);
+
+  /** Number of receive transfers to allocate for the given options. */
+  static std::size_t RxTransferCount(const CameraOptions& options);
+
+  /** Processed frames are carved out of one slab, except zero-copy ones, which have no storage. */
+  std::unique_ptr<FramePool<CameraFrame>> MakeFramePool() const;
 
   void SendStartStopCommand(bool start);
+
+  /** Queue a set exposure/gain command, unless the setting is cached, in which case this returns
+   * false and leaves sent alone. See CameraTransport::SendCommand regarding sent.
+   */
+  bool SendExpGain(uint16_t camera_type, uint16_t exposure, uint16_t gain,
+                   std::promise<void>* sent);
+
   void Stream();
-  void HandleFrame(const libusbcpp::TransferStruct* trans);
+
+  /** Handle one completed transfer: dispatch its frame and recycle it, or reap it if the stream is
+   * stopping. Called on the stream thread, or in inline mode, on the libusb event thread.
+   */
+  void ProcessTransfer(const CompletedTransfer& completed);
+
+  /** Wait for the next completed transfer.
+   * Returns false once the stream has stopped and every transfer has been reaped.
+   */
+  bool PopCompletedTransfer(CompletedTransfer& completed);
+
+  /** Block until the event thread has reaped every transfer and is done touching *this.
+   * Only meaningful once transport_->StopRx has been called.
+   */
+  void WaitForTransferCallbacks();
+
+  /** Validate, unpack and dispatch the frame held by trans, which completed at received.
+   * Invalid transfers are counted and dropped; the stream then resynchronizes on the next valid
+   * frame.
+   * Sets taken once a zero-copy frame takes ownership of trans, in which case it will be handed
+   * back to transport_ once the frame is released, even if this throws afterwards.
+   */
+  void HandleFrame(libusbcpp::TransferStruct* trans, HostTimestamp received, bool& taken);
+
   static void TransferCallback(libusbcpp::c::libusb_transfer* trans);
-  void CancelAllTransfers();
+
+  /** Called when the last FrameHandle referencing a zero-copy frame is dropped. */
+  void ReleaseTransfer(libusbcpp::TransferStruct* trans) noexcept;
 
   bool ValidateFrame(const uint8_t* frame, std::size_t size);
-  FrameHandle CopyFrame(const uint8_t* frame);
+  bool ValidateSegmentHeader(const uint8_t* frame, std::size_t segment_idx);
+
+  /** Unpack frame into dst by executing copy_plan_, using unpack_pool_ if any.
+   * Only images selected by image_mask are unpacked. Segment headers are validated along the way,
+   * and if histograms is non-null it receives one LumaHistogram per image. Returns false if a
+   * segment header is invalid.
+   */
+  bool CopyFrame(const uint8_t* frame, uint32_t image_mask, LumaHistogram* histograms,
+                 CameraFrame& dst);
+
+  /** Validate every segment header of frame, without unpacking it. */
+  bool ValidateSegmentHeaders(const uint8_t* frame);
+
+  /** Wrap the frame held by trans in pooled_frame, a zero-copy CameraFrame that references it in
+   * place. Returns nullptr if a segment header is invalid.
+   */
+  FrameHandle ViewFrame(libusbcpp::TransferStruct* trans, PooledPtr<CameraFrame> pooled_frame);
+
+  /** Fill in the frame type and timestamp from the footer of a raw frame. */
+  void ReadFooter(const uint8_t* frame, CameraFrame& dst);
+  CameraFrame::Type ReadFrameType(const uint8_t* frame);
+
+  /** Find the union of the images wanted by subscribers due a frame of the given type.
+   * Returns false if no subscriber is due one. Call with frame_callbacks_m_ held.
+   */
+  bool WantedImages(CameraFrame::Type type, uint32_t& image_mask) const;
+
+  /** Hand a frame of the given type to the subscribers due one, and advance their decimation
+   * counters. Asynchronous subscribers only get it queued. frame is null if nobody wanted it. Call
+   * with frame_callbacks_m_ held.
+   */
+  void DispatchFrame(CameraFrame::Type type, const FrameHandle& frame);
+
+  /** Feed the histograms of a room frame to auto_exposure_, and apply any changes. */
+  void UpdateAutoExposure(const LumaHistogram* histograms);
 
   std::array<ExpGainState, kCameraTypeCount> exp_gain_state_{};
+  std::mutex exp_gain_m_;
+
+  // One controller per image, driving the room frame camera type of the same index. Empty if
+  // auto-exposure is disabled.
+  std::vector<AutoExposure> auto_exposure_;
 
-  bool streaming_{};
+  std::atomic<bool> streaming_{};
 
   HeadsetSpec spec_;
-  libusbcpp::DeviceHandle::Pointer dev_handle_;
+  CameraOptions options_;
+  CopyPlan copy_plan_;
+  std::unique_ptr<ThreadPool> unpack_pool_;
+  FrameUnpacker unpacker_;
 
-  std::list<libusbcpp::Transfer::Pointer> rx_transfers_;
-  std::list<std::shared_ptr<unsigned char>> rx_buffers_;
-  std::size_t outstanding_transfer_count_{};
+  // In zero-copy mode, outstanding frames pin their transfers. The receive ring gets a spare
+  // transfer for each one, so that pinned frames never eat into the in-flight depth.
+  std::unique_ptr<CameraTransport> transport_;
+  std::shared_ptr<CaptureWriter> capture_;
 
-  std::queue<libusbcpp::TransferStruct*> completed_rx_transactions_;
-  std::mutex completed_rx_transactions_m_;
-  std::condition_variable completed_rx_transactions_cv_;
+  // Handoff from the libusb event thread to the stream thread. active_transfer_callbacks_ lets the
+  // stream thread, or StopStream in inline mode, tell when the event thread is completely done
+  // touching *this. It's decremented with transfer_callbacks_m_ held, and only read with it held
+  // once stopping, so that *this can't go away while the last callback still holds the lock.
+  SpscQueue<CompletedTransfer> completed_rx_transactions_;
+  Waiter completed_rx_transactions_waiter_;
+  std::atomic<std::size_t> active_transfer_callbacks_{};
+  std::mutex transfer_callbacks_m_;
+  std::condition_variable transfer_callbacks_cv_; /**< Signals active_transfer_callbacks_ hit 0. */
 
   std::thread stream_thread_;
 
-  std::shared_ptr<void> iface_claim_hnd_;
-  uint8_t read_ep_, write_ep_;
-
+  // Before everything that holds references to its metrics
+  std::shared_ptr<MetricsRegistry> metrics_;
+  RxErrorCounters rx_errors_;
+  StreamMetrics stream_metrics_;
+  SyncState sync_state_;
   uint32_t prev_frame_number_;
-  bool got_first_frame_;
 
-  FramePool<CameraFrame> frame_pool_;
+  std::unique_ptr<FramePool<CameraFrame>> frame_pool_;
+  std::shared_ptr<ClockSync> clock_sync_;
+
+  // Before frame_callbacks_, since asynchronous callbacks record to it from their own threads
+  LatencyStages latency_;
+
+  struct Subscriber {
+    uint32_t id;
+    FrameCallback callback; /**< Null for asynchronous callbacks, which queue owns. */
+    FrameSubscription subscription;
+    uint64_t matched{};   /**< Valid frames of the subscribed types seen so far. */
+    uint64_t delivered{}; /**< Frames passed to callback. */
+    std::unique_ptr<CallbackQueue<FrameHandle>> queue;
+
+    bool Wants(CameraFrame::Type type) const {
+      return subscription.frame_type_mask & FrameSubscription::FrameTypeBit(type);
+    }
+    bool Due() const { return matched % std::max<uint32_t>(subscription.decimation, 1) == 0; }
+
+    SubscriberStats GetStats() const;
+  };
 
-  std::list<FrameCallback> frame_callbacks_;
+  // After frame_pool_, so that frames still queued for asynchronous callbacks are released before
+  // the pool waits for them
+  std::vector<Subscriber> frame_callbacks_;
+  uint32_t next_subscriber_id_{};
   std::mutex frame_callbacks_m_;
 };
 
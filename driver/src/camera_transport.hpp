@@ -0,0 +1,63 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+#include <future>
+
+#include <libusbcpp/transfer.hpp>
+#include <libusbcpp/transfer_ring.hpp>
+
+namespace wmr {
+
+/** What Camera talks to the camera's USB interface through: a ring of whole-frame receive
+ * transfers on the bulk IN endpoint, and commands on the bulk OUT endpoint.
+ * Receive transfers follow libusbcpp::TransferRing's model. Each one is in flight, held by Camera
+ * (from its completion until Camera hands it back with RecycleRx), or idle. They're handed around
+ * as libusbcpp::TransferStruct, of which Camera only reads buffer, actual_length, status and
+ * user_data. Implementations that don't go through libusb fill those in themselves.
+ */
+class CameraTransport {
+ public:
+  using Transfer = libusbcpp::TransferStruct;
+  using RxStats = libusbcpp::TransferRing::Stats;
+
+  /** Same meaning as the fields of libusbcpp::TransferRing::Config. */
+  struct RxConfig {
+    std::size_t buffer_size;
+    std::size_t capacity;
+    std::size_t depth;
+    std::size_t min_depth;
+    std::size_t max_depth;
+    bool adaptive;
+    libusbcpp::c::libusb_transfer_cb_fn callback;
+    void* user_data;
+  };
+
+  virtual ~CameraTransport() = default;
+
+  /** Write a command, and wait for it to be sent. Throws if that fails. Not for the thread that
+   * completes receive transfers.
+   */
+  virtual void WriteCommand(const void* command, std::size_t size) = 0;
+
+  /** Queue a command without waiting, see CommandQueue::Send. */
+  virtual void SendCommand(std::size_t key, const void* command, std::size_t size,
+                           std::promise<void>* sent) = 0;
+
+  /** Allocate the receive transfers. Call once, before anything else below. */
+  virtual void OpenRx(const RxConfig& config) = 0;
+
+  /** Like the libusbcpp::TransferRing member functions of the same name. */
+  virtual void StartRx() = 0;
+  virtual void StopRx() = 0;
+  virtual void OnRxComplete(Transfer* trans) = 0;
+  virtual void RecycleRx(Transfer* trans) = 0;
+  virtual std::size_t RxInFlight() const = 0;
+  virtual RxStats GetRxStats() const = 0;
+};
+
+}  // namespace wmr
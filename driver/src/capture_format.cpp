@@ -0,0 +1,193 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "capture_format.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace wmr {
+
+namespace {
+
+template <class T>
+T ReadAt(const uint8_t* data, std::size_t offset) {
+  T t;
+  std::memcpy(&t, data + offset, sizeof(T));
+  return t;
+}
+
+}  // namespace
+
+CaptureReader::CaptureReader(const std::string& path) : path_(path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) throw std::runtime_error("CaptureReader: Can't open " + path);
+
+  struct stat st {};
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    size_ = static_cast<std::size_t>(st.st_size);
+    auto mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) data_ = static_cast<const uint8_t*>(mapping);
+  }
+  close(fd);  // The mapping stays valid
+  if (!data_) throw std::runtime_error("CaptureReader: Can't map " + path);
+
+  // From here on, the destructor won't run if we throw
+  try {
+    if (size_ < sizeof(capture::FileHeader) ||
+        ReadAt<capture::FileHeader>(data_, 0).magic != capture::kMagic) {
+      throw std::runtime_error("CaptureReader: " + path + " isn't a capture");
+    }
+    auto version = ReadAt<capture::FileHeader>(data_, 0).version;
+    if (version != capture::kVersion) {
+      throw std::runtime_error("CaptureReader: " + path + " has unsupported version " +
+                               std::to_string(version));
+    }
+
+    // Use the index if there is one
+    std::size_t chunks_end = size_;
+    if (size_ >= sizeof(capture::FileHeader) + sizeof(capture::Trailer)) {
+      auto trailer = ReadAt<capture::Trailer>(data_, size_ - sizeof(capture::Trailer));
+      if (trailer.magic == capture::kIndexMagic &&
+          trailer.index_offset >= sizeof(capture::FileHeader) &&
+          trailer.chunks == (size_ - sizeof(capture::Trailer) - trailer.index_offset) /
+                                sizeof(capture::IndexEntry)) {
+        index_.resize(trailer.chunks);
+        std::memcpy(index_.data(), data_ + trailer.index_offset,
+                    trailer.chunks * sizeof(capture::IndexEntry));
+        chunks_end = trailer.index_offset;
+      }
+    }
+
+    if (index_.empty()) {
+      // Walk the chunks, up to the last whole one
+      std::size_t offset = sizeof(capture::FileHeader);
+      while (offset + sizeof(capture::ChunkHeader) <= size_) {
+        auto header = ReadAt<capture::ChunkHeader>(data_, offset);
+        if (header.size > size_ - offset - sizeof(capture::ChunkHeader)) break;
+        index_.push_back({offset, header.first_ns, header.last_ns});
+        offset += sizeof(capture::ChunkHeader) + header.size;
+      }
+      if (offset != size_) {
+        spdlog::warn("CaptureReader: {} has no index, so it was cut short. Read {} whole chunks.",
+                     path, index_.size());
+      }
+      chunks_end = offset;
+    }
+
+    for (const auto& entry : index_) {
+      if (entry.offset + sizeof(capture::ChunkHeader) > chunks_end ||
+          ReadAt<capture::ChunkHeader>(data_, entry.offset).size >
+              chunks_end - entry.offset - sizeof(capture::ChunkHeader)) {
+        throw std::runtime_error("CaptureReader: " + path + " has a corrupt index");
+      }
+    }
+  } catch (...) {
+    munmap(const_cast<uint8_t*>(data_), size_);
+    throw;
+  }
+
+  Rewind();
+}
+
+CaptureReader::~CaptureReader() { munmap(const_cast<uint8_t*>(data_), size_); }
+
+bool CaptureReader::Next(Record& record) {
+  while (chunk_records_left_ == 0) {
+    if (chunk_ + 1 >= index_.size()) return false;
+    EnterChunk(chunk_ + 1);
+  }
+
+  if (offset_ + sizeof(capture::RecordHeader) > chunk_end_) {
+    throw std::runtime_error("CaptureReader: " + path_ + " has a truncated chunk");
+  }
+  auto header = ReadAt<capture::RecordHeader>(data_, offset_);
+  auto span = capture::RecordSpan(header.size);
+  if (span > chunk_end_ - offset_) {
+    throw std::runtime_error("CaptureReader: " + path_ + " has a record overrunning its chunk");
+  }
+
+  record.type = static_cast<capture::RecordType>(header.type);
+  record.status = header.status;
+  record.received = HostTimestamp(std::chrono::nanoseconds(header.received_ns));
+  record.data = {data_ + offset_ + sizeof(capture::RecordHeader), header.size};
+
+  offset_ += span;
+  --chunk_records_left_;
+  return true;
+}
+
+void CaptureReader::Rewind() {
+  if (index_.empty()) {
+    chunk_records_left_ = 0;
+    return;
+  }
+  EnterChunk(0);
+}
+
+void CaptureReader::Seek(HostTimestamp time) {
+  auto time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch());
+
+  // The first chunk that ends at or after time
+  auto it = std::partition_point(index_.begin(), index_.end(), [&](const auto& entry) {
+    return entry.last_ns < time_ns.count();
+  });
+  if (it == index_.end()) {
+    // Past the end
+    if (!index_.empty()) EnterChunk(index_.size() - 1);
+    chunk_records_left_ = 0;
+    return;
+  }
+  EnterChunk(it - index_.begin());
+
+  // Skip the records before time, within the chunk
+  while (chunk_records_left_ > 0) {
+    auto offset = offset_;
+    auto records_left = chunk_records_left_;
+    Record record;
+    Next(record);
+    if (record.received >= time) {
+      offset_ = offset;
+      chunk_records_left_ = records_left;
+      break;
+    }
+  }
+}
+
+HostTimestamp CaptureReader::StartTime() const {
+  if (index_.empty()) return {};
+  auto first = std::min_element(index_.begin(), index_.end(), [](const auto& a, const auto& b) {
+                 return a.first_ns < b.first_ns;
+               })->first_ns;
+  return HostTimestamp(std::chrono::nanoseconds(first));
+}
+
+HostTimestamp CaptureReader::EndTime() const {
+  if (index_.empty()) return {};
+  auto last = std::max_element(index_.begin(), index_.end(), [](const auto& a, const auto& b) {
+                return a.last_ns < b.last_ns;
+              })->last_ns;
+  return HostTimestamp(std::chrono::nanoseconds(last));
+}
+
+void CaptureReader::EnterChunk(std::size_t idx) {
+  auto offset = index_[idx].offset;
+  auto header = ReadAt<capture::ChunkHeader>(data_, offset);
+  chunk_ = idx;
+  offset_ = offset + sizeof(capture::ChunkHeader);
+  chunk_end_ = offset_ + header.size;
+  chunk_records_left_ = header.records;
+}
+
+}  // namespace wmr
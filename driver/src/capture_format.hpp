@@ -0,0 +1,151 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <wmr/types.hpp>
+
+namespace wmr {
+
+/** On-disk format of raw captures of headset traffic, which CaptureWriter records and
+ * ReplayHeadset plays back.
+ * A capture is a FileHeader, then chunks, then an index of the chunks, then a Trailer. Each chunk
+ * is a ChunkHeader followed by records, each of which is a RecordHeader followed by size bytes of
+ * payload, padded to kAlignment. Records are in the order they were written in, which is roughly
+ * the order they were received in. Integers are little-endian.
+ * Chunks are only ever appended, and the index only written on close, so a capture that was cut
+ * short is still readable up to its last whole chunk. Everything is aligned to kAlignment, so a
+ * memory-mapped capture can be read in place.
+ */
+namespace capture {
+
+inline constexpr std::array<char, 8> kMagic{'W', 'M', 'R', 'C', 'A', 'P', '\r', '\n'};
+inline constexpr std::array<char, 8> kIndexMagic{'W', 'M', 'R', 'I', 'D', 'X', '\r', '\n'};
+inline constexpr uint32_t kVersion = 2;
+inline constexpr std::size_t kAlignment = 8;
+
+struct FileHeader {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t reserved;
+};
+static_assert(sizeof(FileHeader) == 16);
+
+struct ChunkHeader {
+  uint64_t size;     /**< Bytes of records following the header, including padding. */
+  uint32_t records;  /**< Number of records. */
+  uint32_t reserved;
+  int64_t first_ns;  /**< Earliest RecordHeader::received_ns in the chunk. */
+  int64_t last_ns;   /**< Latest RecordHeader::received_ns in the chunk. */
+};
+static_assert(sizeof(ChunkHeader) == 32);
+
+enum class RecordType : uint16_t {
+  kCameraTransfer = 1,  /**< A completed camera receive transfer, as it sat in the buffer. */
+  kOasisReport = 2,     /**< A report read from the Oasis HID device, which carries the IMU. */
+  kVendorReport = 3,    /**< A report read from the vendor HID device. */
+  kFirmwarePayload = 4, /**< A payload read from the Oasis firmware, e.g. the calibration. */
+};
+
+struct RecordHeader {
+  uint16_t type;       /**< A RecordType. */
+  uint16_t status;     /**< Camera transfers: libusb_transfer_status. Payloads: which one. */
+  uint32_t size;       /**< Bytes of payload following the header, not counting padding. */
+  int64_t received_ns; /**< When it was received, on the recording host's steady_clock. */
+};
+static_assert(sizeof(RecordHeader) == 16);
+
+/** Size of a record of size bytes of payload, including its header and padding. */
+constexpr std::size_t RecordSpan(std::size_t size) {
+  return (sizeof(RecordHeader) + size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+/** Values of RecordHeader::status for firmware payloads. */
+enum class FirmwarePayload : uint16_t {
+  kDeviceInfo = 0,
+  kCalibration = 1,
+};
+
+/** One per chunk, in file order. */
+struct IndexEntry {
+  uint64_t offset; /**< Of the chunk's ChunkHeader, from the start of the file. */
+  int64_t first_ns;
+  int64_t last_ns;
+};
+static_assert(sizeof(IndexEntry) == 24);
+
+/** The last thing in the file. */
+struct Trailer {
+  uint64_t index_offset; /**< Of the first IndexEntry. */
+  uint64_t chunks;       /**< Number of IndexEntries. */
+  std::array<char, 8> magic;
+};
+static_assert(sizeof(Trailer) == 24);
+
+}  // namespace capture
+
+/** Reads the records of a capture file, which it maps into memory.
+ * Uses the capture's index to seek, or if it has none because recording was cut short, rebuilds
+ * one by walking the chunk headers.
+ */
+class CaptureReader {
+ public:
+  struct Record {
+    capture::RecordType type;
+    uint16_t status;
+    HostTimestamp received; /**< On the recording host's clock. */
+    std::basic_string_view<uint8_t> data;
+  };
+
+  /** Throws std::runtime_error if path can't be mapped, or isn't a capture. */
+  explicit CaptureReader(const std::string& path);
+  ~CaptureReader();
+
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator=(const CaptureReader&) = delete;
+
+  /** Read the next record into record, whose data stays valid as long as the reader.
+   * Returns false at the end of the capture. Throws std::runtime_error if a chunk is corrupt.
+   */
+  bool Next(Record& record);
+
+  /** Go back to the first record. */
+  void Rewind();
+
+  /** Go to the first record received at or after time, without reading the chunks before it.
+   * Records are only roughly in order of receipt, so a few after that may have been received
+   * slightly earlier.
+   */
+  void Seek(HostTimestamp time);
+
+  /** Earliest and latest receive time in the capture. */
+  HostTimestamp StartTime() const;
+  HostTimestamp EndTime() const;
+
+ private:
+  /** Position at the first record of chunk idx. */
+  void EnterChunk(std::size_t idx);
+
+  std::string path_;
+  const uint8_t* data_{};
+  std::size_t size_{};
+
+  std::vector<capture::IndexEntry> index_;
+
+  // Position of the next record
+  std::size_t chunk_{};
+  std::size_t offset_{};
+  std::size_t chunk_end_{};
+  uint32_t chunk_records_left_{};
+};
+
+}  // namespace wmr
@@ -0,0 +1,220 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "capture_writer.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.hpp"
+
+namespace wmr {
+
+namespace {
+
+std::size_t CheckChunkSize(std::size_t chunk_size) {
+  chunk_size = chunk_size / capture::kAlignment * capture::kAlignment;
+  if (chunk_size < sizeof(capture::ChunkHeader) + sizeof(capture::RecordHeader)) {
+    throw std::invalid_argument("CaptureWriter: chunk_size is too small");
+  }
+  return chunk_size;
+}
+
+}  // namespace
+
+CaptureWriter::CaptureWriter(const std::string& path, std::size_t buffer_size,
+                             std::size_t chunk_size, std::shared_ptr<MetricsRegistry> metrics)
+    : path_(path),
+      chunk_size_(CheckChunkSize(chunk_size)),
+      metrics_(std::move(metrics)),
+      records_(metrics_->GetCounter("wmr_capture_records_total", "Records written to the capture")),
+      dropped_(metrics_->GetCounter("wmr_capture_records_dropped_total",
+                                   "Records not captured because the writer fell behind")),
+      bytes_(metrics_->GetCounter("wmr_capture_bytes_total", "Bytes written to the capture file")),
+      slab_(std::max(buffer_size, 2 * chunk_size_)),
+      chunks_(std::make_unique<Chunk[]>(slab_.size() / chunk_size_)) {
+  // Fault in the buffers now, rather than while capturing
+  slab_.Prefault(0, slab_.size());
+  auto chunk_count = slab_.size() / chunk_size_;
+  free_.reserve(chunk_count);
+  for (std::size_t i = chunk_count; i-- > 0;) {
+    chunks_[i].data = slab_.data() + i * chunk_size_;
+    free_.push_back(&chunks_[i]);
+  }
+  index_.reserve(1024);
+
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw std::runtime_error("CaptureWriter: Can't create " + path + ": " + std::strerror(errno));
+  }
+
+  capture::FileHeader header{capture::kMagic, capture::kVersion, 0};
+  if (!WriteFully(&header, sizeof(header))) {
+    close(fd_);
+    throw std::runtime_error("CaptureWriter: Can't write " + path);
+  }
+  offset_ = sizeof(header);
+
+  thread_ = std::thread([this]() { Run(); });
+}
+
+CaptureWriter::~CaptureWriter() {
+  {
+    std::lock_guard l{m_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+  close(fd_);
+
+  auto stats = GetStats();
+  spdlog::info("CaptureWriter: Wrote {} records ({} bytes) to {}, dropped {}", stats.records,
+               stats.bytes, path_, stats.dropped);
+}
+
+bool CaptureWriter::Write(capture::RecordType type, uint16_t status, HostTimestamp received,
+                          BufferView data) {
+  auto span = capture::RecordSpan(data.size());
+  auto received_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(received.time_since_epoch()).count();
+
+  Chunk* chunk;
+  std::size_t offset;
+  {
+    std::lock_guard l{m_};
+    if (failed_ || stopping_ || span > chunk_size_ - sizeof(capture::ChunkHeader)) {
+      dropped_.Increment();
+      return false;
+    }
+
+    if (current_ && current_->used + span > chunk_size_) Seal();
+    if (!current_) {
+      if (free_.empty()) {
+        dropped_.Increment();
+        WMR_TRACE_INSTANT("CaptureWriter overflow");
+        return false;
+      }
+      current_ = free_.back();
+      free_.pop_back();
+      current_->used = sizeof(capture::ChunkHeader);
+      current_->records = 0;
+      current_->first_ns = received_ns;
+      current_->last_ns = received_ns;
+      current_->opened = std::chrono::steady_clock::now();
+    }
+
+    chunk = current_;
+    offset = chunk->used;
+    chunk->used += span;
+    ++chunk->records;
+    chunk->first_ns = std::min(chunk->first_ns, received_ns);
+    chunk->last_ns = std::max(chunk->last_ns, received_ns);
+    chunk->copying.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // The room is ours, so the copy needs no lock
+  capture::RecordHeader header{static_cast<uint16_t>(type), status,
+                               static_cast<uint32_t>(data.size()), received_ns};
+  auto dst = chunk->data + offset;
+  std::memcpy(dst, &header, sizeof(header));
+  std::memcpy(dst + sizeof(header), data.data(), data.size());
+  std::fill(dst + sizeof(header) + data.size(), dst + span, 0);
+  chunk->copying.fetch_sub(1, std::memory_order_release);
+
+  records_.Increment();
+  return true;
+}
+
+CaptureWriter::Stats CaptureWriter::GetStats() const {
+  return {records_.Value(), dropped_.Value(), bytes_.Value()};
+}
+
+void CaptureWriter::Seal() {
+  full_.push_back(current_);
+  current_ = nullptr;
+  cv_.notify_one();
+}
+
+void CaptureWriter::Run() {
+  WMR_TRACE_THREAD_NAME("Capture writer");
+
+  std::unique_lock l{m_};
+  while (true) {
+    cv_.wait_for(l, kFlushInterval, [this]() { return !full_.empty() || stopping_; });
+
+    // Don't let a trickle of records sit in memory indefinitely
+    if (current_ &&
+        (stopping_ || std::chrono::steady_clock::now() - current_->opened >= kFlushInterval)) {
+      Seal();
+    }
+
+    if (full_.empty()) {
+      if (stopping_) break;
+      continue;
+    }
+
+    auto chunk = full_.front();
+    full_.pop_front();
+    l.unlock();
+
+    {
+      WMR_TRACE_SCOPE("CaptureWriter write chunk");
+
+      // Wait for writers that reserved room before the chunk was sealed to finish copying
+      while (chunk->copying.load(std::memory_order_acquire) > 0) std::this_thread::yield();
+
+      capture::ChunkHeader header{chunk->used - sizeof(capture::ChunkHeader), chunk->records, 0,
+                                  chunk->first_ns, chunk->last_ns};
+      std::memcpy(chunk->data, &header, sizeof(header));
+
+      if (!failed_ && WriteFully(chunk->data, chunk->used)) {
+        index_.push_back({offset_, chunk->first_ns, chunk->last_ns});
+        offset_ += chunk->used;
+        bytes_.Increment(chunk->used);
+      } else {
+        dropped_.Increment(chunk->records);
+        l.lock();
+        failed_ = true;
+        l.unlock();
+      }
+    }
+
+    l.lock();
+    free_.push_back(chunk);
+  }
+  l.unlock();
+
+  // Without the index, a reader has to walk the chunks, but can still read them
+  capture::Trailer trailer{offset_, index_.size(), capture::kIndexMagic};
+  if (!failed_ &&
+      (!WriteFully(index_.data(), index_.size() * sizeof(capture::IndexEntry)) ||
+       !WriteFully(&trailer, sizeof(trailer)))) {
+    spdlog::error("CaptureWriter: Failed to write the index of {}", path_);
+  }
+}
+
+bool CaptureWriter::WriteFully(const void* data, std::size_t size) {
+  auto p = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    auto written = write(fd_, p, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      spdlog::error("CaptureWriter: Failed to write {}: {}", path_, std::strerror(errno));
+      return false;
+    }
+    p += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+}  // namespace wmr
@@ -0,0 +1,117 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <wmr/types.hpp>
+
+#include "capture_format.hpp"
+#include "metrics_registry.hpp"
+#include "slab.hpp"
+
+namespace wmr {
+
+/** Records headset traffic to a capture file (see capture_format.hpp), without ever making the
+ * threads it comes from wait on the disk.
+ * Records are copied into chunk buffers, all allocated up front, which a thread of its own writes
+ * out once they fill up, or have sat partly filled for kFlushInterval. A writing thread only holds
+ * the lock long enough to reserve room in the current chunk, and copies its record outside of it.
+ * If every buffer is waiting to be written, new records are dropped (and counted) rather than
+ * queued.
+ */
+class CaptureWriter {
+ public:
+  using BufferView = std::basic_string_view<uint8_t>;
+
+  struct Stats {
+    uint64_t records; /**< Records accepted. */
+    uint64_t dropped; /**< Records dropped for lack of buffer space, or after a write error. */
+    uint64_t bytes;   /**< Bytes written to the file so far. */
+  };
+
+  /** Truncates path, and throws std::runtime_error if it can't be created. buffer_size bytes are
+   * allocated for chunks of chunk_size bytes, which bounds the size of a record. Its health is
+   * reported to metrics.
+   */
+  CaptureWriter(const std::string& path, std::size_t buffer_size, std::size_t chunk_size,
+                std::shared_ptr<MetricsRegistry> metrics);
+
+  /** Writes out every record accepted so far, then the index. */
+  ~CaptureWriter();
+
+  CaptureWriter(const CaptureWriter&) = delete;
+  CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+  /** Append a record. Safe to call from any thread. Returns false if it was dropped. */
+  bool Write(capture::RecordType type, uint16_t status, HostTimestamp received, BufferView data);
+
+  Stats GetStats() const;
+
+ private:
+  static constexpr std::chrono::milliseconds kFlushInterval{1000};
+
+  struct Chunk {
+    uint8_t* data;         // ChunkHeader, then records
+    std::size_t used;      // Bytes of data reserved, including the ChunkHeader
+    uint32_t records;
+    int64_t first_ns;
+    int64_t last_ns;
+    std::chrono::steady_clock::time_point opened;
+
+    // Writers still copying into data. The chunk can't be written out until this drops to zero.
+    std::atomic<uint32_t> copying;
+  };
+
+  /** Queue current_ for writing. Call with m_ held. */
+  void Seal();
+
+  void Run();
+
+  /** Write size bytes, or log why not and return false. Only called from the writer thread. */
+  bool WriteFully(const void* data, std::size_t size);
+
+  std::string path_;
+  std::size_t chunk_size_;
+
+  std::shared_ptr<MetricsRegistry> metrics_;
+  MetricsRegistry::Counter& records_;
+  MetricsRegistry::Counter& dropped_;
+  MetricsRegistry::Counter& bytes_;
+
+  Slab slab_;
+  std::unique_ptr<Chunk[]> chunks_;
+
+  std::mutex m_;
+  std::condition_variable cv_;  // Signals the writer thread that full_ is non-empty, or to stop
+  std::vector<Chunk*> free_;
+  std::deque<Chunk*> full_;
+  Chunk* current_{};
+  bool stopping_{};
+  bool failed_{};  // Set once a write fails, after which everything is dropped
+
+  int fd_ = -1;
+
+  // Only touched by the writer thread
+  uint64_t offset_{};
+  std::vector<capture::IndexEntry> index_;
+
+  // Last, so that everything it uses is constructed first
+  std::thread thread_;
+};
+
+}  // namespace wmr
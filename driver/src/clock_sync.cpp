@@ -0,0 +1,136 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "clock_sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace wmr {
+
+void ClockSync::AddSample(Timestamp device_time, HostTimestamp host_time) {
+  std::lock_guard l{m_};
+
+  if (!have_reference_ || device_time < newest_device_time_ - kMaxBackstep) {
+    Reset();
+    have_reference_ = true;
+    device_reference_ = device_time;
+    host_reference_ = host_time;
+  }
+  newest_device_time_ = std::max(newest_device_time_, device_time);
+
+  auto device_delta = device_time - device_reference_;
+  Point p{std::chrono::duration<double>(device_delta).count(),
+          std::chrono::duration<double, std::nano>(host_time - host_reference_ - device_delta)
+              .count()};
+
+  auto bin = device_delta.count() / kBinWidth.count();
+  if (bin < current_bin_) return;  // Late, and its bin is already closed
+
+  if (bin > current_bin_) {
+    if (current_bin_ >= 0) {
+      bins_[bin_next_] = current_;
+      bin_next_ = (bin_next_ + 1) % kBinCount;
+      bin_count_ = std::min(bin_count_ + 1, kBinCount);
+    }
+    current_bin_ = bin;
+    current_ = p;
+  } else if (p.y < current_.y) {
+    current_ = p;
+  } else {
+    return;  // Arrived later than the best point of its bin, so tells us nothing new
+  }
+
+  Fit();
+}
+
+HostTimestamp ClockSync::ToHost(Timestamp device_time) const {
+  std::lock_guard l{m_};
+  if (!have_reference_) return {};
+
+  auto device_delta = device_time - device_reference_;
+  double x = std::chrono::duration<double>(device_delta).count();
+  auto correction = std::chrono::nanoseconds(std::llround(intercept_ + slope_ * x));
+  return host_reference_ + std::chrono::duration_cast<HostTimestamp::duration>(device_delta) +
+         std::chrono::duration_cast<HostTimestamp::duration>(correction);
+}
+
+ClockSync::Estimate ClockSync::GetEstimate() const {
+  std::lock_guard l{m_};
+  return {fit_points_, slope_ * 1e-3, std::chrono::nanoseconds(std::llround(jitter_))};
+}
+
+void ClockSync::Reset() {
+  have_reference_ = false;
+  newest_device_time_ = {};
+  bin_count_ = 0;
+  bin_next_ = 0;
+  current_bin_ = -1;
+  intercept_ = 0;
+  slope_ = 0;
+  fit_points_ = 0;
+  jitter_ = 0;
+}
+
+void ClockSync::Fit() {
+  // The completed bins, plus the one being filled
+  std::array<Point, kBinCount + 1> points;
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < bin_count_; ++i) points[n++] = bins_[i];
+  points[n++] = current_;
+
+  auto fit = [&](const auto& keep, double& intercept, double& slope) {
+    double sx = 0, sy = 0;
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!keep(i)) continue;
+      sx += points[i].x;
+      sy += points[i].y;
+      ++count;
+    }
+    double mx = sx / count, my = sy / count;
+
+    double sxx = 0, sxy = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      if (!keep(i)) continue;
+      sxx += (points[i].x - mx) * (points[i].x - mx);
+      sxy += (points[i].x - mx) * (points[i].y - my);
+    }
+
+    // Until the points span some time, only estimate the offset
+    slope = sxx > 1e-6 ? sxy / sxx : 0;
+    intercept = my - slope * mx;
+    return count;
+  };
+
+  double intercept, slope;
+  fit([](std::size_t) { return true; }, intercept, slope);
+
+  // Reject points well above the first fit, i.e. ones that were held up in transit
+  std::array<double, kBinCount + 1> distance{};
+  for (std::size_t i = 0; i < n; ++i) {
+    distance[i] = std::abs(points[i].y - (intercept + slope * points[i].x));
+  }
+  std::nth_element(distance.begin(), distance.begin() + n / 2, distance.begin() + n);
+  jitter_ = distance[n / 2];
+  double threshold = std::max(kRejectScale * jitter_, kMinRejectNs);
+
+  double first_intercept = intercept, first_slope = slope;
+  fit_points_ = fit(
+      [&](std::size_t i) {
+        return points[i].y - (first_intercept + first_slope * points[i].x) <= threshold;
+      },
+      intercept, slope);
+
+  // Lower the line onto the envelope, so that no report seems to have arrived before it was sent
+  double lowest = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    lowest = std::min(lowest, points[i].y - (intercept + slope * points[i].x));
+  }
+  intercept_ = intercept + lowest;
+  slope_ = slope;
+}
+
+}  // namespace wmr
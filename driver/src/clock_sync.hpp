@@ -0,0 +1,92 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include <wmr/types.hpp>
+
+namespace wmr {
+
+/** Online estimate of the mapping from device timestamps to the host's steady_clock.
+ * Every report received gives a point (device timestamp, host receive time). The receive time is
+ * the device timestamp on the host clock, plus a transport delay that's never negative, and that's
+ * only sometimes close to its minimum. So the mapping is fitted to the lower envelope of the
+ * points: they're binned by device time, only the earliest-arriving point of each bin is kept, and
+ * a line (offset and drift) is fitted to those by least squares. Points that sit well above the
+ * line are rejected and the line refitted, then it's lowered to touch the lowest point.
+ * Safe to use from multiple threads, e.g. to feed it both camera and IMU reports.
+ */
+class ClockSync {
+ public:
+  struct Estimate {
+    std::size_t points;              /**< Bins the current fit is based on. */
+    double drift_ppm;                /**< How much faster the host clock runs, in ppm. */
+    std::chrono::nanoseconds jitter; /**< Median distance of the bins from the fitted line. */
+  };
+
+  /** Record that a report stamped device_time by the device was received at host_time. */
+  void AddSample(Timestamp device_time, HostTimestamp host_time);
+
+  /** Map device_time to the host clock. Before the first sample, returns the epoch. */
+  HostTimestamp ToHost(Timestamp device_time) const;
+
+  Estimate GetEstimate() const;
+
+ private:
+  /** Width of each bin, in device time. */
+  static constexpr Timestamp kBinWidth = std::chrono::milliseconds(100);
+
+  /** Bins in the fitting window, which thus covers kBinCount * kBinWidth of device time. */
+  static constexpr std::size_t kBinCount = 64;
+
+  /** Points are rejected if they're further above the first fit than kRejectScale times the median
+   * distance of all points from it, or kMinRejectNs, whichever is more.
+   */
+  static constexpr double kRejectScale = 3;
+  static constexpr double kMinRejectNs = 50e3;
+
+  /** A device timestamp this far behind the newest one means the device clock was reset. */
+  static constexpr Timestamp kMaxBackstep = std::chrono::seconds(1);
+
+  /** Earliest-arriving point of one bin, relative to the reference point. */
+  struct Point {
+    double x;  // Device time, in seconds
+    double y;  // Host time minus device time, in nanoseconds
+  };
+
+  /** Clear all state. Call with m_ held. */
+  void Reset();
+
+  /** Refit the line to the bins in the window. Call with m_ held. */
+  void Fit();
+
+  mutable std::mutex m_;
+
+  // Every point is relative to the first sample, so that the fit is well conditioned
+  bool have_reference_{};
+  Timestamp device_reference_{};
+  HostTimestamp host_reference_{};
+  Timestamp newest_device_time_{};
+
+  std::array<Point, kBinCount> bins_{};
+  std::size_t bin_count_{};
+  std::size_t bin_next_{};    // Index in bins_ of the next completed bin
+  int64_t current_bin_ = -1;  // Index of the bin being filled, counting from device_reference_
+  Point current_{};
+
+  // y = intercept_ + slope_ * x
+  double intercept_{};
+  double slope_{};
+  std::size_t fit_points_{};
+  double jitter_{};
+};
+
+}  // namespace wmr
@@ -0,0 +1,110 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "command_queue.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "trace.hpp"
+
+namespace wmr {
+
+CommandQueue::CommandQueue(std::size_t key_count, SubmitFn submit, CancelFn cancel)
+    : submit_(std::move(submit)), cancel_(std::move(cancel)), slots_(key_count) {}
+
+CommandQueue::~CommandQueue() {
+  std::vector<std::size_t> in_flight;
+  {
+    std::lock_guard l{m_};
+    stopping_ = true;
+    for (std::size_t key = 0; key < slots_.size(); ++key) {
+      if (slots_[key].in_flight) in_flight.push_back(key);
+    }
+  }
+
+  // Outside the lock, in case cancelling completes the send right away
+  for (auto key : in_flight) {
+    try {
+      cancel_(key);
+    } catch (std::exception& e) {
+      spdlog::warn("CommandQueue::~CommandQueue: Failed to cancel command: {}", e.what());
+    } catch (...) {
+      spdlog::warn("CommandQueue::~CommandQueue: Failed to cancel command");
+    }
+  }
+
+  std::unique_lock l{m_};
+  idle_cv_.wait(l, [this]() { return in_flight_ == 0; });
+}
+
+void CommandQueue::Send(std::size_t key, const void* command, std::size_t size,
+                        std::promise<void>* sent) {
+  if (size > kMaxCommandSize) throw std::out_of_range("CommandQueue::Send: Command too big");
+
+  std::lock_guard l{m_};
+  auto& slot = slots_.at(key);
+
+  // Replace whatever command was waiting. Its callers are told once this one is sent.
+  auto bytes = static_cast<const uint8_t*>(command);
+  std::copy(bytes, bytes + size, slot.pending_command.begin());
+  slot.pending_size = size;
+  slot.pending = true;
+  if (sent) slot.waiting.push_back(std::move(*sent));
+
+  if (!slot.in_flight && !stopping_) Submit(key);
+}
+
+void CommandQueue::OnSent(std::size_t key, bool ok) {
+  WMR_TRACE_SCOPE("CommandQueue::OnSent");
+
+  std::lock_guard l{m_};
+  auto& slot = slots_.at(key);
+  slot.in_flight = false;
+  --in_flight_;
+
+  if (ok) {
+    Complete(slot, nullptr);
+  } else {
+    Complete(slot, std::make_exception_ptr(std::runtime_error("CommandQueue: Send failed")));
+  }
+
+  // Send the latest command that came in meanwhile
+  if (slot.pending && !stopping_) Submit(key);
+  if (in_flight_ == 0) idle_cv_.notify_all();
+}
+
+void CommandQueue::Submit(std::size_t key) {
+  auto& slot = slots_[key];
+  std::copy_n(slot.pending_command.begin(), slot.pending_size, slot.buffer.begin());
+  slot.sending.swap(slot.waiting);
+  slot.pending = false;
+
+  try {
+    submit_(key, slot.buffer.data(), slot.pending_size);
+  } catch (std::exception& e) {
+    spdlog::warn("CommandQueue::Submit: Failed to submit command: {}", e.what());
+    Complete(slot, std::current_exception());
+    return;
+  }
+
+  slot.in_flight = true;
+  ++in_flight_;
+}
+
+void CommandQueue::Complete(Slot& slot, std::exception_ptr error) {
+  for (auto& promise : slot.sending) {
+    if (error) {
+      promise.set_exception(error);
+    } else {
+      promise.set_value();
+    }
+  }
+  slot.sending.clear();
+}
+
+}  // namespace wmr
@@ -0,0 +1,93 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <vector>
+
+namespace wmr {
+
+/** Sends commands asynchronously, without blocking the caller.
+ * Each command has a key (e.g. the camera type it's for), and each key gets a send of its own in
+ * progress, so commands for different keys go out back to back. A command for a key whose send is
+ * still in progress waits for it, and is replaced by any later command for the same key, so only
+ * the latest one is sent. How commands are sent is up to the owner: UsbCameraTransport submits a
+ * libusb transfer for each, and reports its completion from the event thread, from which it's also
+ * fine to call Send.
+ */
+class CommandQueue {
+ public:
+  static constexpr std::size_t kMaxCommandSize = 64;
+
+  /** Start sending size bytes of command for key, and see to it that OnSent(key, ...) is called
+   * once that's done, e.g. from a transfer callback. command stays valid until then. Throws if the
+   * send can't be started. Called with the queue's lock held, so it mustn't call OnSent itself.
+   */
+  using SubmitFn = std::function<void(std::size_t key, const uint8_t* command, std::size_t size)>;
+
+  /** Make the send in progress for key finish early. OnSent must still be called for it. */
+  using CancelFn = std::function<void(std::size_t key)>;
+
+  CommandQueue(std::size_t key_count, SubmitFn submit, CancelFn cancel);
+
+  /** Cancels sends in progress, and waits for OnSent to be called for them. Errors from cancelling
+   * are logged. Futures of commands not sent yet get a std::future_error (broken_promise).
+   */
+  ~CommandQueue();
+
+  CommandQueue(const CommandQueue&) = delete;
+  CommandQueue& operator=(const CommandQueue&) = delete;
+
+  /** Queue size bytes of command for key. Throws std::out_of_range if key or size is too big.
+   * Doesn't allocate unless sent is given. Then it's moved from, and fulfilled once this command,
+   * or a later one for the same key that replaced it, has been sent. If sending fails, it holds a
+   * std::runtime_error.
+   */
+  void Send(std::size_t key, const void* command, std::size_t size,
+            std::promise<void>* sent = nullptr);
+
+  /** Report that the send in progress for key is done, successfully or not. Starts sending the
+   * latest command that came in meanwhile, if any.
+   */
+  void OnSent(std::size_t key, bool ok);
+
+ private:
+  struct Slot {
+    bool in_flight{};
+    std::array<uint8_t, kMaxCommandSize> buffer{};  // Being sent
+    std::vector<std::promise<void>> sending;
+
+    bool pending{};
+    std::array<uint8_t, kMaxCommandSize> pending_command{};
+    std::size_t pending_size{};
+    std::vector<std::promise<void>> waiting;
+  };
+
+  /** Start sending the pending command of the slot for key. Call with m_ held, while the slot
+   * isn't in flight.
+   */
+  void Submit(std::size_t key);
+
+  /** Complete the promises of the command slot was sending. Call with m_ held. */
+  static void Complete(Slot& slot, std::exception_ptr error);
+
+  SubmitFn submit_;
+  CancelFn cancel_;
+
+  std::mutex m_;
+  std::condition_variable idle_cv_;  // Signals the destructor that in_flight_ dropped to zero
+  std::vector<Slot> slots_;
+  std::size_t in_flight_{};
+  bool stopping_{};
+};
+
+}  // namespace wmr
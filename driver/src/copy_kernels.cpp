@@ -0,0 +1,305 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "copy_kernels.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WUMBO_COPY_KERNELS_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define WUMBO_COPY_KERNELS_NEON
+#endif
+
+namespace wmr {
+
+namespace {
+
+// Scalar
+
+void CopyScalar(uint8_t* dst, const uint8_t* src, std::size_t size) {
+  std::memcpy(dst, src, size);
+}
+
+void FenceNone() {}
+
+void DownsampleScalar(uint8_t* dst, const uint8_t* src0, const uint8_t* src1,
+                      std::size_t dst_size) {
+  for (std::size_t i = 0; i < dst_size; ++i) {
+    dst[i] = static_cast<uint8_t>(
+        (src0[2 * i] + src0[2 * i + 1] + src1[2 * i] + src1[2 * i + 1] + 2) >> 2);
+  }
+}
+
+void RemapScalar(uint8_t* dst, const uint8_t* src, const uint32_t* top, const uint32_t* bottom,
+                 const uint16_t* weights, std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i) {
+    int fx = weights[i] & 0xFF;
+    int fy = weights[i] >> 8;
+    auto t = src + top[i];
+    auto b = src + bottom[i];
+
+    int upper = t[0] * (kRemapScale - fx) + t[1] * fx;
+    int lower = b[0] * (kRemapScale - fx) + b[1] * fx;
+    dst[i] = static_cast<uint8_t>((upper * (kRemapScale - fy) + lower * fy +
+                                   (1 << (2 * kRemapFractionBits - 1))) >>
+                                  (2 * kRemapFractionBits));
+  }
+}
+
+#ifdef WUMBO_COPY_KERNELS_X86
+
+// SSE4.1
+
+__attribute__((target("sse4.1"))) void CopySse4(uint8_t* dst, const uint8_t* src,
+                                                 std::size_t size) {
+  std::size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+    auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+    auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+  }
+  for (; i + 16 <= size; i += 16) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+  }
+  std::memcpy(dst + i, src + i, size - i);
+}
+
+__attribute__((target("sse4.1"))) void CopyNtSse4(uint8_t* dst, const uint8_t* src,
+                                                   std::size_t size) {
+  if (size < 64) return CopySse4(dst, src, size);
+
+  // Unaligned head, so that the streaming stores below are 16 byte aligned
+  auto head = (16 - (reinterpret_cast<std::uintptr_t>(dst) & 15)) & 15;
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+
+  std::size_t i = head;
+  for (; i + 16 <= size; i += 16) {
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+  }
+
+  // Unaligned tail, overlapping the last streamed block
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + size - 16),
+                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + size - 16)));
+}
+
+__attribute__((target("sse4.1"))) void FenceSse4() { _mm_sfence(); }
+
+__attribute__((target("sse4.1"))) void DownsampleSse4(uint8_t* dst, const uint8_t* src0,
+                                                       const uint8_t* src1, std::size_t dst_size) {
+  // maddubs against all ones sums horizontally adjacent pixels into 16 bit lanes
+  const auto ones = _mm_set1_epi8(1);
+  const auto two = _mm_set1_epi16(2);
+
+  std::size_t i = 0;
+  for (; i + 16 <= dst_size; i += 16) {
+    auto a_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * i));
+    auto a_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + 2 * i + 16));
+    auto b_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * i));
+    auto b_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + 2 * i + 16));
+
+    auto lo = _mm_add_epi16(_mm_maddubs_epi16(a_lo, ones), _mm_maddubs_epi16(b_lo, ones));
+    auto hi = _mm_add_epi16(_mm_maddubs_epi16(a_hi, ones), _mm_maddubs_epi16(b_hi, ones));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+  }
+  DownsampleScalar(dst + i, src0 + 2 * i, src1 + 2 * i, dst_size - i);
+}
+
+// AVX2
+
+__attribute__((target("avx2"))) void CopyAvx2(uint8_t* dst, const uint8_t* src,
+                                               std::size_t size) {
+  std::size_t i = 0;
+  for (; i + 128 <= size; i += 128) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+    auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 64));
+    auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 96));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), b);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 64), c);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 96), d);
+  }
+  for (; i + 32 <= size; i += 32) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+  }
+  std::memcpy(dst + i, src + i, size - i);
+}
+
+__attribute__((target("avx2"))) void CopyNtAvx2(uint8_t* dst, const uint8_t* src,
+                                                 std::size_t size) {
+  if (size < 128) return CopyAvx2(dst, src, size);
+
+  // Unaligned head, so that the streaming stores below are 32 byte aligned
+  auto head = (32 - (reinterpret_cast<std::uintptr_t>(dst) & 31)) & 31;
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+
+  std::size_t i = head;
+  for (; i + 32 <= size; i += 32) {
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+  }
+
+  // Unaligned tail, overlapping the last streamed block
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + size - 32),
+                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + size - 32)));
+}
+
+__attribute__((target("avx2"))) void DownsampleAvx2(uint8_t* dst, const uint8_t* src0,
+                                                     const uint8_t* src1, std::size_t dst_size) {
+  const auto ones = _mm256_set1_epi8(1);
+  const auto two = _mm256_set1_epi16(2);
+
+  std::size_t i = 0;
+  for (; i + 32 <= dst_size; i += 32) {
+    auto a_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + 2 * i));
+    auto a_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src0 + 2 * i + 32));
+    auto b_lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + 2 * i));
+    auto b_hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src1 + 2 * i + 32));
+
+    auto lo = _mm256_add_epi16(_mm256_maddubs_epi16(a_lo, ones), _mm256_maddubs_epi16(b_lo, ones));
+    auto hi = _mm256_add_epi16(_mm256_maddubs_epi16(a_hi, ones), _mm256_maddubs_epi16(b_hi, ones));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+    // packus works within 128 bit lanes, so put the quadwords back in order afterwards
+    auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+  }
+  DownsampleScalar(dst + i, src0 + 2 * i, src1 + 2 * i, dst_size - i);
+}
+
+__attribute__((target("avx2"))) void RemapAvx2(uint8_t* dst, const uint8_t* src,
+                                                const uint32_t* top, const uint32_t* bottom,
+                                                const uint16_t* weights, std::size_t size) {
+  const auto scale = _mm256_set1_epi32(kRemapScale);
+  const auto low_mask = _mm256_set1_epi32(0xFF);
+  const auto second_mask = _mm256_set1_epi32(0xFF00);
+  const auto round = _mm256_set1_epi32(1 << (2 * kRemapFractionBits - 1));
+
+  // Picks the low byte of each 32 bit lane into the bottom 4 bytes of each 128 bit lane
+  const auto pick = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                     0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  const auto gather = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    auto t_idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + i));
+    auto b_idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + i));
+    auto w = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(weights + i)));
+
+    // Each gather fetches a horizontal pixel pair (plus two bytes we don't need) per lane, which
+    // is spread into two 16 bit halves to be blended with madd
+    auto t = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), t_idx, 1);
+    auto b = _mm256_i32gather_epi32(reinterpret_cast<const int*>(src), b_idx, 1);
+    t = _mm256_or_si256(_mm256_and_si256(t, low_mask),
+                        _mm256_slli_epi32(_mm256_and_si256(t, second_mask), 8));
+    b = _mm256_or_si256(_mm256_and_si256(b, low_mask),
+                        _mm256_slli_epi32(_mm256_and_si256(b, second_mask), 8));
+
+    auto fx = _mm256_and_si256(w, low_mask);
+    auto fy = _mm256_srli_epi32(w, 8);
+    auto wx = _mm256_or_si256(_mm256_sub_epi32(scale, fx), _mm256_slli_epi32(fx, 16));
+    auto wy = _mm256_or_si256(_mm256_sub_epi32(scale, fy), _mm256_slli_epi32(fy, 16));
+
+    auto upper = _mm256_madd_epi16(t, wx);
+    auto lower = _mm256_madd_epi16(b, wx);
+    auto blend = _mm256_madd_epi16(_mm256_or_si256(upper, _mm256_slli_epi32(lower, 16)), wy);
+    blend = _mm256_srli_epi32(_mm256_add_epi32(blend, round), 2 * kRemapFractionBits);
+
+    auto packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(blend, pick), gather);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm256_castsi256_si128(packed));
+  }
+  RemapScalar(dst + i, src, top + i, bottom + i, weights + i, size - i);
+}
+
+#endif  // WUMBO_COPY_KERNELS_X86
+
+#ifdef WUMBO_COPY_KERNELS_NEON
+
+// NEON (AArch64 doesn't have non-temporal stores that bypass cache in the same sense; STNP is a
+// hint the core is free to ignore, so copy_nt and copy share an implementation.)
+
+void CopyNeon(uint8_t* dst, const uint8_t* src, std::size_t size) {
+  std::size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    auto v = vld1q_u8_x4(src + i);
+    vst1q_u8_x4(dst + i, v);
+  }
+  for (; i + 16 <= size; i += 16) {
+    vst1q_u8(dst + i, vld1q_u8(src + i));
+  }
+  std::memcpy(dst + i, src + i, size - i);
+}
+
+void DownsampleNeon(uint8_t* dst, const uint8_t* src0, const uint8_t* src1, std::size_t dst_size) {
+  std::size_t i = 0;
+  for (; i + 8 <= dst_size; i += 8) {
+    auto sum = vaddq_u16(vpaddlq_u8(vld1q_u8(src0 + 2 * i)), vpaddlq_u8(vld1q_u8(src1 + 2 * i)));
+    vst1_u8(dst + i, vrshrn_n_u16(sum, 2));
+  }
+  DownsampleScalar(dst + i, src0 + 2 * i, src1 + 2 * i, dst_size - i);
+}
+
+#endif  // WUMBO_COPY_KERNELS_NEON
+
+constexpr CopyKernel kScalarKernel{"scalar",  CopyScalar,       CopyScalar,
+                                   FenceNone, DownsampleScalar, RemapScalar};
+
+#ifdef WUMBO_COPY_KERNELS_X86
+// Without a gather instruction, remap gains nothing from SSE
+constexpr CopyKernel kSse4Kernel{"sse4.1",  CopySse4,       CopyNtSse4,
+                                 FenceSse4, DownsampleSse4, RemapScalar};
+constexpr CopyKernel kAvx2Kernel{"avx2",    CopyAvx2,       CopyNtAvx2,
+                                 FenceSse4, DownsampleAvx2, RemapAvx2};
+#endif
+
+#ifdef WUMBO_COPY_KERNELS_NEON
+// Likewise, NEON has no gather
+constexpr CopyKernel kNeonKernel{"neon",    CopyNeon,       CopyNeon,
+                                 FenceNone, DownsampleNeon, RemapScalar};
+#endif
+
+const CopyKernel& SelectCopyKernel() {
+#if defined(WUMBO_COPY_KERNELS_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return kAvx2Kernel;
+  if (__builtin_cpu_supports("sse4.1")) return kSse4Kernel;
+#elif defined(WUMBO_COPY_KERNELS_NEON)
+  return kNeonKernel;
+#endif
+  return kScalarKernel;
+}
+
+}  // namespace
+
+const CopyKernel& GetCopyKernel() {
+  static const CopyKernel& kernel = []() -> const CopyKernel& {
+    auto& k = SelectCopyKernel();
+    spdlog::debug("GetCopyKernel: selected {} kernel", k.name);
+    return k;
+  }();
+
+  return kernel;
+}
+
+}  // namespace wmr
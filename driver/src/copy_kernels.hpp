@@ -0,0 +1,56 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wmr {
+
+/** A set of block copy routines tuned for one instruction set.
+ * Camera frames are unpacked as a long sequence of short (<= one row) block copies, so these are
+ * called many thousands of times per frame.
+ */
+struct CopyKernel {
+  using CopyFn = void (*)(uint8_t* dst, const uint8_t* src, std::size_t size);
+  using DownsampleFn = void (*)(uint8_t* dst, const uint8_t* src0, const uint8_t* src1,
+                                std::size_t dst_size);
+  using RemapFn = void (*)(uint8_t* dst, const uint8_t* src, const uint32_t* top,
+                           const uint32_t* bottom, const uint16_t* weights, std::size_t size);
+
+  const char* name;
+
+  /** Regular copy. Leaves dst in cache. */
+  CopyFn copy;
+
+  /** Copy using non-temporal stores where possible. Call fence() before publishing dst. */
+  CopyFn copy_nt;
+
+  /** Order all preceding non-temporal stores before subsequent stores. */
+  void (*fence)();
+
+  /** Downsample two rows into one, averaging each 2x2 block of pixels (rounding to nearest).
+   * src0 and src1 are at least 2 * dst_size pixels long.
+   */
+  DownsampleFn downsample;
+
+  /** Bilinearly interpolate size pixels out of src.
+   * Pixel i blends the pixel pairs at src + top[i] and src + bottom[i]. weights[i] holds the
+   * horizontal fraction in its low byte and the vertical fraction in its high byte, both in units
+   * of 1 / kRemapScale. Reads up to 4 bytes at each offset.
+   */
+  RemapFn remap;
+};
+
+constexpr int kRemapFractionBits = 5;
+constexpr int kRemapScale = 1 << kRemapFractionBits;
+
+/** Return the best CopyKernel supported by the CPU we're running on.
+ * Selection happens once, at first call.
+ */
+const CopyKernel& GetCopyKernel();
+
+}  // namespace wmr
@@ -0,0 +1,112 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "copy_plan.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace wmr {
+
+CopyPlan::CopyPlan(const HeadsetSpec& spec)
+    : image_count_(spec.n_cameras),
+      image_width_(spec.camera_width),
+      image_size_(spec.camera_width * spec.camera_height) {
+  if (image_count_ == 0 || image_count_ > kMaxImages) {
+    throw std::invalid_argument("CopyPlan: Unsupported number of cameras");
+  }
+  if (spec.camera_width > std::numeric_limits<decltype(Span::length)>::max() ||
+      spec.camera_frame_size > std::numeric_limits<decltype(Span::src_offset)>::max()) {
+    throw std::invalid_argument("CopyPlan: Frame geometry too large");
+  }
+
+  CompileSpans(spec);
+  CompileRowLayouts(spec);
+}
+
+void CopyPlan::CompileSpans(const HeadsetSpec& spec) {
+  std::vector<std::size_t> bytes_copied_per_image(image_count_, 0);
+  std::size_t cam_idx = 0;
+
+  // The first row of each image contains metadata
+  // TODO what is the metatadata?
+  std::size_t frame_offset = kSegmentHeaderSize + image_count_ * spec.camera_width;
+  if (frame_offset > spec.camera_segment_size) {
+    throw std::invalid_argument("CopyPlan: Metadata rows don't fit in the first segment");
+  }
+
+  segments_.push_back({0, 0, 0});
+  std::size_t segment_end = spec.camera_segment_size;
+
+  while (true) {
+    // Emit spans until the segment is exhausted, splitting at row boundaries
+    while (frame_offset < segment_end) {
+      auto row_remaining = spec.camera_width - bytes_copied_per_image[cam_idx] % spec.camera_width;
+      auto block_size = std::min(segment_end - frame_offset, row_remaining);
+
+      if (frame_offset + block_size >= spec.camera_frame_size) {
+        throw std::runtime_error("CopyPlan: Ran out of bytes in raw frame");
+      }
+
+      spans_.push_back({static_cast<uint32_t>(frame_offset),
+                        static_cast<uint32_t>(bytes_copied_per_image[cam_idx]),
+                        static_cast<uint16_t>(block_size), static_cast<uint8_t>(cam_idx)});
+
+      frame_offset += block_size;
+      bytes_copied_per_image[cam_idx] += block_size;
+
+      // If we finished reading a row, move to the next camera
+      if (bytes_copied_per_image[cam_idx] % spec.camera_width == 0) {
+        cam_idx = (cam_idx + 1) % image_count_;
+
+        // If the image for the next camera is already complete, we're done
+        if (bytes_copied_per_image[cam_idx] == image_size_) {
+          segments_.back().span_end = spans_.size();
+
+          // Trailing segments carry no image data, but still have headers
+          while (segments_.size() < spec.camera_segment_count) {
+            auto span_idx = static_cast<uint32_t>(spans_.size());
+            segments_.push_back({static_cast<uint32_t>(segments_.size() * spec.camera_segment_size),
+                                 span_idx, span_idx});
+          }
+
+          return;
+        }
+      }
+    }
+
+    // Seek past the next segment header
+    segments_.back().span_end = spans_.size();
+    if (segments_.size() == spec.camera_segment_count) {
+      throw std::runtime_error("CopyPlan: Ran out of segments in raw frame");
+    }
+
+    auto span_idx = static_cast<uint32_t>(spans_.size());
+    segments_.push_back({static_cast<uint32_t>(segment_end), span_idx, span_idx});
+    frame_offset = segment_end + kSegmentHeaderSize;
+    segment_end += spec.camera_segment_size;
+  }
+}
+
+void CopyPlan::CompileRowLayouts(const HeadsetSpec& spec) {
+  row_layouts_.resize(image_count_ * spec.camera_height);
+
+  // Each row is made of one span, or two if it straddles a segment header
+  for (auto& span : spans_) {
+    auto row = span.dst_offset / spec.camera_width;
+    auto& layout = row_layouts_[span.dst_image * spec.camera_height + row];
+
+    if (span.dst_offset % spec.camera_width == 0) {
+      layout.head_offset = span.src_offset;
+      layout.head_size = span.length;
+      layout.tail_offset = span.src_offset + span.length;
+    } else {
+      layout.tail_offset = span.src_offset;
+    }
+  }
+}
+
+}  // namespace wmr
@@ -0,0 +1,67 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <wmr/headset_spec.hpp>
+#include <wmr/types.hpp>
+
+namespace wmr {
+
+/** Precomputed recipe for unpacking a raw camera frame.
+ * The raw frame has segment headers inserted into it, and the individual camera images are stacked
+ * horizontally. A CopyPlan is compiled once from a HeadsetSpec into a flat table of spans, each of
+ * which copies a run of pixels from the raw frame into one image. Spans are grouped by the segment
+ * they read from, and never include segment headers.
+ */
+class CopyPlan {
+ public:
+  static constexpr std::size_t kSegmentHeaderSize = 0x20;
+  static constexpr std::size_t kMaxImages = 8;
+
+  struct Span {
+    uint32_t src_offset; /**< Offset into the raw frame. */
+    uint32_t dst_offset; /**< Offset into image dst_image. */
+    uint16_t length;
+    uint8_t dst_image;
+  };
+
+  struct Segment {
+    uint32_t header_offset; /**< Offset of the segment header in the raw frame. */
+    uint32_t span_begin;    /**< Index of the first span reading from this segment. */
+    uint32_t span_end;      /**< One past the index of the last span reading from this segment. */
+  };
+
+  explicit CopyPlan(const HeadsetSpec& spec);
+
+  const std::vector<Span>& Spans() const { return spans_; }
+  const std::vector<Segment>& Segments() const { return segments_; }
+
+  /** Where each row of each image lives in the raw frame, for zero-copy frames.
+   * Holds image height entries for each image in turn.
+   */
+  const CameraImageView::RowLayout* RowLayouts() const { return row_layouts_.data(); }
+
+  std::size_t ImageCount() const { return image_count_; }
+  std::size_t ImageWidth() const { return image_width_; }
+  std::size_t ImageSize() const { return image_size_; }
+
+ private:
+  void CompileSpans(const HeadsetSpec& spec);
+  void CompileRowLayouts(const HeadsetSpec& spec);
+
+  std::size_t image_count_;
+  std::size_t image_width_;
+  std::size_t image_size_;
+  std::vector<Span> spans_;
+  std::vector<Segment> segments_;
+  std::vector<CameraImageView::RowLayout> row_layouts_;
+};
+
+}  // namespace wmr
@@ -5,7 +5,9 @@
 
 #include <spdlog/spdlog.h>
 
+#include <cstdlib>
 #include <memory>
+#include <string_view>
 #include <thread>
 #include <type_traits>
 #include <utility>
@@ -16,10 +18,13 @@
 #include <wmr/create_headset.hpp>
 
 #include "camera.hpp"
+#include "capture_writer.hpp"
 #include "headset.h"
 #include "hp_reverb_hid.hpp"
 #include "libusb_event_thread.hpp"
 #include "oasis_hid.hpp"
+#include "replay_headset.hpp"
+#include "usb_camera_transport.hpp"
 
 namespace wmr {
 
@@ -35,7 +40,23 @@ std::vector<libusbcpp::Device::Pointer> FilterVidPid(libusbcpp::DeviceList& devi
   return matching_devs;
 }
 
-std::shared_ptr<HeadsetInterface> CreateHeadset(const HeadsetSpec& spec) {
+std::shared_ptr<HeadsetInterface> CreateHeadset(const HeadsetSpec& spec,
+                                                const HeadsetOptions& options) {
+  if (!options.replay.file.empty()) return CreateReplayHeadset(spec, options);
+
+  // Lets tools that only know about CreateHeadset run against a capture
+  if (auto file = std::getenv("WMR_REPLAY"); file && *file) {
+    auto replay_options = options;
+    replay_options.replay.file = file;
+    auto pacing = std::getenv("WMR_REPLAY_PACING");
+    if (pacing && std::string_view(pacing) == "fast") {
+      replay_options.replay.pacing = ReplayPacing::kAsFastAsPossible;
+    } else if (pacing && std::string_view(pacing) != "original") {
+      spdlog::warn("CreateHeadset: Unknown WMR_REPLAY_PACING={}, using original", pacing);
+    }
+    return CreateReplayHeadset(spec, replay_options);
+  }
+
   auto ctx = libusbcpp::Context::Create();
 
   auto dev_list = ctx->GetDeviceList();
@@ -60,8 +81,11 @@ std::shared_ptr<HeadsetInterface> CreateHeadset(const HeadsetSpec& spec) {
   auto hid_sn = hid_dev_hnd->GetStringDescriptorAscii(hid_desc.iSerialNumber);
   std::wstring hid_sn_w(hid_sn.begin(), hid_sn.end());
 
-  auto oasis_hid =
-      std::make_unique<HidDevice>(hid_desc.idVendor, hid_desc.idProduct, hid_sn_w.c_str());
+  // Every part of the headset reports to one registry
+  auto metrics = std::make_shared<MetricsRegistry>();
+
+  auto oasis_hid = std::make_unique<HidDevice>(hid_desc.idVendor, hid_desc.idProduct,
+                                               hid_sn_w.c_str(), metrics, "oasis");
 
   // Get the serial number of vendor_hid_dev
   auto vendor_hid_desc = vendor_hid_dev->GetDeviceDescriptor();
@@ -70,13 +94,35 @@ std::shared_ptr<HeadsetInterface> CreateHeadset(const HeadsetSpec& spec) {
   std::wstring vendor_hid_sn_w(vendor_hid_sn.begin(), vendor_hid_sn.end());
 
   auto vendor_hid = std::make_unique<HidDevice>(vendor_hid_desc.idVendor, vendor_hid_desc.idProduct,
-                                                vendor_hid_sn_w.c_str());
+                                                vendor_hid_sn_w.c_str(), metrics, "vendor");
+
+  // The camera and IMU share one device clock
+  auto clock_sync = std::make_shared<ClockSync>();
+
+  auto camera = std::make_unique<Camera>(
+      spec, options.camera, std::make_unique<UsbCameraTransport>(cam_dev, Camera::kCameraTypeCount),
+      clock_sync, metrics);
 
-  auto camera = std::make_unique<Camera>(spec, cam_dev);
+  auto oasis = std::make_unique<OasisHid>(std::move(oasis_hid), options.imu, clock_sync, metrics);
+
+  if (!options.capture.file.empty()) {
+    // Each part holds on to the writer, which finishes the file once the last of them is gone
+    auto capture = std::make_shared<CaptureWriter>(
+        options.capture.file, options.capture.buffer_size, options.capture.chunk_size, metrics);
+    oasis->SetCapture(capture);
+    vendor_hid->SetCapture(capture, capture::RecordType::kVendorReport);
+    camera->SetCapture(capture);
+  }
+
+  return std::make_shared<Headset>(spec, ctx, std::move(oasis), std::move(camera),
+                                   std::make_unique<HpReverbHid>(std::move(vendor_hid)), metrics,
+                                   options);
+}
 
-  return std::make_shared<Headset>(spec, ctx, std::make_unique<OasisHid>(std::move(oasis_hid)),
-                                   std::move(camera),
-                                   std::make_unique<HpReverbHid>(std::move(vendor_hid)));
+std::shared_ptr<HeadsetInterface> CreateReplayHeadset(const HeadsetSpec& spec,
+                                                      const HeadsetOptions& options) {
+  spdlog::info("CreateReplayHeadset: Replaying {}", options.replay.file);
+  return std::make_shared<ReplayHeadset>(spec, options);
 }
 
 }  // namespace wmr
@@ -13,8 +13,10 @@ namespace wmr {
 std::unique_ptr<OasisHidInterface> Factory::CreateOasisHid(unsigned short vendor_id,
                                                            unsigned short product_id,
                                                            const wchar_t *serial_number) {
+  auto metrics = std::make_shared<MetricsRegistry>();
   return std::make_unique<OasisHid>(
-      std::make_unique<HidDevice>(vendor_id, product_id, serial_number));
+      std::make_unique<HidDevice>(vendor_id, product_id, serial_number, metrics, "oasis"),
+      ImuOptions{}, std::make_shared<ClockSync>(), metrics);
 }
 
 }  // namespace wmr
\ No newline at end of file
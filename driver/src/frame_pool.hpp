@@ -5,81 +5,276 @@
 
 #pragma once
 
-#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <tuple>
-#include <vector>
+
+#include <wmr/headset_options.hpp>
+#include <wmr/pooled_ptr.hpp>
+
+#include "slab.hpp"
 
 namespace wmr {
 
+/** Fixed set of reusable frames, handed out as PooledPtrs that return to the pool when the last
+ * reference is dropped. The reference count is part of each slot, so handing out a frame never
+ * allocates.
+ * Free slots are kept on a lock-free stack, so Allocate and release never take a lock unless a
+ * thread is blocked waiting for a slot, or the pool grows. The stack is threaded through slot
+ * indices, and its head carries a tag that changes with every update, which makes a
+ * compare-and-swap fail if the head was popped and pushed back in the meantime (the ABA problem).
+ * What Allocate does when every slot is in use is up to FramePoolOptions::on_exhaustion.
+ */
 template <class Frame>
 class FramePool {
  public:
+  struct Stats {
+    std::size_t slots;      /**< Slots constructed so far. */
+    std::size_t in_use;     /**< Slots referenced right now. */
+    std::size_t high_water; /**< Most slots ever in use at once. */
+    uint64_t allocations;
+    uint64_t exhaustions;   /**< Allocations that found no free slot. */
+    uint64_t failures;      /**< Allocations that returned nullptr. */
+    std::chrono::nanoseconds wait_time;     /**< Total time Allocate spent blocked. */
+    std::chrono::nanoseconds max_wait_time; /**< Longest single wait in Allocate. */
+  };
+
+  /** Frames get storage_size bytes each, carved out of one Slab, and are constructed as
+   * Frame(storage, args...).
+   */
+  struct SlabStorage {
+    std::size_t storage_size;
+  };
+
+  /** Frames are constructed as Frame(args...). */
   template <class... Args>
-  FramePool(std::size_t n_slots, const Args&... args) : n_slots_(n_slots) {
-    assert(n_slots_ > 0);
+  FramePool(const FramePoolOptions& options, const Args&... args)
+      : FramePool(options, MakeSlot([this, args = std::make_tuple(args...)](std::size_t idx) {
+          return std::apply(
+              [&](const auto&... a) { return std::make_unique<Slot>(this, idx, a...); }, args);
+        })) {
+    Fill();
+  }
+
+  template <class... Args>
+  FramePool(const FramePoolOptions& options, SlabStorage storage, const Args&... args)
+      : FramePool(options, MakeSlot([this, args = std::make_tuple(args...)](std::size_t idx) {
+          // Fault in the frame's pages now, rather than while streaming
+          slab_->Prefault(idx * slab_stride_, slab_stride_);
+          auto frame_storage = slab_->data() + idx * slab_stride_;
+          return std::apply(
+              [&](const auto&... a) {
+                return std::make_unique<Slot>(this, idx, frame_storage, a...);
+              },
+              args);
+        })) {
+    slab_stride_ = (storage.storage_size + kSlabAlignment - 1) / kSlabAlignment * kSlabAlignment;
+    slab_ = std::make_unique<Slab>(slab_stride_ * capacity_);
+    Fill();
+  }
+
+  ~FramePool() {
+    // Wait until all slots are returned to the pool. Polls, since a releasing thread can't touch
+    // *this once it has given its slot back, so there's no safe way for it to signal us.
+    while (in_use_ > 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
 
-    // Construct Frames in places
-    slots_.reserve(n_slots_);
-    for (std::size_t i = 0; i < n_slots_; ++i) {
-      slots_.emplace_back(std::piecewise_construct, std::make_tuple(), std::tie(args...));
+  /** Called with each frame just before it goes back into the pool, e.g. to release resources it
+   * references. Set before allocating any frames.
+   */
+  void SetRecycleHook(std::function<void(Frame&)> hook) { recycle_hook_ = std::move(hook); }
+
+  /** Returns nullptr if the pool is exhausted and the policy gives up. */
+  PooledPtr<Frame> Allocate() {
+    ++allocations_;
+
+    auto idx = Pop();
+    if (idx == kNone) {
+      ++exhaustions_;
+      idx = OnExhausted();
+      if (idx == kNone) {
+        ++failures_;
+        return nullptr;
+      }
     }
 
-    // Initialize singly linked list
-    on_deck_ = &slots_[0];
-    for (std::size_t i = 0; i < n_slots_ - 1; ++i) {
-      slots_[i].first = &slots_[i + 1];
+    // Track the high-water mark. A released slot can be popped again before in_use_ is decremented
+    // for it, so in_use_ may briefly overcount.
+    auto in_use = std::min<std::size_t>(++in_use_, constructed_.load(std::memory_order_relaxed));
+    auto high_water = high_water_.load(std::memory_order_relaxed);
+    while (in_use > high_water &&
+           !high_water_.compare_exchange_weak(high_water, in_use, std::memory_order_relaxed)) {
     }
-    slots_[n_slots_ - 1].first = nullptr;
+
+    Slot* s = slots_[idx].get();
+    s->ResetRefs();
+    return {&s->frame, s};
   }
 
-  ~FramePool() {
-    // Wait until all slots are returned to the pool
-    std::unique_lock l{on_deck_m_};
-    on_deck_cv_.wait(l, [this]() {
-      std::size_t n_free_slots = 0;
-      for (Slot* s = on_deck_; s; s = s->first) {
-        ++n_free_slots;
+  Stats GetStats() const {
+    return {constructed_.load(),
+            in_use_.load(),
+            high_water_.load(),
+            allocations_.load(),
+            exhaustions_.load(),
+            failures_.load(),
+            std::chrono::nanoseconds(wait_ns_.load()),
+            std::chrono::nanoseconds(max_wait_ns_.load())};
+  }
+
+ private:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  /** Frames in a slab start on cache line boundaries. */
+  static constexpr std::size_t kSlabAlignment = 64;
+
+  struct Slot : PooledObject {
+    template <class... Args>
+    explicit Slot(FramePool* pool, uint32_t idx, const Args&... args)
+        : pool(pool), idx(idx), frame(args...) {}
+
+    void Recycle() noexcept final { pool->Release(idx); }
+
+    using PooledObject::ResetRefs;
+
+    FramePool* pool;
+    uint32_t idx;
+    std::atomic<uint32_t> next{kNone}; /**< Index of the slot below this one on the free stack. */
+    Frame frame;
+  };
+
+  using MakeSlot = std::function<std::unique_ptr<Slot>(std::size_t idx)>;
+
+  FramePool(const FramePoolOptions& options, MakeSlot make_slot)
+      : options_(options),
+        capacity_(options.on_exhaustion == PoolExhaustion::kGrow
+                      ? std::max(options.size, options.max_size)
+                      : options.size),
+        slots_(std::make_unique<std::unique_ptr<Slot>[]>(capacity_)),
+        make_slot_(std::move(make_slot)) {
+    if (options_.size == 0) throw std::invalid_argument("FramePool: size must be at least 1");
+  }
+
+  void Fill() {
+    for (std::size_t i = 0; i < options_.size; ++i) Push(Construct());
+  }
+
+  // Head of the free stack: a tag in the high half, and the index of the top slot in the low half
+  static uint64_t PackHead(uint64_t tag, uint32_t idx) { return tag << 32 | idx; }
+  static uint32_t HeadIndex(uint64_t head) { return static_cast<uint32_t>(head); }
+  static uint64_t HeadTag(uint64_t head) { return head >> 32; }
+
+  uint32_t Pop() {
+    auto head = head_.load(std::memory_order_acquire);
+    while (HeadIndex(head) != kNone) {
+      // If the top slot is popped (and maybe pushed back) under us, next is stale, but the tag
+      // will have changed and the exchange fails
+      auto next = slots_[HeadIndex(head)]->next.load(std::memory_order_relaxed);
+      if (head_.compare_exchange_weak(head, PackHead(HeadTag(head) + 1, next),
+                                      std::memory_order_acquire, std::memory_order_acquire)) {
+        return HeadIndex(head);
       }
+    }
+    return kNone;
+  }
+
+  void Push(uint32_t idx) {
+    auto head = head_.load(std::memory_order_relaxed);
+    do {
+      slots_[idx]->next.store(HeadIndex(head), std::memory_order_relaxed);
+    } while (!head_.compare_exchange_weak(head, PackHead(HeadTag(head) + 1, idx),
+                                          std::memory_order_release, std::memory_order_relaxed));
+  }
 
-      return n_free_slots == n_slots_;
-    });
+  /** Construct the next slot, returning its index. Call with m_ held, or before sharing *this. */
+  uint32_t Construct() {
+    auto idx = constructed_.load(std::memory_order_relaxed);
+    slots_[idx] = make_slot_(idx);
+    constructed_.store(idx + 1, std::memory_order_relaxed);
+    return static_cast<uint32_t>(idx);
   }
 
-  std::shared_ptr<Frame> Allocate() {
-    std::lock_guard l{on_deck_m_};
+  uint32_t OnExhausted() {
+    switch (options_.on_exhaustion) {
+      case PoolExhaustion::kDropNewest:
+        return kNone;
+
+      case PoolExhaustion::kGrow: {
+        std::lock_guard l{m_};
+        if (auto idx = Pop(); idx != kNone) return idx;
+        return constructed_ < capacity_ ? Construct() : kNone;
+      }
 
-    Slot* s = on_deck_;
-    if (!s) throw std::bad_alloc();
-    on_deck_ = s->first;
+      case PoolExhaustion::kBlock: {
+        auto start = std::chrono::steady_clock::now();
+        uint32_t idx = kNone;
+        {
+          std::unique_lock l{m_};
+          ++waiters_;
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          cv_.wait_for(l, options_.block_timeout, [&]() { return (idx = Pop()) != kNone; });
+          --waiters_;
+        }
 
-    auto deleter = [this](Slot* slot) {
-      {
-        std::lock_guard l{on_deck_m_};
-        slot->first = on_deck_;
-        on_deck_ = slot;
+        auto wait_ns = (std::chrono::steady_clock::now() - start).count();
+        wait_ns_ += wait_ns;
+        auto max_wait_ns = max_wait_ns_.load(std::memory_order_relaxed);
+        while (wait_ns > max_wait_ns && !max_wait_ns_.compare_exchange_weak(
+                                            max_wait_ns, wait_ns, std::memory_order_relaxed)) {
+        }
+        return idx;
       }
-      on_deck_cv_.notify_one();
-    };
+    }
+    return kNone;
+  }
+
+  void Release(uint32_t idx) {
+    if (recycle_hook_) recycle_hook_(slots_[idx]->frame);
+    Push(idx);
 
-    // Use std::shared_ptr's aliasing constructor
-    return {std::shared_ptr<Slot>(s, deleter), &s->second};
+    // Only go through the mutex if somebody might be waiting on it. The fences pair up so that
+    // either the waiter sees the slot, or we see the waiter.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_ > 0) {
+      std::lock_guard l{m_};
+      cv_.notify_all();
+    }
+
+    // Must be the last access to *this
+    --in_use_;
   }
 
- private:
-  // first points to the Slot Allocate should return next
-  struct Slot : std::pair<Slot*, Frame> {
-    using std::pair<Slot*, Frame>::pair;
-  };
+  FramePoolOptions options_;
+  std::size_t capacity_;
+  std::unique_ptr<Slab> slab_;
+  std::size_t slab_stride_{};
+  std::unique_ptr<std::unique_ptr<Slot>[]> slots_;
+  MakeSlot make_slot_;
+  std::function<void(Frame&)> recycle_hook_;
+
+  std::atomic<uint64_t> head_{PackHead(0, kNone)};
+  std::atomic<std::size_t> constructed_{};
+  std::atomic<std::size_t> in_use_{};
+  std::atomic<std::size_t> waiters_{};
+
+  std::atomic<std::size_t> high_water_{};
+  std::atomic<uint64_t> allocations_{};
+  std::atomic<uint64_t> exhaustions_{};
+  std::atomic<uint64_t> failures_{};
+  std::atomic<int64_t> wait_ns_{};
+  std::atomic<int64_t> max_wait_ns_{};
 
-  std::size_t n_slots_;
-  std::vector<Slot> slots_;
-  Slot* on_deck_;
-  std::mutex on_deck_m_;
-  std::condition_variable on_deck_cv_;
+  // Taken only to block in Allocate, and to grow
+  std::mutex m_;
+  std::condition_variable cv_;
 };
 
 }  // namespace wmr
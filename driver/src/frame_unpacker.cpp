@@ -0,0 +1,200 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "frame_unpacker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+#include "copy_kernels.hpp"
+
+namespace wmr {
+
+FrameUnpacker::FrameUnpacker(const CopyPlan& plan, bool non_temporal, ThreadPool* pool,
+                             std::size_t min_chunk_size, SegmentValidator validator)
+    : plan_(plan), non_temporal_(non_temporal), pool_(pool), validator_(std::move(validator)) {
+  auto& spans = plan_.Spans();
+  auto& segments = plan_.Segments();
+  auto segment_count = static_cast<uint32_t>(segments.size());
+
+  if (!pool_ || pool_->ThreadCount() == 1) {
+    chunks_.push_back({0, segment_count});
+    return;
+  }
+
+  // Greedily group segments until each group has enough image data to be worth handing off
+  std::size_t chunk_bytes = 0;
+  chunks_.push_back({0, 0});
+  for (uint32_t segment_idx = 0; segment_idx < segment_count; ++segment_idx) {
+    if (chunk_bytes >= min_chunk_size) {
+      chunks_.push_back({segment_idx, segment_idx});
+      chunk_bytes = 0;
+    }
+
+    auto& segment = segments[segment_idx];
+    for (auto span_idx = segment.span_begin; span_idx < segment.span_end; ++span_idx) {
+      chunk_bytes += spans[span_idx].length;
+    }
+    chunks_.back().segment_end = segment_idx + 1;
+  }
+
+  // Trailing segments with little or no image data don't deserve a chunk of their own
+  if (chunks_.size() > 1 && chunk_bytes < min_chunk_size / 2) {
+    chunks_.pop_back();
+    chunks_.back().segment_end = segment_count;
+  }
+
+  chunk_histograms_.resize(chunks_.size());
+}
+
+bool FrameUnpacker::Unpack(const uint8_t* frame, CameraFrame& dst, uint32_t image_mask,
+                           LumaHistogram* histograms) const {
+  if (histograms) std::fill_n(histograms, plan_.ImageCount(), LumaHistogram{});
+
+  bool parallel = chunks_.size() > 1;
+  if (!parallel) {
+    if (!UnpackChunk(frame, dst, image_mask, chunks_.front(), histograms, true)) return false;
+  } else if (!UnpackChunks(frame, dst, image_mask, histograms)) {
+    return false;
+  }
+
+  ForEach(remap_tasks_.size(), [&](std::size_t task_idx) {
+    auto& task = remap_tasks_[task_idx];
+    if (image_mask & 1u << task.remap->Image()) {
+      task.remap->Apply(frame, dst.GetImage(task.remap->Image()), task.row_begin, task.row_end);
+    }
+  });
+
+  // Whatever wasn't downsampled on the fly gets its pyramid now
+  if (dst.pyramid_levels > 0 && (parallel || !remap_tasks_.empty())) {
+    ForEach(plan_.ImageCount(), [&](std::size_t n) {
+      if ((parallel || remaps_[n]) && image_mask & 1u << n) {
+        BuildPyramid(dst, static_cast<uint8_t>(n));
+      }
+    });
+  }
+
+  return true;
+}
+
+void FrameUnpacker::SetRemap(uint8_t n, std::unique_ptr<const RemapTable> remap) {
+  remaps_.at(n) = std::move(remap);
+
+  remap_tasks_.clear();
+  for (auto& r : remaps_) {
+    if (!r) continue;
+
+    auto band_rows = pool_ ? kRemapBandRows : r->Height();
+    for (uint32_t row = 0; row < r->Height(); row += band_rows) {
+      remap_tasks_.push_back({r.get(), row, std::min(row + band_rows, r->Height())});
+    }
+  }
+}
+
+bool FrameUnpacker::UnpackChunks(const uint8_t* frame, CameraFrame& dst, uint32_t image_mask,
+                                 LumaHistogram* histograms) const {
+  std::atomic<bool> valid = true;
+  pool_->ParallelFor(chunks_.size(), [&](std::size_t chunk_idx) {
+    if (!valid.load(std::memory_order_relaxed)) return;
+
+    LumaHistogram* chunk_histograms = nullptr;
+    if (histograms) {
+      chunk_histograms = chunk_histograms_[chunk_idx].data();
+      std::fill_n(chunk_histograms, plan_.ImageCount(), LumaHistogram{});
+    }
+
+    if (!UnpackChunk(frame, dst, image_mask, chunks_[chunk_idx], chunk_histograms, false)) {
+      valid.store(false, std::memory_order_relaxed);
+    }
+  });
+
+  if (valid && histograms) {
+    for (auto& chunk_histograms : chunk_histograms_) {
+      for (std::size_t i = 0; i < plan_.ImageCount(); ++i) histograms[i] += chunk_histograms[i];
+    }
+  }
+
+  return valid;
+}
+
+void FrameUnpacker::SampleHistograms(const uint8_t* frame, LumaHistogram* histograms) const {
+  std::fill_n(histograms, plan_.ImageCount(), LumaHistogram{});
+
+  for (auto& span : plan_.Spans()) {
+    if (IsSampled(span)) {
+      histograms[span.dst_image].AddRun(frame + span.src_offset, span.length,
+                                        span.dst_offset % plan_.ImageWidth());
+    }
+  }
+}
+
+bool FrameUnpacker::UnpackChunk(const uint8_t* frame, CameraFrame& dst, uint32_t image_mask,
+                                const Chunk& chunk, LumaHistogram* histograms,
+                                bool fuse_pyramid) const {
+  // Non-temporal stores are fenced by whichever thread issued them, before it reports completion.
+  auto& kernel = GetCopyKernel();
+  auto copy = non_temporal_ ? kernel.copy_nt : kernel.copy;
+  fuse_pyramid = fuse_pyramid && dst.pyramid_levels > 0;
+
+  // Rectified images are left to their RemapTable, and unwanted ones aren't copied at all
+  CameraFrame::Pixel* images[CopyPlan::kMaxImages];
+  for (uint8_t n = 0; n < plan_.ImageCount(); ++n) {
+    images[n] = remaps_[n] || !(image_mask & 1u << n) ? nullptr : dst.GetImage(n);
+  }
+
+  auto& spans = plan_.Spans();
+  auto& segments = plan_.Segments();
+  bool valid = true;
+  for (auto segment_idx = chunk.segment_begin; segment_idx < chunk.segment_end; ++segment_idx) {
+    if (!validator_(frame, segment_idx)) {
+      valid = false;
+      break;
+    }
+
+    auto& segment = segments[segment_idx];
+    for (auto span_idx = segment.span_begin; span_idx < segment.span_end; ++span_idx) {
+      auto& span = spans[span_idx];
+      auto image = images[span.dst_image];
+      if (image) copy(image + span.dst_offset, frame + span.src_offset, span.length);
+
+      // Sample the row while the source is still in cache
+      if (histograms && IsSampled(span)) {
+        histograms[span.dst_image].AddRun(frame + span.src_offset, span.length,
+                                          span.dst_offset % plan_.ImageWidth());
+      }
+
+      // Once a span finishes an odd row, that row and the one before it are ready to downsample.
+      // Each new row of a level may in turn complete a row pair of the level above.
+      auto row_end = span.dst_offset + span.length;
+      if (fuse_pyramid && image && row_end % plan_.ImageWidth() == 0) {
+        auto row = static_cast<uint32_t>(row_end / plan_.ImageWidth() - 1);
+        for (uint8_t level = 1; level <= dst.pyramid_levels && row % 2 == 1; ++level) {
+          row /= 2;
+          if (row >= dst.PyramidHeight(level)) break;
+          DownsampleRow(dst, span.dst_image, level, row);
+        }
+      }
+    }
+  }
+
+  if (non_temporal_) kernel.fence();
+  return valid;
+}
+
+void FrameUnpacker::DownsampleRow(CameraFrame& dst, uint8_t n, uint8_t level, uint32_t row) {
+  auto src_width = dst.PyramidWidth(level - 1);
+  auto src = dst.GetPyramidImage(n, level - 1) + std::size_t{2 * row} * src_width;
+  auto out = dst.GetPyramidImage(n, level) + std::size_t{row} * dst.PyramidWidth(level);
+  GetCopyKernel().downsample(out, src, src + src_width, dst.PyramidWidth(level));
+}
+
+void FrameUnpacker::BuildPyramid(CameraFrame& dst, uint8_t n) {
+  for (uint8_t level = 1; level <= dst.pyramid_levels; ++level) {
+    for (uint32_t row = 0; row < dst.PyramidHeight(level); ++row) DownsampleRow(dst, n, level, row);
+  }
+}
+
+}  // namespace wmr
@@ -0,0 +1,123 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <wmr/types.hpp>
+
+#include "copy_plan.hpp"
+#include "luma_histogram.hpp"
+#include "remap_table.hpp"
+#include "thread_pool.hpp"
+
+namespace wmr {
+
+/** Executes a CopyPlan, optionally spread across a ThreadPool.
+ * The plan's segments are grouped into chunks of at least min_chunk_size bytes of image data, and
+ * each chunk is unpacked independently. Chunks are ranges of segments rather than whole images,
+ * because the images are interleaved row by row within every segment: a chunk per image would have
+ * each thread stream through the entire raw frame.
+ */
+class FrameUnpacker {
+ public:
+  /** Checks the header of one segment of a raw frame. Must be safe to call concurrently. */
+  using SegmentValidator = std::function<bool(const uint8_t* frame, std::size_t segment_idx)>;
+
+  /** If pool is null, frames are unpacked on the calling thread in a single chunk. */
+  FrameUnpacker(const CopyPlan& plan, bool non_temporal, ThreadPool* pool,
+                std::size_t min_chunk_size, SegmentValidator validator);
+
+  static constexpr uint32_t kAllImages = UINT32_MAX;
+
+  /** Unpack the images of frame selected by image_mask into dst, validating each segment header
+   * before copying out of its segment. Histograms and segment headers still cover every image.
+   * Images that have a RemapTable are interpolated out of frame instead, once the segment headers
+   * have all been checked. If dst has pyramid levels, they're filled in too. When unpacking in a
+   * single chunk, each pair of rows is downsampled as soon as it's been copied, while it's still in
+   * cache; otherwise (and for rectified images) the pyramid is built per image afterwards.
+   * If histograms is non-null, it receives one LumaHistogram per image, sampled from each row as
+   * it's copied. Returns false if any segment header is invalid, in which case dst and histograms
+   * hold garbage.
+   */
+  bool Unpack(const uint8_t* frame, CameraFrame& dst, uint32_t image_mask = kAllImages,
+              LumaHistogram* histograms = nullptr) const;
+
+  /** Rectify image n with remap from now on, or stop rectifying it if remap is null.
+   * Not safe to call concurrently with Unpack.
+   */
+  void SetRemap(uint8_t n, std::unique_ptr<const RemapTable> remap);
+
+  /** Sample one LumaHistogram per image from frame, without unpacking it. */
+  void SampleHistograms(const uint8_t* frame, LumaHistogram* histograms) const;
+
+  std::size_t ChunkCount() const { return chunks_.size(); }
+
+ private:
+  struct Chunk {
+    uint32_t segment_begin;
+    uint32_t segment_end;
+  };
+
+  /** A band of rows of one rectified image, which can be interpolated independently. */
+  struct RemapTask {
+    const RemapTable* remap;
+    uint32_t row_begin;
+    uint32_t row_end;
+  };
+
+  /** Rows per RemapTask when remapping on a pool. */
+  static constexpr uint32_t kRemapBandRows = 32;
+
+  using ImageHistograms = std::array<LumaHistogram, CopyPlan::kMaxImages>;
+
+  /** Unpack all chunks on pool_, merging their histograms. */
+  bool UnpackChunks(const uint8_t* frame, CameraFrame& dst, uint32_t image_mask,
+                    LumaHistogram* histograms) const;
+
+  bool UnpackChunk(const uint8_t* frame, CameraFrame& dst, uint32_t image_mask, const Chunk& chunk,
+                   LumaHistogram* histograms, bool fuse_pyramid) const;
+
+  /** Downsample row pair (2 * row, 2 * row + 1) of image n at level - 1 into row row of level. */
+  static void DownsampleRow(CameraFrame& dst, uint8_t n, uint8_t level, uint32_t row);
+
+  /** Build all pyramid levels of image n from its full-resolution image. */
+  static void BuildPyramid(CameraFrame& dst, uint8_t n);
+
+  /** Run fn(i) for i in [0, count), on pool_ if there is one. */
+  template <typename Fn>
+  void ForEach(std::size_t count, Fn&& fn) const {
+    if (pool_) {
+      pool_->ParallelFor(count, fn);
+    } else {
+      for (std::size_t i = 0; i < count; ++i) fn(i);
+    }
+  }
+
+  /** True if the row written by span is sampled for histograms. */
+  bool IsSampled(const CopyPlan::Span& span) const {
+    return (span.dst_offset / plan_.ImageWidth()) % LumaHistogram::kRowStep == 0;
+  }
+
+  const CopyPlan& plan_;
+  bool non_temporal_;
+  ThreadPool* pool_;
+  SegmentValidator validator_;
+  std::vector<Chunk> chunks_;
+  std::array<std::unique_ptr<const RemapTable>, CopyPlan::kMaxImages> remaps_;
+  std::vector<RemapTask> remap_tasks_;
+
+  // Per-chunk histograms, merged once all chunks are done. Unpack is only called from one thread
+  // at a time.
+  mutable std::vector<ImageHistograms> chunk_histograms_;
+};
+
+}  // namespace wmr
@@ -16,6 +16,7 @@
 #include <utility>
 
 #include <wmr/oasis_hid_interface.hpp>
+#include <wmr/tracing.hpp>
 
 #include "oasis_hid.hpp"
 
@@ -26,21 +27,36 @@ namespace wmr {
 Headset::Headset(const HeadsetSpec& spec, libusbcpp::ContextBase::BasePointer ctx,
                  std::unique_ptr<OasisHidInterface> oasis_hid,
                  std::unique_ptr<CameraInterface> camera,
-                 std::unique_ptr<VendorHidInterface> vendor_hid)
+                 std::unique_ptr<VendorHidInterface> vendor_hid,
+                 std::shared_ptr<MetricsRegistry> metrics, const HeadsetOptions& options)
     : spec_(spec),
-      usb_thread_(ctx),
+      usb_thread_(ctx ? std::make_unique<LibusbEventThread>(ctx) : nullptr),
       oasis_hid_(std::move(oasis_hid)),
       camera_(std::move(camera)),
-      vendor_hid_(std::move(vendor_hid)) {}
+      vendor_hid_(std::move(vendor_hid)),
+      metrics_(std::move(metrics)),
+      options_(options) {}
 
 void Headset::Open() {
   oasis_hid_->StartImu();
   camera_->StartStream();
+
+  if (!options_.metrics.prometheus_file.empty()) {
+    metrics_writer_ = std::make_unique<PrometheusFileWriter>(
+        metrics_, options_.metrics.prometheus_file, options_.metrics.prometheus_interval);
+  }
 }
 
 void Headset::Close() {
   oasis_hid_->StopImu();
   camera_->StopStream();
+
+  // Writes the file once more, so that it reflects the whole session
+  metrics_writer_.reset();
+
+  if (!options_.trace_file.empty() && !WriteChromeTrace(options_.trace_file)) {
+    spdlog::warn("Headset::Close: Not writing {}, tracing isn't built in", options_.trace_file);
+  }
 }
 
 }  // namespace wmr
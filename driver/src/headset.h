@@ -6,21 +6,26 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <wmr/headset_interface.hpp>
+#include <wmr/headset_options.hpp>
 #include <wmr/headset_spec.hpp>
 #include <wmr/oasis_hid_interface.hpp>
 #include <wmr/vendor_hid_interface.hpp>
 
 #include "libusb_event_thread.hpp"
+#include "metrics_registry.hpp"
 
 namespace wmr {
 
 class Headset : public HeadsetInterface {
  public:
+  /** If ctx is non-null, a thread handles its events for as long as the headset exists. */
   Headset(const HeadsetSpec& spec, libusbcpp::ContextBase::BasePointer ctx,
           std::unique_ptr<OasisHidInterface> oasis_hid, std::unique_ptr<CameraInterface> camera,
-          std::unique_ptr<VendorHidInterface> vendor_hid);
+          std::unique_ptr<VendorHidInterface> vendor_hid, std::shared_ptr<MetricsRegistry> metrics,
+          const HeadsetOptions& options);
 
  private:
   void Open() final;
@@ -28,12 +33,18 @@ class Headset : public HeadsetInterface {
   CameraInterface& Camera() final { return *camera_; }
   OasisHidInterface& OasisHid() final { return *oasis_hid_; }
   VendorHidInterface& VendorHid() final { return *vendor_hid_; }
+  std::vector<Metric> GetMetrics() final { return metrics_->Snapshot(); }
 
   HeadsetSpec spec_;
-  LibusbEventThread usb_thread_;
+  std::unique_ptr<LibusbEventThread> usb_thread_;
   std::unique_ptr<OasisHidInterface> oasis_hid_;
   std::unique_ptr<CameraInterface> camera_;
   std::unique_ptr<VendorHidInterface> vendor_hid_;
+  std::shared_ptr<MetricsRegistry> metrics_;
+  HeadsetOptions options_;
+
+  // Set while the headset is open, if options_ asks for it
+  std::unique_ptr<PrometheusFileWriter> metrics_writer_;
 };
 
 }  // namespace wmr
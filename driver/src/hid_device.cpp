@@ -8,13 +8,19 @@
 #include <hidapi.h>
 #include <spdlog/spdlog.h>
 
+#include <chrono>
 #include <stdexcept>
+#include <utility>
+
+#include "trace.hpp"
 
 namespace wmr {
 
 HidDevice::HidDevice(unsigned short vendor_id, unsigned short product_id,
-                     const wchar_t *serial_number)
-    : hid_dev_(hid_open(vendor_id, product_id, serial_number)) {
+                     const wchar_t *serial_number, std::shared_ptr<MetricsRegistry> metrics,
+                     std::string device_name)
+    : HidDevice(std::move(metrics), std::move(device_name)) {
+  hid_dev_.reset(hid_open(vendor_id, product_id, serial_number));
   if (!hid_dev_) {
     throw std::runtime_error("Failed to open HID device");
   }
@@ -23,9 +29,16 @@ HidDevice::HidDevice(unsigned short vendor_id, unsigned short product_id,
   reader_thread_ = std::thread([this]() { ReadThreadFunc(); });
 }
 
+HidDevice::HidDevice(std::shared_ptr<MetricsRegistry> metrics, std::string device_name)
+    : metrics_(std::move(metrics)),
+      device_name_(std::move(device_name)),
+      unhandled_reports_(metrics_->GetCounter("wmr_hid_reports_unhandled_total",
+                                              "HID reports discarded for lack of a reader",
+                                              {{"device", device_name_}})) {}
+
 HidDevice::~HidDevice() {
   run_.clear();
-  reader_thread_.join();
+  if (reader_thread_.joinable()) reader_thread_.join();
 }
 
 void HidDevice::WriteReport(BufferView report) {
@@ -60,7 +73,9 @@ void HidDevice::GetFeatureReport(void *report, std::size_t report_size) {
 
 void HidDevice::RegisterReportReader(Byte report_id, std::shared_ptr<ReportReader> reader) {
   std::lock_guard l(report_readers_m_);
-  assert(!report_readers_[report_id].lock());
+  // The previous reader may still be pinned by the read thread for a moment after it finished
+  auto previous = report_readers_[report_id].lock();
+  assert(!previous || previous->Finished());
   report_readers_[report_id] = reader;
 }
 
@@ -69,11 +84,20 @@ void HidDevice::DeregisterReportReader(Byte report_id) {
   report_readers_[report_id].reset();
 }
 
+void HidDevice::SetCapture(std::shared_ptr<CaptureWriter> writer, capture::RecordType type) {
+  std::lock_guard l(report_readers_m_);
+  capture_ = std::move(writer);
+  capture_type_ = type;
+}
+
 void HidDevice::ReadThreadFunc() {
+  WMR_TRACE_THREAD_NAME("HID reader (" + device_name_ + ")");
+
   std::array<Byte, kMaxReportSize> rbuff;
   while (run_.test_and_set(std::memory_order_acquire)) {
     auto bytes_read = hid_read_timeout(static_cast<hid_device *>(hid_dev_.get()), rbuff.data(),
                                        rbuff.size(), kReadLoopTimeoutMs);
+    auto received = std::chrono::steady_clock::now();
 
     if (bytes_read < 0) {
       throw std::runtime_error("HidDevice: hid_read_timeout failed");
@@ -82,17 +106,47 @@ void HidDevice::ReadThreadFunc() {
       continue;
     }
 
-    auto report_id = rbuff[0];
-    std::shared_ptr<ReportReader> reader;
-    {
+    DispatchReport(BufferView{rbuff.data(), static_cast<BufferView::size_type>(bytes_read)},
+                   received);
+  }
+}
+
+void HidDevice::DispatchReport(BufferView report, HostTimestamp received) {
+  WMR_TRACE_SCOPE("HidDevice::DispatchReport");
+  auto report_id = report[0];
+  CountReport(report_id);
+
+  std::shared_ptr<ReportReader> reader;
+  std::shared_ptr<CaptureWriter> capture;
+  capture::RecordType capture_type;
+  {
+    std::lock_guard l(report_readers_m_);
+    reader = report_readers_[report_id].lock();
+    capture = capture_;
+    capture_type = capture_type_;
+  }
+  if (capture) capture->Write(capture_type, 0, received, report);
+
+  if (reader) {
+    reader->Update(report, received);
+    if (reader->Finished()) {
+      // Unless a new reader was registered in the meantime
       std::lock_guard l(report_readers_m_);
-      reader = report_readers_[report_id].lock();
-    }
-    if (reader) {
-      reader->Update(BufferView{rbuff.data(), static_cast<BufferView::size_type>(bytes_read)});
-      if (reader->Finished()) DeregisterReportReader(report_id);
+      if (report_readers_[report_id].lock() == reader) report_readers_[report_id].reset();
     }
+  } else {
+    unhandled_reports_.Increment();
+  }
+}
+
+void HidDevice::CountReport(Byte report_id) {
+  auto &counter = report_counters_[report_id];
+  if (!counter) {
+    counter = &metrics_->GetCounter("wmr_hid_reports_total", "HID reports received, by report ID",
+                                    {{"device", device_name_},
+                                     {"report_id", fmt::format("0x{:02x}", report_id)}});
   }
+  counter->Increment();
 }
 
 void HidDevice::HidDevDeleter::operator()(void *dev) { hid_close(static_cast<hid_device *>(dev)); }
@@ -5,28 +5,38 @@
 
 #pragma once
 
+#include <array>
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <string_view>
 #include <thread>
 
+#include <wmr/types.hpp>
+
+#include "capture_writer.hpp"
+#include "metrics_registry.hpp"
+
 namespace wmr {
 
 /** Manages a hidapi device.
  * A reader thread calls hid_read_timeout in a loop and deals each report thus yielded to a single
  * registered ReportReader instance based on its report_id. Reports for which there isn't a
  * registered reader are discarded. This way, multiple readers can listen for reports at once.
+ * Subclasses may stand in for the device, by overriding its I/O and feeding reports to
+ * DispatchReport from a thread of their own.
  */
 struct HidDevice {
   using Byte = uint8_t;
   using BufferView = std::basic_string_view<Byte>;
 
-  HidDevice(unsigned short vendor_id, unsigned short product_id,
-            const wchar_t *serial_number = nullptr);
-  ~HidDevice();
+  /** Reports received are counted in metrics, labelled with device_name. */
+  HidDevice(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number,
+            std::shared_ptr<MetricsRegistry> metrics, std::string device_name);
+  virtual ~HidDevice();
 
   static constexpr std::size_t kMaxReportSize = 1024;
 
@@ -34,20 +44,31 @@ struct HidDevice {
     using Report = BufferView;
 
     virtual ~ReportReader() = default;
-    virtual void Update(BufferView report) = 0;
+    /** received is when the read thread got the report. */
+    virtual void Update(BufferView report, HostTimestamp received) = 0;
     virtual bool Finished() { return false; }
   };
 
-  void WriteReport(BufferView report);
+  virtual void WriteReport(BufferView report);
 
-  void SetFeatureReport(BufferView report);
+  virtual void SetFeatureReport(BufferView report);
 
-  void GetFeatureReport(void *report, std::size_t report_size);
+  virtual void GetFeatureReport(void *report, std::size_t report_size);
 
   void RegisterReportReader(Byte report_id, std::shared_ptr<ReportReader> reader);
 
   void DeregisterReportReader(Byte report_id);
 
+  /** Record every report received from now on to writer, as records of the given type. */
+  void SetCapture(std::shared_ptr<CaptureWriter> writer, capture::RecordType type);
+
+ protected:
+  /** Opens nothing, and starts no reader thread. */
+  HidDevice(std::shared_ptr<MetricsRegistry> metrics, std::string device_name);
+
+  /** Deal report, received at received, to its reader. Call from one thread at a time. */
+  void DispatchReport(BufferView report, HostTimestamp received);
+
  private:
   struct HidDevDeleter {
     void operator()(void *dev);
@@ -57,9 +78,22 @@ struct HidDevice {
 
   void ReadThreadFunc();
 
+  /** Count a report with the given ID. Call from the thread dispatching reports. */
+  void CountReport(Byte report_id);
+
+  std::shared_ptr<MetricsRegistry> metrics_;
+  std::string device_name_;
+
+  // Registered the first time a report with each ID shows up. Only touched by the thread
+  // dispatching reports.
+  std::array<MetricsRegistry::Counter *, 256> report_counters_{};
+  MetricsRegistry::Counter &unhandled_reports_;
+
   std::unique_ptr<void, HidDevDeleter> hid_dev_;
   std::array<std::weak_ptr<ReportReader>, 256> report_readers_;
-  std::mutex report_readers_m_;
+  std::shared_ptr<CaptureWriter> capture_;
+  capture::RecordType capture_type_{};
+  std::mutex report_readers_m_;  // Also guards capture_
   std::atomic_flag run_;
   std::thread reader_thread_;
 };
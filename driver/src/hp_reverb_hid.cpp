@@ -43,7 +43,7 @@ void HpReverbHid::WakeDisplay() {
   hid_dev_->SetFeatureReport({reinterpret_cast<uint8_t *>(&tx4_), sizeof(MyteryReport4)});
 }
 
-void HpReverbHid::MysteryReport5Reader::Update(Report report) {
+void HpReverbHid::MysteryReport5Reader::Update(Report report, HostTimestamp) {
   assert(report[0] == MyteryReport5::kReportId);
 
   auto as_struct = reinterpret_cast<const MyteryReport5 *>(report.data());
@@ -58,7 +58,7 @@ void HpReverbHid::MysteryReport5Reader::Update(Report report) {
   }
 }
 
-void HpReverbHid::MysteryReport1Reader::Update(Report report) {
+void HpReverbHid::MysteryReport1Reader::Update(Report report, HostTimestamp) {
   assert(report[0] == MyteryReport1::kReportId);
 
   auto as_struct = reinterpret_cast<const MyteryReport1 *>(report.data());
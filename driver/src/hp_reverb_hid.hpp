@@ -85,7 +85,7 @@ class HpReverbHid : public VendorHidInterface {
   static_assert(sizeof(MyteryReport5) == MyteryReport5::kReportSize);
 
   struct MysteryReport5Reader : HidDevice::ReportReader {
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
   };
 
   // Read as interrupt during operation
@@ -100,7 +100,7 @@ class HpReverbHid : public VendorHidInterface {
   static_assert(sizeof(MyteryReport1) == MyteryReport1::kReportSize);
 
   struct MysteryReport1Reader : HidDevice::ReportReader {
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
   };
 
   std::unique_ptr<HidDevice> hid_dev_;
@@ -0,0 +1,99 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "latency_histogram.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "metrics_registry.hpp"
+
+namespace wmr {
+
+StageLatency LatencyHistogram::Summarize(const char* stage) const {
+  StageLatency summary{};
+  summary.stage = stage;
+
+  // Percentiles come from the bucket counts alone, so that they're consistent with each other
+  std::array<uint64_t, kBucketCount> counts;
+  uint64_t total = 0;
+  for (std::size_t i = 0; i < kBucketCount; ++i) {
+    counts[i] = counts_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return summary;
+
+  // A latency being recorded meanwhile may be in the buckets before it's in min_ and max_. If they
+  // don't bound it yet, fall back on the bounds of the buckets that aren't empty.
+  auto min = min_.load(std::memory_order_relaxed);
+  auto max = max_.load(std::memory_order_relaxed);
+  if (min > max) {
+    auto first = std::find_if(counts.begin(), counts.end(), [](auto c) { return c > 0; });
+    auto last = std::find_if(counts.rbegin(), counts.rend(), [](auto c) { return c > 0; });
+    auto first_idx = static_cast<std::size_t>(first - counts.begin());
+    min = first_idx > 0 ? BucketLimit(first_idx - 1) + 1 : 0;
+    max = BucketLimit(static_cast<std::size_t>(counts.rend() - last) - 1);
+  }
+
+  auto percentile = [&](double p) {
+    auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(p * total)), 1);
+    uint64_t seen = 0;
+    std::size_t i = 0;
+    while ((seen += counts[i]) < rank) ++i;
+    return std::chrono::nanoseconds(std::clamp(BucketLimit(i), min, max));
+  };
+
+  summary.count = total;
+  summary.min = std::chrono::nanoseconds(min);
+  summary.mean = std::chrono::nanoseconds(sum_.load(std::memory_order_relaxed) / total);
+  summary.p50 = percentile(0.5);
+  summary.p90 = percentile(0.9);
+  summary.p99 = percentile(0.99);
+  summary.p999 = percentile(0.999);
+  summary.max = std::chrono::nanoseconds(max);
+  return summary;
+}
+
+uint64_t LatencyHistogram::BucketLimit(std::size_t idx) {
+  if (idx < kSubBuckets) return idx;
+
+  auto shift = idx / kSubBuckets - 1;
+  auto sub_bucket = idx % kSubBuckets + kSubBuckets;
+  return ((sub_bucket + 1) << shift) - 1;
+}
+
+LatencyStages::LatencyStages(MetricsRegistry& metrics, const std::string& name,
+                             const std::string& help, std::vector<const char*> stage_names)
+    : stage_names_(std::move(stage_names)) {
+  for (auto stage : stage_names_) {
+    histograms_.push_back(&metrics.GetHistogram(name, help, {{"stage", stage}}));
+  }
+}
+
+std::vector<StageLatency> LatencyStages::Summarize() const {
+  std::vector<StageLatency> summaries;
+  summaries.reserve(stage_names_.size());
+  for (std::size_t i = 0; i < stage_names_.size(); ++i) {
+    summaries.push_back(histograms_[i]->Summarize(stage_names_[i]));
+  }
+  return summaries;
+}
+
+void LatencyStages::Log(const char* prefix) const {
+  auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1e3; };
+  for (auto& s : Summarize()) {
+    if (s.count == 0) continue;
+    spdlog::debug(
+        "{}: {} latency count={} (min={:.1f}us, mean={:.1f}us, p50={:.1f}us, p90={:.1f}us, "
+        "p99={:.1f}us, p99.9={:.1f}us, max={:.1f}us)",
+        prefix, s.stage, s.count, us(s.min), us(s.mean), us(s.p50), us(s.p90), us(s.p99),
+        us(s.p999), us(s.max));
+  }
+}
+
+}  // namespace wmr
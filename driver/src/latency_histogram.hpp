@@ -0,0 +1,102 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <wmr/latency.hpp>
+#include <wmr/types.hpp>
+
+namespace wmr {
+
+class MetricsRegistry;
+
+/** Histogram of latencies with logarithmically spaced buckets, like an HdrHistogram.
+ * Each power of two is split into kSubBuckets linear buckets, so a bucket is never wider than
+ * 1/kSubBuckets of the values in it. Recording takes a few relaxed atomic increments and never
+ * blocks, so it's safe from any thread, including ones that produce frames.
+ */
+class LatencyHistogram {
+ public:
+  void Record(std::chrono::nanoseconds latency) {
+    auto ns = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0));
+    counts_[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(ns, std::memory_order_relaxed);
+
+    auto min = min_.load(std::memory_order_relaxed);
+    while (ns < min && !min_.compare_exchange_weak(min, ns, std::memory_order_relaxed)) {
+    }
+    auto max = max_.load(std::memory_order_relaxed);
+    while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  /** Summarize the latencies recorded so far. Latencies recorded meanwhile may be left out. */
+  StageLatency Summarize(const char* stage) const;
+
+ private:
+  static constexpr int kSubBucketBits = 5;
+  static constexpr uint64_t kSubBuckets = uint64_t{1} << kSubBucketBits;
+
+  /** Latencies of 2^kMaxBits ns (about 2 minutes) and up share the last bucket. */
+  static constexpr int kMaxBits = 37;
+  static constexpr std::size_t kBucketCount = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+  static std::size_t BucketIndex(uint64_t ns) {
+    if (ns < kSubBuckets) return ns;
+    ns = std::min(ns, (uint64_t{1} << kMaxBits) - 1);
+
+    // Values with their top bit at position e land in group e - kSubBucketBits + 1, which is split
+    // by the kSubBucketBits bits below the top one
+    int shift = 63 - __builtin_clzll(ns) - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + ((ns >> shift) - kSubBuckets);
+  }
+
+  /** Largest value that lands in bucket idx. */
+  static uint64_t BucketLimit(std::size_t idx);
+
+  std::array<std::atomic<uint64_t>, kBucketCount> counts_{};
+  std::atomic<uint64_t> sum_{};
+  std::atomic<uint64_t> min_{UINT64_MAX};
+  std::atomic<uint64_t> max_{};
+};
+
+/** One LatencyHistogram per stage of a frame's trip through the driver.
+ * The histograms are registered with metrics as the summary name, labelled by stage.
+ */
+class LatencyStages {
+ public:
+  /** stage_names must be string literals, and are indexed by stage number. */
+  LatencyStages(MetricsRegistry& metrics, const std::string& name, const std::string& help,
+                std::vector<const char*> stage_names);
+
+  void Record(std::size_t stage, std::chrono::nanoseconds latency) {
+    histograms_[stage]->Record(latency);
+  }
+
+  /** Record the time from start until now. */
+  void RecordSince(std::size_t stage, HostTimestamp start) {
+    Record(stage, std::chrono::steady_clock::now() - start);
+  }
+
+  std::vector<StageLatency> Summarize() const;
+
+  /** Log a line per stage at debug level, each starting with prefix. */
+  void Log(const char* prefix) const;
+
+ private:
+  std::vector<const char*> stage_names_;
+  std::vector<LatencyHistogram*> histograms_;
+};
+
+}  // namespace wmr
@@ -7,6 +7,8 @@
 
 #include <spdlog/spdlog.h>
 
+#include "trace.hpp"
+
 namespace wmr {
 
 LibusbEventThread::LibusbEventThread(libusbcpp::ContextBase::BasePointer ctx) : ctx_(ctx) {
@@ -22,6 +24,8 @@ LibusbEventThread::~LibusbEventThread() {
 }
 
 void LibusbEventThread::EventThreadFunc() {
+  WMR_TRACE_THREAD_NAME("libusb events");
+
   struct timeval tv {};
   tv.tv_sec = kLoopTimeoutSec;
   while (run_.test_and_set(std::memory_order_acquire)) {
@@ -0,0 +1,45 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace wmr {
+
+/** Coarse histogram of pixel values, sampled from a sparse grid over one image. */
+struct LumaHistogram {
+  static constexpr std::size_t kBinCount = 64;
+  static constexpr std::size_t kBinShift = 2;  // 256 pixel values / 64 bins
+
+  /** Only every kRowStep'th row and every kColStep'th column is sampled. */
+  static constexpr std::size_t kRowStep = 8;
+  static constexpr std::size_t kColStep = 8;
+
+  std::array<uint32_t, kBinCount> bins{};
+  uint32_t count{};
+
+  void Add(uint8_t pixel) {
+    ++bins[pixel >> kBinShift];
+    ++count;
+  }
+
+  /** Add every kColStep'th pixel of a run that begins at column col of its row. */
+  void AddRun(const uint8_t* pixels, std::size_t size, std::size_t col) {
+    for (auto i = (kColStep - col % kColStep) % kColStep; i < size; i += kColStep) {
+      Add(pixels[i]);
+    }
+  }
+
+  LumaHistogram& operator+=(const LumaHistogram& other) {
+    for (std::size_t i = 0; i < kBinCount; ++i) bins[i] += other.bins[i];
+    count += other.count;
+    return *this;
+  }
+};
+
+}  // namespace wmr
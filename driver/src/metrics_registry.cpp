@@ -0,0 +1,233 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "metrics_registry.hpp"
+
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+namespace wmr {
+
+namespace {
+
+std::string EscapeHelp(const std::string& help) {
+  std::string escaped;
+  for (char c : help) {
+    if (c == '\\') {
+      escaped += "\\\\";
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string EscapeLabelValue(const std::string& value) {
+  std::string escaped;
+  for (char c : value) {
+    if (c == '"') {
+      escaped += "\\\"";
+    } else {
+      escaped += EscapeHelp(std::string(1, c));
+    }
+  }
+  return escaped;
+}
+
+/** Format labels as {a="x",b="y"}, with extra appended if it isn't empty. */
+std::string FormatLabels(const MetricLabels& labels, const std::string& extra = {}) {
+  if (labels.empty() && extra.empty()) return {};
+
+  std::string formatted = "{";
+  for (auto& [name, value] : labels) {
+    if (formatted.size() > 1) formatted += ',';
+    formatted += fmt::format("{}=\"{}\"", name, EscapeLabelValue(value));
+  }
+  if (!extra.empty()) {
+    if (formatted.size() > 1) formatted += ',';
+    formatted += extra;
+  }
+  return formatted + '}';
+}
+
+double Seconds(std::chrono::nanoseconds ns) { return ns.count() / 1e9; }
+
+const char* TypeName(MetricType type) {
+  switch (type) {
+    case MetricType::kCounter:
+      return "counter";
+    case MetricType::kGauge:
+      return "gauge";
+    case MetricType::kSummary:
+      return "summary";
+  }
+  return "untyped";
+}
+
+}  // namespace
+
+MetricsRegistry::Counter& MetricsRegistry::GetCounter(const std::string& name,
+                                                      const std::string& help,
+                                                      const MetricLabels& labels) {
+  std::lock_guard l{m_};
+  auto& entry = FindOrAdd(name, help, MetricType::kCounter, labels);
+  if (!entry.counter) entry.counter = std::make_unique<Counter>();
+  return *entry.counter;
+}
+
+MetricsRegistry::Gauge& MetricsRegistry::GetGauge(const std::string& name,
+                                                  const std::string& help,
+                                                  const MetricLabels& labels) {
+  std::lock_guard l{m_};
+  auto& entry = FindOrAdd(name, help, MetricType::kGauge, labels);
+  if (!entry.gauge) entry.gauge = std::make_unique<Gauge>();
+  return *entry.gauge;
+}
+
+LatencyHistogram& MetricsRegistry::GetHistogram(const std::string& name, const std::string& help,
+                                                const MetricLabels& labels) {
+  std::lock_guard l{m_};
+  auto& entry = FindOrAdd(name, help, MetricType::kSummary, labels);
+  if (!entry.histogram) entry.histogram = std::make_unique<LatencyHistogram>();
+  return *entry.histogram;
+}
+
+MetricsRegistry::Entry& MetricsRegistry::FindOrAdd(const std::string& name,
+                                                   const std::string& help, MetricType type,
+                                                   const MetricLabels& labels) {
+  for (auto& entry : entries_) {
+    if (entry->name != name) continue;
+    if (entry->type != type) {
+      throw std::logic_error("MetricsRegistry: " + name + " was registered with another type");
+    }
+    if (entry->labels == labels) return *entry;
+  }
+
+  auto& entry = *entries_.emplace_back(std::make_unique<Entry>());
+  entry.name = name;
+  entry.help = help;
+  entry.type = type;
+  entry.labels = labels;
+  return entry;
+}
+
+std::vector<Metric> MetricsRegistry::Snapshot() const {
+  std::lock_guard l{m_};
+
+  std::vector<Metric> metrics;
+  metrics.reserve(entries_.size());
+  for (auto& entry : entries_) {
+    auto& metric = metrics.emplace_back();
+    metric.name = entry->name;
+    metric.help = entry->help;
+    metric.type = entry->type;
+    metric.labels = entry->labels;
+    switch (entry->type) {
+      case MetricType::kCounter:
+        metric.value = static_cast<double>(entry->counter->Value());
+        break;
+      case MetricType::kGauge:
+        metric.value = entry->gauge->Value();
+        break;
+      case MetricType::kSummary:
+        metric.latency = entry->histogram->Summarize(entry->name.c_str());
+        metric.latency.stage = nullptr;  // Would dangle once the lock is released
+        break;
+    }
+  }
+  return metrics;
+}
+
+std::string FormatPrometheus(const std::vector<Metric>& metrics) {
+  // Every sample of a metric must come right after its HELP and TYPE lines, so group the metrics
+  // by name, keeping the order each name first appeared in
+  std::vector<bool> done(metrics.size());
+  std::string text;
+  for (std::size_t i = 0; i < metrics.size(); ++i) {
+    if (done[i]) continue;
+
+    auto& first = metrics[i];
+    text += fmt::format("# HELP {} {}\n", first.name, EscapeHelp(first.help));
+    text += fmt::format("# TYPE {} {}\n", first.name, TypeName(first.type));
+
+    for (std::size_t j = i; j < metrics.size(); ++j) {
+      auto& metric = metrics[j];
+      if (done[j] || metric.name != first.name) continue;
+      done[j] = true;
+
+      if (metric.type != MetricType::kSummary) {
+        text += fmt::format("{}{} {}\n", metric.name, FormatLabels(metric.labels), metric.value);
+        continue;
+      }
+
+      auto& latency = metric.latency;
+      for (auto [quantile, value] : {std::pair{"0.5", latency.p50},
+                                     std::pair{"0.9", latency.p90},
+                                     std::pair{"0.99", latency.p99},
+                                     std::pair{"0.999", latency.p999}}) {
+        text += fmt::format("{}{} {}\n", metric.name,
+                            FormatLabels(metric.labels, fmt::format("quantile=\"{}\"", quantile)),
+                            Seconds(value));
+      }
+      text += fmt::format("{}_sum{} {}\n", metric.name, FormatLabels(metric.labels),
+                          Seconds(latency.mean * latency.count));
+      text += fmt::format("{}_count{} {}\n", metric.name, FormatLabels(metric.labels),
+                          latency.count);
+    }
+  }
+  return text;
+}
+
+PrometheusFileWriter::PrometheusFileWriter(std::shared_ptr<const MetricsRegistry> metrics,
+                                           std::string path, std::chrono::milliseconds interval)
+    : metrics_(std::move(metrics)),
+      path_(std::move(path)),
+      interval_(interval),
+      thread_([this]() { Run(); }) {}
+
+PrometheusFileWriter::~PrometheusFileWriter() {
+  {
+    std::lock_guard l{m_};
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+
+  Write();
+}
+
+void PrometheusFileWriter::Run() {
+  std::unique_lock l{m_};
+  while (!cv_.wait_for(l, interval_, [this]() { return stopping_; })) {
+    l.unlock();
+    Write();
+    l.lock();
+  }
+}
+
+void PrometheusFileWriter::Write() {
+  auto tmp_path = path_ + ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::trunc);
+    file << FormatPrometheus(metrics_->Snapshot());
+    if (!file) {
+      spdlog::warn("PrometheusFileWriter: Failed to write {}", tmp_path);
+      return;
+    }
+  }
+
+  if (std::rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    spdlog::warn("PrometheusFileWriter: Failed to rename {} to {}", tmp_path, path_);
+  }
+}
+
+}  // namespace wmr
@@ -0,0 +1,115 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <wmr/metrics.hpp>
+
+#include "latency_histogram.hpp"
+
+namespace wmr {
+
+/** Driver health metrics, shared by every part of one headset.
+ * Metrics are registered up front (or the first time they're needed), which takes a lock. After
+ * that, a part keeps a reference to each of its metrics, and updates it with a relaxed atomic
+ * operation, so updating never blocks and is safe from any thread. Metrics live as long as the
+ * registry, so parts hold it by shared_ptr.
+ */
+class MetricsRegistry {
+ public:
+  class Counter {
+   public:
+    void Increment(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<uint64_t> value_{};
+  };
+
+  class Gauge {
+   public:
+    void Set(double value) { value_.store(value, std::memory_order_relaxed); }
+    double Value() const { return value_.load(std::memory_order_relaxed); }
+
+   private:
+    std::atomic<double> value_{};
+  };
+
+  /** Get the metric with the given name and labels, registering it if it's new.
+   * Throws std::logic_error if a metric of another type has the same name.
+   */
+  Counter& GetCounter(const std::string& name, const std::string& help,
+                      const MetricLabels& labels = {});
+  Gauge& GetGauge(const std::string& name, const std::string& help,
+                  const MetricLabels& labels = {});
+  LatencyHistogram& GetHistogram(const std::string& name, const std::string& help,
+                                 const MetricLabels& labels = {});
+
+  /** Read every metric, in the order they were registered. */
+  std::vector<Metric> Snapshot() const;
+
+ private:
+  struct Entry {
+    std::string name;
+    std::string help;
+    MetricType type;
+    MetricLabels labels;
+
+    // Exactly one is set, according to type
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<LatencyHistogram> histogram;
+  };
+
+  /** Find the entry with the given name and labels, or add one. Call with m_ held. */
+  Entry& FindOrAdd(const std::string& name, const std::string& help, MetricType type,
+                   const MetricLabels& labels);
+
+  mutable std::mutex m_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+/** Periodically writes a registry's metrics to a file, in the Prometheus text format.
+ * Each write goes to a temporary file that's then renamed over path, so a reader (like the
+ * node_exporter textfile collector) never sees a partial file.
+ */
+class PrometheusFileWriter {
+ public:
+  PrometheusFileWriter(std::shared_ptr<const MetricsRegistry> metrics, std::string path,
+                       std::chrono::milliseconds interval);
+
+  /** Writes the file one last time. */
+  ~PrometheusFileWriter();
+
+  PrometheusFileWriter(const PrometheusFileWriter&) = delete;
+  PrometheusFileWriter& operator=(const PrometheusFileWriter&) = delete;
+
+ private:
+  void Run();
+  void Write();
+
+  std::shared_ptr<const MetricsRegistry> metrics_;
+  std::string path_;
+  std::chrono::milliseconds interval_;
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  bool stopping_{};
+
+  // Last, so that everything it uses is constructed first
+  std::thread thread_;
+};
+
+}  // namespace wmr
@@ -17,11 +17,22 @@
 #include <stdexcept>
 
 #include "oasis_hid_calibration_key.hpp"
+#include "trace.hpp"
 
 namespace wmr {
 
-OasisHid::OasisHid(std::unique_ptr<HidDevice> hid_dev)
-    : hid_dev_(std::move(hid_dev)), imu_frame_pool_(kFramePoolSize) {
+OasisHid::OasisHid(std::unique_ptr<HidDevice> hid_dev, const ImuOptions &options,
+                   std::shared_ptr<ClockSync> clock_sync, std::shared_ptr<MetricsRegistry> metrics)
+    : hid_dev_(std::move(hid_dev)),
+      clock_sync_(std::move(clock_sync)),
+      metrics_(std::move(metrics)),
+      imu_metrics_(*metrics_),
+      imu_frame_pool_(options.frame_pool),
+      latency_(*metrics_, "wmr_imu_latency_seconds",
+               "Time from HID report arrival until each stage of IMU frame processing",
+               {"hid", "validate", "unpack", "callback_entry", "callback_exit"}) {
+  imu_frame_callbacks_.reserve(kMaxImuSubscribers);
+
   fw_log_report_reader_ = std::make_shared<FwLogReportReader>();
   hid_dev_->RegisterReportReader(FwLogReportReader::FwLogReport::kReportId, fw_log_report_reader_);
 
@@ -40,6 +51,22 @@ OasisHid::OasisHid(std::unique_ptr<HidDevice> hid_dev)
 
 OasisHid::~OasisHid() { WriteFwCmdWaitAck(FwReport::kCmdImuStop); }
 
+OasisHid::ImuMetrics::ImuMetrics(MetricsRegistry &metrics)
+    : frames(metrics.GetCounter("wmr_imu_frames_total", "IMU frames dispatched")),
+      samples(metrics.GetCounter("wmr_imu_samples_total",
+                                 "Accelerometer samples in valid IMU reports")),
+      gaps(metrics.GetCounter("wmr_imu_gaps_total", "Gaps of more than 2 ms between IMU samples")),
+      stale_frames(metrics.GetCounter("wmr_imu_stale_frames_total",
+                                      "IMU reports dropped for repeating an earlier sample")),
+      size_errors(metrics.GetCounter("wmr_imu_report_errors_total", "Invalid IMU reports, by error",
+                                     {{"error", "size"}})),
+      magic_errors(metrics.GetCounter("wmr_imu_report_errors_total",
+                                      "Invalid IMU reports, by error", {{"error", "magic"}})),
+      frames_dropped(metrics.GetCounter("wmr_imu_frames_dropped_total",
+                                        "IMU frames dropped for lack of a free frame")),
+      frame_pool_in_use(metrics.GetGauge("wmr_imu_frame_pool_in_use",
+                                         "IMU frames held by the driver or consumers")) {}
+
 void OasisHid::StartImu() {
   imu_report_reader_ = std::make_shared<ImuReportReader>();
   imu_report_reader_->parent_ = this;  // Safe-ish, since it's among the first members destructed
@@ -51,11 +78,54 @@ void OasisHid::StartImu() {
 void OasisHid::StopImu() {
   WriteFwCmdWaitAck(OasisHid::FwReport::kCmdImuStop);
   imu_report_reader_.reset();
+
+  auto pool_stats = imu_frame_pool_.GetStats();
+  spdlog::debug(
+      "OasisHid::StopImu: frame pool size={} (high_water={}, exhaustions={}, drops={}, "
+      "wait_time={}us)",
+      pool_stats.slots, pool_stats.high_water, pool_stats.exhaustions, pool_stats.failures,
+      std::chrono::duration_cast<std::chrono::microseconds>(pool_stats.wait_time).count());
+
+  latency_.Log("OasisHid::StopImu");
+
+  std::lock_guard l{imu_frame_callbacks_m_};
+  for (auto &subscriber : imu_frame_callbacks_) {
+    if (!subscriber.queue) continue;
+    auto queue_stats = subscriber.queue->GetStats();
+    spdlog::debug(
+        "OasisHid::StopImu: async callback delivered={} (dropped={}, max_queued={}, "
+        "max_lag={}us)",
+        queue_stats.delivered, queue_stats.dropped, queue_stats.max_queued,
+        std::chrono::duration_cast<std::chrono::microseconds>(queue_stats.max_lag).count());
+  }
 }
 
-void OasisHid::RegisterImuFrameCallback(ImuFrameCallback cb) {
+void OasisHid::RegisterImuFrameCallback(ImuFrameCallback cb, const CallbackQueueOptions &queue) {
   std::lock_guard l{imu_frame_callbacks_m_};
-  imu_frame_callbacks_.push_back(std::move(cb));
+  if (imu_frame_callbacks_.size() == kMaxImuSubscribers) {
+    throw std::runtime_error("OasisHid::RegisterImuFrameCallback: Too many IMU frame callbacks");
+  }
+
+  // Time every callback the same way, whichever thread it runs on
+  auto timed_cb = [this, cb = std::move(cb)](const ImuFrameHandle &frame) {
+    WMR_TRACE_SCOPE("IMU frame callback");
+    latency_.RecordSince(kLatencyCallbackEntry, frame->received_timestamp);
+    bool again = cb(frame);
+    latency_.RecordSince(kLatencyCallbackExit, frame->received_timestamp);
+    return again;
+  };
+
+  if (queue.async) {
+    imu_frame_callbacks_.push_back(
+        {nullptr, std::make_unique<CallbackQueue<ImuFrameHandle>>(std::move(timed_cb), queue)});
+  } else {
+    imu_frame_callbacks_.push_back({std::move(timed_cb), nullptr});
+  }
+}
+
+void OasisHid::SetCapture(std::shared_ptr<CaptureWriter> writer) {
+  hid_dev_->SetCapture(writer, capture::RecordType::kOasisReport);
+  capture_ = std::move(writer);
 }
 
 std::string OasisHid::ReadCalibration() {
@@ -103,13 +173,20 @@ std::basic_string<uint8_t> OasisHid::ReadFirmwarePayload(PayloadType type) {
   // Wait for read to complete
   auto fut = reader->payload_promise_.get_future();
   if (fut.wait_for(std::chrono::seconds(1)) == std::future_status::ready) {
-    return fut.get();
+    auto payload = fut.get();
+
+    // So that a replay of the capture can serve it
+    if (capture_) {
+      capture_->Write(capture::RecordType::kFirmwarePayload, static_cast<uint16_t>(type),
+                      std::chrono::steady_clock::now(), payload);
+    }
+    return payload;
   } else {
     throw std::runtime_error("OasisHid::ReadFirmwarePayload: Timeout");
   }
 }
 
-void OasisHid::FwPayloadReader::Update(Report report) {
+void OasisHid::FwPayloadReader::Update(Report report, HostTimestamp) {
   try {
     if (report.size() < 2) {
       throw std::runtime_error("Report too short");
@@ -177,10 +254,10 @@ void OasisHid::FwPayloadReader::Update(Report report) {
           throw std::runtime_error("DATA_READ_END before payload complete");
         }
 
-        // Success!
-        payload_promise_.set_value(std::move(payload_rbuff_));
-
+        // Success! Finish before fulfilling the promise, since the waiter may then register the
+        // next reader right away.
         finished_ = true;
+        payload_promise_.set_value(std::move(payload_rbuff_));
 
         // Note: Don't ACK DATA_READ_END
       } break;
@@ -240,36 +317,52 @@ void OasisHid::WriteHidCmd(uint8_t command, uint8_t mystery_byte) {
 void OasisHid::RunCallbacks(ImuFrameHandle frame) {
   // Run callbacks
   std::lock_guard l{imu_frame_callbacks_m_};
-  auto it = imu_frame_callbacks_.begin();
-  while (it != imu_frame_callbacks_.end()) {
-    ImuFrameCallback &cb = *it;
-    auto prev = it++;
-
-    if (!cb(frame)) {
-      imu_frame_callbacks_.erase(prev);
+  std::size_t i = 0;
+  while (i < imu_frame_callbacks_.size()) {
+    auto &subscriber = imu_frame_callbacks_[i];
+
+    // Asynchronous callbacks only get the frame queued, so they can't hold up the report reader
+    bool again = subscriber.queue ? subscriber.queue->Push(frame) : subscriber.callback(frame);
+    if (again) {
+      ++i;
+    } else {
+      imu_frame_callbacks_.erase(imu_frame_callbacks_.begin() + i);
     }
   }
 }
 
-void OasisHid::ImuReportReader::Update(Report report) {
+void OasisHid::ImuReportReader::Update(Report report, HostTimestamp received) {
+  WMR_TRACE_SCOPE("OasisHid::ImuReportReader::Update");
   assert(report[0] == ImuReport::kReportId);
 
   auto as_struct = reinterpret_cast<const ImuReport *>(report.data());
 
+  auto &metrics = parent_->imu_metrics_;
   if (report.size() != ImuReport::kReportSize) {
+    metrics.size_errors.Increment();
     spdlog::warn("ImuReport has wrong size ({})", report.size());
     return;
   }
 
   if (as_struct->magic != ImuReport::kMagic) {
+    metrics.magic_errors.Increment();
     spdlog::warn("ImuReport has bad magic ({:04x})", as_struct->magic);
     return;
   }
+  parent_->latency_.RecordSince(kLatencyValidate, received);
+  metrics.samples.Increment(ImuFrame::kSamplesPerFrame);
 
   sample_count_ += ImuFrame::kSamplesPerFrame;
   if (sample_count_ < kImuStartupDiscardNSamples) return;
 
   auto frame = parent_->imu_frame_pool_.Allocate();
+  metrics.frame_pool_in_use.Set(parent_->imu_frame_pool_.GetStats().in_use);
+  if (!frame) {
+    metrics.frames_dropped.Increment();
+    WMR_TRACE_INSTANT("IMU frame pool exhausted");
+    spdlog::warn("OasisHid::ImuReportReader: Frame pool exhausted, dropping frame");
+    return;
+  }
 
   // Sanitize the one buffer we might not completely overwrite
   frame->magneto_samples = {};
@@ -278,7 +371,16 @@ void OasisHid::ImuReportReader::Update(Report report) {
   for (std::size_t smp_idx = 0; true; ++smp_idx) {
     // Run callbacks and break when frame is complete
     if (smp_idx == ImuFrame::kSamplesPerFrame) {
-      parent_->RunCallbacks(frame);
+      auto device_time = frame->accel_samples.back().timestamp;
+      parent_->clock_sync_->AddSample(device_time, received);
+      frame->host_timestamp = parent_->clock_sync_->ToHost(device_time);
+      frame->received_timestamp = received;
+      parent_->latency_.Record(kLatencyHid, received - frame->host_timestamp);
+      parent_->latency_.RecordSince(kLatencyUnpack, received);
+
+      metrics.frames.Increment();
+
+      parent_->RunCallbacks(std::move(frame));
       break;
     }
 
@@ -288,11 +390,14 @@ void OasisHid::ImuReportReader::Update(Report report) {
     prev_sample_time_ = sample_time;
 
     if (delta_t.count() <= 0) {
+      metrics.stale_frames.Increment();
       stale_frame_count_++;
       break;
     }
 
     if (delta_t > 2 * kSamplePeriod) {
+      metrics.gaps.Increment();
+      WMR_TRACE_INSTANT("IMU sample gap");
       spdlog::warn(
           "OasisHid::ImuReportReader: encountered gap sample_count_={}, sample_time={}*100ns "
           "delta_t={}*100ns",
@@ -348,7 +453,7 @@ void OasisHid::ImuReportReader::Update(Report report) {
   }
 }
 
-void OasisHid::FwLogReportReader::Update(Report report) {
+void OasisHid::FwLogReportReader::Update(Report report, HostTimestamp) {
   assert(report[0] == FwLogReport::kReportId);
 
   auto as_struct = reinterpret_cast<const FwLogReport *>(report.data());
@@ -367,7 +472,7 @@ void OasisHid::FwLogReportReader::Update(Report report) {
   }
 }
 
-void OasisHid::McEventReportReader::Update(Report report) {
+void OasisHid::McEventReportReader::Update(Report report, HostTimestamp) {
   assert(report[0] == McEventReport::kReportId);
 
   auto as_struct = reinterpret_cast<const McEventReport *>(report.data());
@@ -380,7 +485,7 @@ void OasisHid::McEventReportReader::Update(Report report) {
   }
 }
 
-void OasisHid::CommandReportReader::Update(Report report) {
+void OasisHid::CommandReportReader::Update(Report report, HostTimestamp) {
   assert(report[0] == CommandReport::kReportId);
 
   auto as_struct = reinterpret_cast<const CommandReport *>(report.data());
@@ -399,7 +504,7 @@ void OasisHid::CommandReportReader::Update(Report report) {
   }
 }
 
-void OasisHid::WicedReportReader::Update(Report report) {
+void OasisHid::WicedReportReader::Update(Report report, HostTimestamp) {
   assert(report[0] == WicedReport::kReportId);
 
   auto as_struct = reinterpret_cast<const WicedReport *>(report.data());
@@ -7,25 +7,61 @@
 
 #include <chrono>
 #include <future>
-#include <list>
+#include <memory>
+#include <vector>
 
 #include <wmr/oasis_hid_interface.hpp>
 
+#include "callback_queue.hpp"
+#include "capture_writer.hpp"
+#include "clock_sync.hpp"
 #include "frame_pool.hpp"
 #include "hid_device.hpp"
+#include "latency_histogram.hpp"
+#include "metrics_registry.hpp"
 
 namespace wmr {
 
 class OasisHid : public OasisHidInterface {
  public:
-  OasisHid(std::unique_ptr<HidDevice> hid_dev);
+  /** clock_sync maps IMU timestamps to the host clock, and may be shared with the camera. The
+   * IMU's health metrics are registered with metrics.
+   */
+  OasisHid(std::unique_ptr<HidDevice> hid_dev, const ImuOptions& options,
+           std::shared_ptr<ClockSync> clock_sync, std::shared_ptr<MetricsRegistry> metrics);
   ~OasisHid();
 
- private:
-  static constexpr std::size_t kFramePoolSize = 3;
+  /** Record every report received from now on to writer, along with every firmware payload read. */
+  void SetCapture(std::shared_ptr<CaptureWriter> writer);
 
+ private:
   using BufferView = HidDevice::BufferView;
 
+  /** Subscribers are kept in an array of this size, so that dispatch never allocates. */
+  static constexpr std::size_t kMaxImuSubscribers = 16;
+
+  /** Stages of latency_, in the order GetLatency lists them. */
+  enum LatencyStage : std::size_t {
+    kLatencyHid,
+    kLatencyValidate,
+    kLatencyUnpack,
+    kLatencyCallbackEntry,
+    kLatencyCallbackExit,
+  };
+
+  struct ImuMetrics {
+    explicit ImuMetrics(MetricsRegistry& metrics);
+
+    MetricsRegistry::Counter& frames;
+    MetricsRegistry::Counter& samples;
+    MetricsRegistry::Counter& gaps;
+    MetricsRegistry::Counter& stale_frames;
+    MetricsRegistry::Counter& size_errors;
+    MetricsRegistry::Counter& magic_errors;
+    MetricsRegistry::Counter& frames_dropped;
+    MetricsRegistry::Gauge& frame_pool_in_use;
+  };
+
   enum HidCommands {
     kUnknown0 = 0x04,
     kUnknown1 = 0x08,
@@ -142,7 +178,9 @@ class OasisHid : public OasisHidInterface {
 
   void StartImu() final;
   void StopImu() final;
-  void RegisterImuFrameCallback(ImuFrameCallback cb) final;
+  using OasisHidInterface::RegisterImuFrameCallback;
+  void RegisterImuFrameCallback(ImuFrameCallback cb, const CallbackQueueOptions& queue) final;
+  std::vector<StageLatency> GetLatency() final { return latency_.Summarize(); }
   std::string ReadCalibration() final;
   std::basic_string<uint8_t> ReadDeviceInfo() final;
   void WriteHidCmd(uint8_t command, uint8_t mystery_byte = 0) final;
@@ -157,14 +195,14 @@ class OasisHid : public OasisHidInterface {
   void RunCallbacks(ImuFrameHandle frame);
 
   struct FwCmdAckReader : HidDevice::ReportReader {
-    void Update(Report) final { got_ack_.set_value(); }
+    void Update(Report, HostTimestamp) final { got_ack_.set_value(); }
     bool Finished() final { return true; }  // oneshot
 
     std::promise<void> got_ack_;
   };
 
   struct FwPayloadReader : HidDevice::ReportReader {
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
     bool Finished() final { return finished_; };
 
     OasisHid* parent_;
@@ -205,7 +243,7 @@ class OasisHid : public OasisHidInterface {
     };
     static_assert(sizeof(ImuReport) == ImuReport::kReportSize);
 
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
 
     OasisHid* parent_;
     Timestamp prev_sample_time_{-1};
@@ -235,7 +273,7 @@ class OasisHid : public OasisHidInterface {
     };
     static_assert(sizeof(FwLogReport) == FwLogReport::kReportSize);
 
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
   };
 
   struct McEventReportReader : HidDevice::ReportReader {
@@ -251,11 +289,11 @@ class OasisHid : public OasisHidInterface {
     };
     static_assert(sizeof(McEventReport) == McEventReport::kReportSize);
 
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
   };
 
   struct CommandReportReader : HidDevice::ReportReader {
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
   };
 
   struct WicedReportReader : HidDevice::ReportReader {
@@ -274,13 +312,27 @@ class OasisHid : public OasisHidInterface {
     };
     static_assert(sizeof(WicedReport) == WicedReport::kReportSize);
 
-    void Update(Report report) final;
+    void Update(Report report, HostTimestamp received) final;
   };
 
   std::unique_ptr<HidDevice> hid_dev_;
-  std::list<ImuFrameCallback> imu_frame_callbacks_;
-  std::mutex imu_frame_callbacks_m_;
+  std::shared_ptr<ClockSync> clock_sync_;
+  std::shared_ptr<MetricsRegistry> metrics_;
+  std::shared_ptr<CaptureWriter> capture_;
+  ImuMetrics imu_metrics_;
   FramePool<ImuFrame> imu_frame_pool_;
+
+  // Before imu_frame_callbacks_, since asynchronous callbacks record to it from their own threads
+  LatencyStages latency_;
+
+  // After imu_frame_pool_, so that frames still queued for asynchronous callbacks are released
+  // before the pool waits for them
+  struct ImuSubscriber {
+    ImuFrameCallback callback;
+    std::unique_ptr<CallbackQueue<ImuFrameHandle>> queue; /**< Null for synchronous callbacks. */
+  };
+  std::vector<ImuSubscriber> imu_frame_callbacks_;
+  std::mutex imu_frame_callbacks_m_;
   std::shared_ptr<ImuReportReader> imu_report_reader_;
   std::shared_ptr<FwLogReportReader> fw_log_report_reader_;
   std::shared_ptr<McEventReportReader> mc_event_report_reader_;
@@ -0,0 +1,102 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "remap_table.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "copy_kernels.hpp"
+
+namespace wmr {
+
+RemapTable::RemapTable(const HeadsetSpec& spec, const CopyPlan& plan, uint8_t image,
+                       const RectificationMap& map)
+    : image_(image), width_(spec.camera_width), height_(spec.camera_height) {
+  if (image >= plan.ImageCount()) {
+    throw std::invalid_argument("RemapTable: No such image");
+  }
+  if (map.width != width_ || map.height != height_ ||
+      map.map_x.size() != std::size_t{width_} * height_ ||
+      map.map_y.size() != std::size_t{width_} * height_) {
+    throw std::invalid_argument("RemapTable: Map doesn't match image size");
+  }
+
+  auto rows = plan.RowLayouts() + std::size_t{image} * height_;
+
+  // Offset of pixel (x, y) in the raw frame
+  auto src_offset = [&](int x, int y) -> uint32_t {
+    if (x < 0 || y < 0 || x >= static_cast<int>(width_) || y >= static_cast<int>(height_)) {
+      return kOutside;
+    }
+    auto& row = rows[y];
+    return static_cast<uint32_t>(x) < row.head_size ? row.head_offset + x
+                                                    : row.tail_offset + (x - row.head_size);
+  };
+
+  auto pixel_count = std::size_t{width_} * height_;
+  top_.resize(pixel_count);
+  bottom_.resize(pixel_count);
+  weights_.resize(pixel_count);
+
+  for (uint32_t dst_offset = 0; dst_offset < pixel_count; ++dst_offset) {
+    // Round to the nearest 1/32 pixel, like cv::remap does
+    double map_x = map.map_x[dst_offset], map_y = map.map_y[dst_offset];
+    std::array<uint32_t, 4> src{kOutside, kOutside, kOutside, kOutside};
+    uint16_t weights = 0;
+
+    if (std::isfinite(map_x) && std::isfinite(map_y) && std::abs(map_x) < 1 << 16 &&
+        std::abs(map_y) < 1 << 16) {
+      auto fixed_x = static_cast<int>(std::lrint(map_x * kRemapScale));
+      auto fixed_y = static_cast<int>(std::lrint(map_y * kRemapScale));
+      auto frac_x = fixed_x & (kRemapScale - 1), frac_y = fixed_y & (kRemapScale - 1);
+      auto x = (fixed_x - frac_x) / kRemapScale, y = (fixed_y - frac_y) / kRemapScale;
+
+      src = {src_offset(x, y), src_offset(x + 1, y), src_offset(x, y + 1),
+             src_offset(x + 1, y + 1)};
+      weights = static_cast<uint16_t>(frac_x | frac_y << 8);
+    }
+
+    // The kernels read pixel pairs with (up to) 4 byte loads
+    bool regular = src[0] != kOutside && src[2] != kOutside && src[1] == src[0] + 1 &&
+                   src[3] == src[2] + 1 && std::max(src[1], src[3]) + 3 <= spec.camera_frame_size;
+
+    if (regular) {
+      top_[dst_offset] = src[0];
+      bottom_[dst_offset] = src[2];
+      weights_[dst_offset] = weights;
+    } else {
+      // Filled in with whatever the first pixel of the frame is, then overwritten
+      top_[dst_offset] = bottom_[dst_offset] = 0;
+      weights_[dst_offset] = 0;
+      edge_pixels_.push_back({dst_offset, src, weights});
+    }
+  }
+}
+
+void RemapTable::Apply(const uint8_t* frame, CameraFrame::Pixel* dst, uint32_t row_begin,
+                       uint32_t row_end) const {
+  auto begin = std::size_t{row_begin} * width_, end = std::size_t{row_end} * width_;
+  GetCopyKernel().remap(dst + begin, frame, top_.data() + begin, bottom_.data() + begin,
+                        weights_.data() + begin, end - begin);
+
+  // Taps outside the image read as black
+  auto edge = std::lower_bound(
+      edge_pixels_.begin(), edge_pixels_.end(), begin,
+      [](const EdgePixel& pixel, std::size_t offset) { return pixel.dst_offset < offset; });
+  for (; edge != edge_pixels_.end() && edge->dst_offset < end; ++edge) {
+    int fx = edge->weights & 0xFF, fy = edge->weights >> 8;
+    auto tap = [&](int i) { return edge->src[i] == kOutside ? 0 : frame[edge->src[i]]; };
+
+    int upper = tap(0) * (kRemapScale - fx) + tap(1) * fx;
+    int lower = tap(2) * (kRemapScale - fx) + tap(3) * fx;
+    dst[edge->dst_offset] = static_cast<uint8_t>(
+        (upper * (kRemapScale - fy) + lower * fy + (1 << (2 * kRemapFractionBits - 1))) >>
+        (2 * kRemapFractionBits));
+  }
+}
+
+}  // namespace wmr
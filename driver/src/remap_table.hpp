@@ -0,0 +1,61 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <wmr/camera_interface.hpp>
+#include <wmr/headset_spec.hpp>
+#include <wmr/types.hpp>
+
+#include "copy_plan.hpp"
+
+namespace wmr {
+
+/** Fixed-point form of a RectificationMap for one image, addressed directly into raw frames.
+ * Each output pixel is compiled into the raw frame offsets of the top and bottom pixel pairs it
+ * blends, plus 5 bit horizontal and vertical fractions, which matches the rounding of
+ * cv::remap(..., cv::INTER_LINEAR). Pixels whose 2x2 neighborhood is partially outside the image,
+ * or is split by a segment header, don't fit that form. They're kept aside as edge pixels, with
+ * one offset per tap, and patched in after the bulk of the image has been interpolated.
+ */
+class RemapTable {
+ public:
+  RemapTable(const HeadsetSpec& spec, const CopyPlan& plan, uint8_t image,
+             const RectificationMap& map);
+
+  /** Interpolate rows [row_begin, row_end) of the rectified image out of frame into dst, which
+   * points to the whole image.
+   */
+  void Apply(const uint8_t* frame, CameraFrame::Pixel* dst, uint32_t row_begin,
+             uint32_t row_end) const;
+
+  uint8_t Image() const { return image_; }
+  uint32_t Height() const { return height_; }
+
+ private:
+  static constexpr uint32_t kOutside = UINT32_MAX;
+
+  struct EdgePixel {
+    uint32_t dst_offset;
+    std::array<uint32_t, 4> src; /**< Top left, top right, bottom left, bottom right. */
+    uint16_t weights;
+  };
+
+  uint8_t image_;
+  uint32_t width_;
+  uint32_t height_;
+
+  std::vector<uint32_t> top_;
+  std::vector<uint32_t> bottom_;
+  std::vector<uint16_t> weights_;
+  std::vector<EdgePixel> edge_pixels_;  // sorted by dst_offset
+};
+
+}  // namespace wmr
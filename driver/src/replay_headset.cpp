@@ -0,0 +1,231 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "replay_headset.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "camera.hpp"
+#include "clock_sync.hpp"
+#include "headset.h"
+#include "hp_reverb_hid.hpp"
+#include "metrics_registry.hpp"
+#include "oasis_hid.hpp"
+#include "trace.hpp"
+
+namespace wmr {
+
+namespace {
+
+/** Answers the firmware commands OasisHid writes to the Oasis HID device: payload reads from the
+ * payloads in a capture, and everything else with a bare acknowledgement. The report layout and
+ * command IDs are those of OasisHid::FwReport.
+ */
+class FirmwareEmulator {
+ public:
+  using Payloads = std::map<capture::FirmwarePayload, std::basic_string<uint8_t>>;
+
+  explicit FirmwareEmulator(Payloads payloads) : payloads_(std::move(payloads)) {}
+
+  void OnWrite(SoftHidDevice& dev, HidDevice::BufferView report) {
+    if (report.size() < 2 || report[0] != kReportId) return;
+
+    std::lock_guard l{m_};
+    std::array<uint8_t, kReportSize> reply{kReportId};
+    switch (report[1]) {
+      case kCmdStartCalibrationRead:
+      case kCmdStartDeviceInfoRead: {
+        auto type = report[1] == kCmdStartCalibrationRead ? capture::FirmwarePayload::kCalibration
+                                                          : capture::FirmwarePayload::kDeviceInfo;
+        auto it = payloads_.find(type);
+        if (it == payloads_.end()) {
+          // OasisHid times out, just as if the device didn't answer
+          spdlog::warn("ReplayHeadset: Capture has no firmware payload {}",
+                       static_cast<int>(type));
+          return;
+        }
+
+        reading_ = &it->second;
+        offset_ = 0;
+        auto size = static_cast<uint32_t>(reading_->size());
+        reply[1] = kDataReadStart;
+        reply[2] = static_cast<uint8_t>(type);
+        reply[3] = static_cast<uint8_t>(size >> 24);
+        reply[4] = static_cast<uint8_t>(size >> 16);
+        reply[5] = static_cast<uint8_t>(size >> 8);
+        reply[6] = static_cast<uint8_t>(size);
+      } break;
+
+      case kCmdAckDataReceived:
+        if (reading_ && offset_ < reading_->size()) {
+          auto chunk_size = std::min(kMaxChunkSize, reading_->size() - offset_);
+          reply[1] = kDataReadPayload;
+          reply[2] = static_cast<uint8_t>(chunk_size);
+          std::copy_n(reading_->begin() + offset_, chunk_size, reply.begin() + 3);
+          offset_ += chunk_size;
+        } else if (reading_) {
+          reply[1] = kDataReadEnd;
+          reading_ = nullptr;
+        } else {
+          reply[1] = report[1];
+        }
+        break;
+
+      default:
+        reply[1] = report[1];
+        break;
+    }
+    dev.Inject({reply.data(), reply.size()});
+  }
+
+ private:
+  static constexpr uint8_t kReportId = 0x02;
+  static constexpr std::size_t kReportSize = 64;
+  static constexpr std::size_t kMaxChunkSize = kReportSize - 3;
+
+  static constexpr uint8_t kCmdStartCalibrationRead = 0x04;
+  static constexpr uint8_t kCmdStartDeviceInfoRead = 0x06;
+  static constexpr uint8_t kCmdAckDataReceived = 0x08;
+
+  static constexpr uint8_t kDataReadStart = 0;
+  static constexpr uint8_t kDataReadPayload = 1;
+  static constexpr uint8_t kDataReadEnd = 2;
+
+  Payloads payloads_;
+
+  std::mutex m_;
+  const std::basic_string<uint8_t>* reading_{};
+  std::size_t offset_{};
+};
+
+}  // namespace
+
+ReplayHeadset::ReplayHeadset(const HeadsetSpec& spec, const HeadsetOptions& options)
+    : options_(options.replay), reader_(options.replay.file) {
+  // Payloads may be asked for at any time, so gather them up front
+  FirmwareEmulator::Payloads payloads;
+  CaptureReader::Record record;
+  while (reader_.Next(record)) {
+    if (record.type == capture::RecordType::kFirmwarePayload) {
+      payloads[static_cast<capture::FirmwarePayload>(record.status)] = record.data;
+    }
+  }
+  reader_.Rewind();
+  auto firmware = std::make_shared<FirmwareEmulator>(std::move(payloads));
+
+  auto metrics = std::make_shared<MetricsRegistry>();
+  auto clock_sync = std::make_shared<ClockSync>();
+
+  auto oasis_dev = std::make_unique<SoftHidDevice>(
+      metrics, "oasis", [firmware](SoftHidDevice& dev, HidDevice::BufferView report) {
+        firmware->OnWrite(dev, report);
+      });
+  oasis_dev_ = oasis_dev.get();
+
+  auto vendor_dev = std::make_unique<SoftHidDevice>(metrics, "vendor");
+  vendor_dev_ = vendor_dev.get();
+
+  auto camera_transport = std::make_unique<SoftCameraTransport>();
+  camera_transport_ = camera_transport.get();
+
+  auto camera = std::make_unique<wmr::Camera>(spec, options.camera, std::move(camera_transport),
+                                              clock_sync, metrics);
+
+  headset_ = std::make_unique<Headset>(
+      spec, nullptr,
+      std::make_unique<wmr::OasisHid>(std::move(oasis_dev), options.imu, clock_sync, metrics),
+      std::move(camera), std::make_unique<HpReverbHid>(std::move(vendor_dev)), metrics, options);
+}
+
+ReplayHeadset::~ReplayHeadset() {
+  if (replay_thread_.joinable()) Close();
+}
+
+void ReplayHeadset::Open() {
+  headset_->Open();
+
+  reader_.Rewind();
+  stopping_ = false;
+  replay_thread_ = std::thread([this]() { Replay(); });
+}
+
+void ReplayHeadset::Close() {
+  {
+    std::lock_guard l{m_};
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+  camera_transport_->Interrupt();
+
+  // Before closing the headset, so that StopRx doesn't cancel transfers under the replay thread
+  if (replay_thread_.joinable()) replay_thread_.join();
+  headset_->Close();
+}
+
+void ReplayHeadset::Replay() {
+  WMR_TRACE_THREAD_NAME("Replay");
+
+  bool fast = options_.pacing == ReplayPacing::kAsFastAsPossible;
+  auto start = std::chrono::steady_clock::now();
+  HostTimestamp first{};
+  bool have_first = false;
+  uint64_t transfers = 0;
+  uint64_t reports = 0;
+
+  try {
+    CaptureReader::Record record;
+    while (!stopping_ && reader_.Next(record)) {
+      if (!fast) {
+        if (!have_first) {
+          first = record.received;
+          have_first = true;
+        }
+        std::unique_lock l{m_};
+        if (stop_cv_.wait_until(l, start + (record.received - first),
+                                [this]() { return stopping_.load(); })) {
+          break;
+        }
+      }
+
+      switch (record.type) {
+        case capture::RecordType::kCameraTransfer:
+          camera_transport_->Complete(
+              record.data.data(), record.data.size(),
+              static_cast<libusbcpp::c::libusb_transfer_status>(record.status), fast);
+          ++transfers;
+          break;
+        case capture::RecordType::kOasisReport:
+          oasis_dev_->Inject(record.data);
+          ++reports;
+          break;
+        case capture::RecordType::kVendorReport:
+          vendor_dev_->Inject(record.data);
+          ++reports;
+          break;
+        case capture::RecordType::kFirmwarePayload:
+          // Answered on request, see FirmwareEmulator
+          break;
+      }
+    }
+  } catch (std::exception& e) {
+    spdlog::error("ReplayHeadset::Replay: Stopping replay: {}", e.what());
+  }
+
+  auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+  spdlog::info(
+      "ReplayHeadset::Replay: Replayed {} camera transfers and {} HID reports in {:.3f}s "
+      "(overruns={})",
+      transfers, reports, elapsed.count(), camera_transport_->Overruns());
+}
+
+}  // namespace wmr
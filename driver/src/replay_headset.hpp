@@ -0,0 +1,61 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <wmr/headset_interface.hpp>
+#include <wmr/headset_options.hpp>
+#include <wmr/headset_spec.hpp>
+
+#include "capture_format.hpp"
+#include "soft_camera_transport.hpp"
+#include "soft_hid_device.hpp"
+
+namespace wmr {
+
+/** Headset that plays back a capture, see CreateReplayHeadset.
+ * It's a regular Headset, whose Camera and OasisHid are wired to a SoftCameraTransport and
+ * SoftHidDevices instead of hardware. While it's open, a replay thread reads the capture and feeds
+ * each record to the one it was received from, paced as options.replay asks.
+ */
+class ReplayHeadset : public HeadsetInterface {
+ public:
+  ReplayHeadset(const HeadsetSpec& spec, const HeadsetOptions& options);
+  ~ReplayHeadset();
+
+ private:
+  void Open() final;
+  void Close() final;
+  CameraInterface& Camera() final { return headset_->Camera(); }
+  OasisHidInterface& OasisHid() final { return headset_->OasisHid(); }
+  VendorHidInterface& VendorHid() final { return headset_->VendorHid(); }
+  std::vector<Metric> GetMetrics() final { return headset_->GetMetrics(); }
+
+  void Replay();
+
+  ReplayOptions options_;
+  CaptureReader reader_;
+
+  // Owned by headset_
+  SoftCameraTransport* camera_transport_;
+  SoftHidDevice* oasis_dev_;
+  SoftHidDevice* vendor_dev_;
+
+  std::unique_ptr<HeadsetInterface> headset_;
+
+  std::mutex m_;
+  std::condition_variable stop_cv_;
+  std::atomic<bool> stopping_{};
+  std::thread replay_thread_;
+};
+
+}  // namespace wmr
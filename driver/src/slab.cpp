@@ -0,0 +1,88 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "slab.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace wmr {
+
+namespace {
+
+std::size_t RoundUp(std::size_t n, std::size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+#ifdef __linux__
+
+Slab::Slab(std::size_t size) : size_(RoundUp(size, kHugePageSize)) {
+  // Explicit huge pages
+  mapping_size_ = size_;
+  mapping_ = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (mapping_ != MAP_FAILED) {
+    data_ = static_cast<uint8_t*>(mapping_);
+    spdlog::debug("Slab: {} bytes on explicit huge pages", size_);
+    return;
+  }
+
+  // Regular pages, over-allocated so the block can be aligned to a huge page boundary, which
+  // transparent huge pages need
+  mapping_size_ = size_ + kHugePageSize;
+  mapping_ = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                  0);
+  if (mapping_ == MAP_FAILED) throw std::bad_alloc();
+
+  auto address = reinterpret_cast<std::uintptr_t>(mapping_);
+  data_ = static_cast<uint8_t*>(mapping_) + RoundUp(address, kHugePageSize) - address;
+
+  if (madvise(data_, size_, MADV_HUGEPAGE) == 0) {
+    spdlog::debug("Slab: {} bytes, transparent huge pages requested", size_);
+  } else {
+    spdlog::debug("Slab: {} bytes on regular pages", size_);
+  }
+}
+
+Slab::~Slab() { munmap(mapping_, mapping_size_); }
+
+void Slab::Prefault(std::size_t offset, std::size_t size) {
+  // Writing one byte per page is enough to fault it in. Reading would map the shared zero page.
+  auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  auto begin = offset / page_size * page_size;
+  for (auto p = begin; p < offset + size && p < size_; p += page_size) {
+    static_cast<volatile uint8_t*>(data_)[p] = 0;
+  }
+}
+
+#else
+
+Slab::Slab(std::size_t size) : size_(RoundUp(size, kHugePageSize)) {
+  mapping_ = std::aligned_alloc(kHugePageSize, size_);
+  if (!mapping_) throw std::bad_alloc();
+  data_ = static_cast<uint8_t*>(mapping_);
+}
+
+Slab::~Slab() { std::free(mapping_); }
+
+void Slab::Prefault(std::size_t offset, std::size_t size) {
+  constexpr std::size_t kPageSize = 4096;
+  for (auto p = offset / kPageSize * kPageSize; p < offset + size && p < size_; p += kPageSize) {
+    static_cast<volatile uint8_t*>(data_)[p] = 0;
+  }
+}
+
+#endif
+
+}  // namespace wmr
@@ -0,0 +1,43 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wmr {
+
+/** One large, page-aligned block of memory, backed by huge pages where the OS allows.
+ * Explicit huge pages (MAP_HUGETLB) are tried first, which only works if some have been reserved
+ * (vm.nr_hugepages). Failing that, the block is aligned to a huge page boundary and marked for
+ * transparent huge pages. Neither is guaranteed, so the block may end up on regular pages.
+ */
+class Slab {
+ public:
+  static constexpr std::size_t kHugePageSize = 2 << 20;
+
+  explicit Slab(std::size_t size);
+  ~Slab();
+
+  Slab(const Slab&) = delete;
+  Slab& operator=(const Slab&) = delete;
+
+  uint8_t* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+  /** Fault in the pages backing [offset, offset + size), so first use doesn't have to. */
+  void Prefault(std::size_t offset, std::size_t size);
+
+ private:
+  uint8_t* data_{};
+  std::size_t size_;
+
+  // What to hand back to the OS, which may be larger than the block itself
+  void* mapping_{};
+  std::size_t mapping_size_{};
+};
+
+}  // namespace wmr
@@ -0,0 +1,179 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "soft_camera_transport.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace wmr {
+
+SoftCameraTransport::SoftCameraTransport(CommandHook on_command)
+    : on_command_(std::move(on_command)) {}
+
+void SoftCameraTransport::WriteCommand(const void* command, std::size_t size) {
+  if (on_command_) on_command_(static_cast<const uint8_t*>(command), size);
+}
+
+void SoftCameraTransport::SendCommand(std::size_t, const void* command, std::size_t size,
+                                      std::promise<void>* sent) {
+  WriteCommand(command, size);
+  if (sent) sent->set_value();
+}
+
+void SoftCameraTransport::OpenRx(const RxConfig& config) {
+  if (config.min_depth == 0 || config.min_depth > config.max_depth ||
+      config.max_depth > config.capacity) {
+    throw std::invalid_argument("SoftCameraTransport: need 0 < min_depth <= max_depth <= capacity");
+  }
+  config_ = config;
+  depth_ = std::clamp(config_.depth, config_.min_depth, config_.max_depth);
+
+  submitted_.resize(config_.capacity);
+  for (std::size_t i = 0; i < config_.capacity; ++i) {
+    auto& trans = transfers_.emplace_back(std::make_unique<Transfer>());
+    auto& buff = buffers_.emplace_back(std::make_unique<uint8_t[]>(config_.buffer_size));
+    trans->type = libusbcpp::c::LIBUSB_TRANSFER_TYPE_BULK;
+    trans->buffer = buff.get();
+    trans->length = static_cast<int>(config_.buffer_size);
+    trans->callback = config_.callback;
+    trans->user_data = config_.user_data;
+    idle_.push_back(trans.get());
+  }
+}
+
+void SoftCameraTransport::StartRx() {
+  std::lock_guard l{m_};
+  running_ = true;
+  interrupted_ = false;
+  TopUp();
+}
+
+void SoftCameraTransport::StopRx() {
+  std::vector<Transfer*> cancelled;
+  {
+    std::lock_guard l{m_};
+    running_ = false;
+    while (submitted_count_ > 0) cancelled.push_back(PopSubmitted());
+  }
+  submitted_cv_.notify_all();
+
+  // Only now, since a thread waiting in Complete holds callback_m_ until it sees running_ cleared
+  std::lock_guard callback_lock{callback_m_};
+  for (auto trans : cancelled) {
+    trans->status = libusbcpp::c::LIBUSB_TRANSFER_CANCELLED;
+    trans->actual_length = 0;
+    trans->callback(trans);
+  }
+}
+
+void SoftCameraTransport::OnRxComplete(Transfer*) {
+  std::lock_guard l{m_};
+  auto in_flight = --in_flight_;
+  ++held_;
+  ++stats_.completions;
+
+  if (!running_) return;
+
+  stats_.min_in_flight = std::min(stats_.min_in_flight, in_flight);
+  if (in_flight == 0) ++stats_.underruns;
+  TopUp();
+}
+
+void SoftCameraTransport::RecycleRx(Transfer* trans) {
+  std::lock_guard l{m_};
+  --held_;
+  idle_.push_back(trans);
+  TopUp();
+}
+
+SoftCameraTransport::RxStats SoftCameraTransport::GetRxStats() const {
+  std::lock_guard l{m_};
+  RxStats stats = stats_;
+  stats.capacity = config_.capacity;
+  stats.depth = depth_;
+  stats.in_flight = in_flight_;
+  stats.held = held_;
+  stats.idle = idle_.size();
+  if (stats.min_in_flight == SIZE_MAX) stats.min_in_flight = 0;
+  return stats;
+}
+
+bool SoftCameraTransport::Complete(const uint8_t* data, std::size_t size,
+                                   libusbcpp::c::libusb_transfer_status status, bool wait) {
+  return CompleteInPlace(
+      [&](uint8_t* buffer, std::size_t capacity) {
+        std::copy_n(data, std::min(size, capacity), buffer);
+        return size;
+      },
+      status, wait);
+}
+
+bool SoftCameraTransport::CompleteInPlace(const Fill& fill,
+                                          libusbcpp::c::libusb_transfer_status status, bool wait) {
+  // Held throughout, so that transfers are completed one at a time, in order
+  std::lock_guard callback_lock{callback_m_};
+
+  Transfer* trans;
+  {
+    std::unique_lock l{m_};
+    if (wait) {
+      submitted_cv_.wait(l,
+                         [this]() { return submitted_count_ > 0 || !running_ || interrupted_; });
+    }
+    if (!running_ || (interrupted_ && submitted_count_ == 0)) return false;
+    if (submitted_count_ == 0) {
+      ++overruns_;
+      return false;
+    }
+    trans = PopSubmitted();
+  }
+
+  auto size = fill(trans->buffer, config_.buffer_size);
+  auto length = std::min(size, config_.buffer_size);
+  trans->actual_length = static_cast<int>(length);
+  trans->status = size > length ? libusbcpp::c::LIBUSB_TRANSFER_OVERFLOW : status;
+  trans->callback(trans);
+  return true;
+}
+
+void SoftCameraTransport::Interrupt() {
+  {
+    std::lock_guard l{m_};
+    interrupted_ = true;
+  }
+  submitted_cv_.notify_all();
+}
+
+uint64_t SoftCameraTransport::Overruns() const {
+  std::lock_guard l{m_};
+  return overruns_;
+}
+
+bool SoftCameraTransport::Running() const {
+  std::lock_guard l{m_};
+  return running_;
+}
+
+void SoftCameraTransport::TopUp() {
+  bool submitted = false;
+  while (running_ && in_flight_ < depth_ && !idle_.empty()) {
+    submitted_[(submitted_head_ + submitted_count_++) % submitted_.size()] = idle_.back();
+    idle_.pop_back();
+    ++in_flight_;
+    submitted = true;
+  }
+  if (submitted) submitted_cv_.notify_all();
+}
+
+SoftCameraTransport::Transfer* SoftCameraTransport::PopSubmitted() {
+  auto trans = submitted_[submitted_head_];
+  submitted_head_ = (submitted_head_ + 1) % submitted_.size();
+  --submitted_count_;
+  return trans;
+}
+
+}  // namespace wmr
@@ -0,0 +1,112 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "camera_transport.hpp"
+
+namespace wmr {
+
+/** CameraTransport without a device behind it, for replaying recordings and simulating devices.
+ * Receive transfers are completed by calling Complete, from a thread that takes the place of the
+ * libusb event thread. Transfers in flight are completed in the order they were submitted, and
+ * StopRx cancels the rest right away, on the calling thread. Like libusb's, transfer callbacks
+ * never run concurrently: they're serialized by a mutex, so StopRx first waits for a completion in
+ * progress on another thread. A callback may call StopRx itself. The depth stays where RxConfig
+ * put it. Commands go to a hook, if there is one, and are otherwise dropped.
+ */
+class SoftCameraTransport : public CameraTransport {
+ public:
+  /** Called with every command written or sent, on the thread that did so. */
+  using CommandHook = std::function<void(const uint8_t* command, std::size_t size)>;
+
+  explicit SoftCameraTransport(CommandHook on_command = nullptr);
+
+  void WriteCommand(const void* command, std::size_t size) final;
+
+  /** sent is fulfilled as soon as the hook returns. */
+  void SendCommand(std::size_t key, const void* command, std::size_t size,
+                   std::promise<void>* sent) final;
+
+  void OpenRx(const RxConfig& config) final;
+  void StartRx() final;
+  void StopRx() final;
+  void OnRxComplete(Transfer* trans) final;
+  void RecycleRx(Transfer* trans) final;
+  std::size_t RxInFlight() const final { return in_flight_.load(std::memory_order_acquire); }
+  RxStats GetRxStats() const final;
+
+  /** Complete the oldest transfer in flight with size bytes of data and the given status. Data
+   * that doesn't fit is cut off, and the status becomes LIBUSB_TRANSFER_OVERFLOW, as with libusb.
+   * If no transfer is in flight, waits for one if wait is set. Otherwise, the data is dropped and
+   * counted as an overrun. Returns false if the data was dropped, or the transport isn't running.
+   */
+  bool Complete(const uint8_t* data, std::size_t size,
+                libusbcpp::c::libusb_transfer_status status, bool wait);
+
+  /** Writes the data of a transfer straight into its buffer, of the given capacity (which still
+   * holds whatever the transfer last received), and returns its size.
+   */
+  using Fill = std::function<std::size_t(uint8_t* buffer, std::size_t capacity)>;
+
+  /** Like Complete, but saves a copy by having fill write the data. */
+  bool CompleteInPlace(const Fill& fill, libusbcpp::c::libusb_transfer_status status, bool wait);
+
+  /** Make Complete return false instead of waiting for a transfer, until the next StartRx. For
+   * stopping a thread that completes transfers before stopping the stream.
+   */
+  void Interrupt();
+
+  /** Data dropped by Complete for lack of a transfer in flight. */
+  uint64_t Overruns() const;
+
+  /** Whether StartRx was called more recently than StopRx, e.g. by a Camera stopping itself after
+   * an error.
+   */
+  bool Running() const;
+
+ private:
+  /** Submit idle transfers until depth_ are in flight. Call with m_ held. */
+  void TopUp();
+
+  /** Take the oldest transfer off submitted_. Call with m_ held, while submitted_count_ > 0. */
+  Transfer* PopSubmitted();
+
+  CommandHook on_command_;
+  RxConfig config_{};
+  std::size_t depth_{};
+
+  std::vector<std::unique_ptr<Transfer>> transfers_;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers_;
+
+  // Held while a transfer callback runs. Taken before m_.
+  std::recursive_mutex callback_m_;
+
+  mutable std::mutex m_;
+  std::condition_variable submitted_cv_; /**< Signals Complete that a transfer was submitted. */
+  bool running_{};
+  bool interrupted_{};
+  // Ring of transfers in flight and not being completed yet, oldest first. Sized for every
+  // transfer up front, so that completing one never allocates.
+  std::vector<Transfer*> submitted_;
+  std::size_t submitted_head_{};
+  std::size_t submitted_count_{};
+  std::atomic<std::size_t> in_flight_{};
+  std::size_t held_{};
+  std::vector<Transfer*> idle_;
+  uint64_t overruns_{};
+  // min_in_flight stays at SIZE_MAX until the first completion, as in TransferRing
+  RxStats stats_{0, 0, 0, 0, 0, SIZE_MAX, 0, 0, 0, 0, 0};
+};
+
+}  // namespace wmr
@@ -0,0 +1,73 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "soft_hid_device.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "trace.hpp"
+
+namespace wmr {
+
+SoftHidDevice::SoftHidDevice(std::shared_ptr<MetricsRegistry> metrics, std::string device_name,
+                             WriteHook on_write)
+    : HidDevice(std::move(metrics), std::move(device_name)),
+      on_write_(std::move(on_write)),
+      dispatch_thread_([this]() { DispatchThreadFunc(); }) {}
+
+SoftHidDevice::~SoftHidDevice() {
+  {
+    std::lock_guard l{m_};
+    stopping_ = true;
+  }
+  queued_cv_.notify_one();
+  room_cv_.notify_all();
+  dispatch_thread_.join();
+}
+
+void SoftHidDevice::WriteReport(BufferView report) {
+  if (on_write_) on_write_(*this, report);
+}
+
+void SoftHidDevice::GetFeatureReport(void *report, std::size_t report_size) {
+  // Leave the report ID in place, like a device would
+  if (report_size > 1) std::memset(static_cast<Byte *>(report) + 1, 0, report_size - 1);
+}
+
+void SoftHidDevice::Inject(BufferView report) {
+  if (report.empty()) return;
+
+  std::unique_lock l{m_};
+  if (std::this_thread::get_id() != dispatch_thread_.get_id()) {
+    room_cv_.wait(l, [this]() { return queue_.size() < kQueueDepth || stopping_; });
+  }
+  if (stopping_) return;
+
+  queue_.emplace_back(report);
+  l.unlock();
+  queued_cv_.notify_one();
+}
+
+void SoftHidDevice::DispatchThreadFunc() {
+  WMR_TRACE_THREAD_NAME("Soft HID dispatch");
+
+  std::unique_lock l{m_};
+  while (true) {
+    queued_cv_.wait(l, [this]() { return !queue_.empty() || stopping_; });
+    if (stopping_) break;
+
+    auto report = std::move(queue_.front());
+    queue_.pop_front();
+    l.unlock();
+    room_cv_.notify_one();
+
+    DispatchReport(report, std::chrono::steady_clock::now());
+    l.lock();
+  }
+}
+
+}  // namespace wmr
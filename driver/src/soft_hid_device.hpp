@@ -0,0 +1,61 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "hid_device.hpp"
+
+namespace wmr {
+
+/** HidDevice without a device behind it, for replaying recordings.
+ * Reports handed to Inject are dispatched in order by a thread of its own, which takes the place
+ * of the hidapi reader thread. Reports written go to a hook, which may Inject replies. Feature
+ * reports set are dropped, and those gotten read back as zeros.
+ */
+class SoftHidDevice : public HidDevice {
+ public:
+  /** Called with every report written, on the thread that wrote it. */
+  using WriteHook = std::function<void(SoftHidDevice& dev, BufferView report)>;
+
+  SoftHidDevice(std::shared_ptr<MetricsRegistry> metrics, std::string device_name,
+                WriteHook on_write = nullptr);
+  ~SoftHidDevice();
+
+  void WriteReport(BufferView report) final;
+  void SetFeatureReport(BufferView) final {}
+  void GetFeatureReport(void *report, std::size_t report_size) final;
+
+  /** Queue report to be dispatched. Waits while kQueueDepth reports are queued already, unless
+   * called from the dispatching thread (e.g. by a reader replying to a report).
+   */
+  void Inject(BufferView report);
+
+ private:
+  static constexpr std::size_t kQueueDepth = 64;
+
+  void DispatchThreadFunc();
+
+  WriteHook on_write_;
+
+  std::mutex m_;
+  std::condition_variable queued_cv_; /**< Signals the dispatch thread that queue_ is non-empty. */
+  std::condition_variable room_cv_;   /**< Signals Inject that queue_ has room. */
+  std::deque<std::basic_string<Byte>> queue_;
+  bool stopping_{};
+
+  // Last, so that everything it uses is constructed first
+  std::thread dispatch_thread_;
+};
+
+}  // namespace wmr
@@ -0,0 +1,81 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace wmr {
+
+/** Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ * Capacity is rounded up to a power of two. Each side caches the other side's index, so in the
+ * common case a push or pop touches only one shared cache line.
+ */
+template <typename T>
+class SpscQueue {
+ public:
+  explicit SpscQueue(std::size_t capacity)
+      : slots_(RoundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1) {}
+
+  SpscQueue(const SpscQueue&) = delete;
+  SpscQueue& operator=(const SpscQueue&) = delete;
+
+  /** Producer side. Returns false if the queue is full. */
+  bool TryPush(const T& value) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == slots_.size()) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == slots_.size()) return false;
+    }
+
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Consumer side. Returns false if the queue is empty. */
+  bool TryPop(T& value) {
+    auto head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return false;
+    }
+
+    value = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Safe to call from either side, but only exact from the consumer. */
+  bool Empty() const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+  std::size_t capacity() const { return slots_.size(); }
+
+ private:
+  static constexpr std::size_t kCacheLineSize = 64;
+
+  static std::size_t RoundUpToPowerOfTwo(std::size_t n) {
+    std::size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+  }
+
+  // Consumer owned
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{};
+  std::size_t cached_tail_{};
+
+  // Producer owned
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{};
+  std::size_t cached_head_{};
+
+  alignas(kCacheLineSize) std::vector<T> slots_;
+  const std::size_t mask_;
+};
+
+}  // namespace wmr
@@ -0,0 +1,150 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "trace.hpp"
+#include "waiter.hpp"
+
+namespace wmr {
+
+ThreadPool::ThreadPool(std::size_t thread_count) : slots_(std::max<std::size_t>(thread_count, 1)) {
+  for (std::size_t i = 1; i < slots_.size(); ++i) {
+    workers_.emplace_back([this, i]() { WorkerThread(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard l{m_};
+    stop_ = true;
+  }
+  cv_.notify_all();
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Run(std::size_t count, Task task, void* ctx) {
+  if (count == 0) return;
+  if (count > std::numeric_limits<uint32_t>::max()) {
+    throw std::invalid_argument("ThreadPool::ParallelFor: count too large");
+  }
+
+  task_ = task;
+  ctx_ = ctx;
+  remaining_.store(count, std::memory_order_relaxed);
+
+  // Give each participant an equal share
+  auto n = slots_.size();
+  for (std::size_t i = 0; i < n; ++i) {
+    slots_[i].range.store(Pack(static_cast<uint32_t>(count * i / n),
+                               static_cast<uint32_t>(count * (i + 1) / n)),
+                          std::memory_order_relaxed);
+  }
+
+  // Open the job. Workers join with an acquire CAS on job_state_, which makes the above visible.
+  {
+    std::lock_guard l{m_};
+    ++generation_;
+    job_state_.store((uint64_t{generation_} << 32) | kJobOpen, std::memory_order_release);
+  }
+  cv_.notify_all();
+
+  Work(0);
+
+  // Wait for the tasks claimed by workers to finish
+  while (remaining_.load(std::memory_order_acquire)) CpuRelax();
+
+  // Close the job, so that late workers don't join it, then wait for the ones that did to leave.
+  // After that, nobody is touching slots_ and they're safe to reuse.
+  job_state_.fetch_and(~kJobOpen, std::memory_order_acq_rel);
+  while (job_state_.load(std::memory_order_acquire) & kActiveMask) CpuRelax();
+}
+
+void ThreadPool::WorkerThread(std::size_t slot_idx) {
+  WMR_TRACE_THREAD_NAME("ThreadPool worker " + std::to_string(slot_idx));
+  uint32_t seen_generation = 0;
+
+  while (true) {
+    {
+      std::unique_lock l{m_};
+      cv_.wait(l, [&]() { return stop_ || generation_ != seen_generation; });
+      if (stop_) return;
+      seen_generation = generation_;
+    }
+
+    // Join the job, unless it's already been closed
+    bool joined = false;
+    auto state = job_state_.load(std::memory_order_acquire);
+    while ((state >> 32) == seen_generation && (state & kJobOpen)) {
+      if (job_state_.compare_exchange_weak(state, state + 1, std::memory_order_acquire)) {
+        joined = true;
+        break;
+      }
+    }
+    if (!joined) continue;
+
+    Work(slot_idx);
+    job_state_.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void ThreadPool::Work(std::size_t slot_idx) {
+  WMR_TRACE_SCOPE("ThreadPool::Work");
+  uint32_t i;
+  while (Claim(slot_idx, i) || Steal(slot_idx, i)) {
+    task_(ctx_, i);
+    remaining_.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+bool ThreadPool::Claim(std::size_t slot_idx, uint32_t& i) {
+  auto& range = slots_[slot_idx].range;
+  auto r = range.load(std::memory_order_relaxed);
+
+  while (Begin(r) < End(r)) {
+    if (range.compare_exchange_weak(r, Pack(Begin(r) + 1, End(r)), std::memory_order_acquire,
+                                    std::memory_order_relaxed)) {
+      i = Begin(r);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool ThreadPool::Steal(std::size_t slot_idx, uint32_t& i) {
+  auto n = slots_.size();
+  for (std::size_t k = 1; k < n; ++k) {
+    auto& range = slots_[(slot_idx + k) % n].range;
+    auto r = range.load(std::memory_order_relaxed);
+
+    while (Begin(r) < End(r)) {
+      // Take the back half
+      auto take = (End(r) - Begin(r) + 1) / 2;
+      auto new_end = End(r) - take;
+      if (range.compare_exchange_weak(r, Pack(Begin(r), new_end), std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+        // Run the first stolen index now, and offer up the rest from our own slot. Our slot is
+        // empty, so nobody else is trying to modify it. Nor can its new value be one that a
+        // delayed thief loaded earlier, since those indices have all been claimed since.
+        i = new_end;
+        slots_[slot_idx].range.store(Pack(new_end + 1, End(r)), std::memory_order_release);
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+}  // namespace wmr
@@ -0,0 +1,90 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace wmr {
+
+/** A small fork-join pool for splitting one latency-critical job across cores.
+ * ParallelFor partitions its index range evenly across the participants (the calling thread plus
+ * thread_count - 1 workers). Each participant works through its own share from the front; once
+ * that's gone it steals half of the remaining share of another participant from the back.
+ * Shares are packed into a single atomic word, so claiming and stealing are both lock-free.
+ *
+ * ParallelFor may only be called from one thread at a time.
+ */
+class ThreadPool {
+ public:
+  /** thread_count includes the thread that calls ParallelFor. */
+  explicit ThreadPool(std::size_t thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  std::size_t ThreadCount() const { return slots_.size(); }
+
+  /** Call fn(i) for each i in [0, count), and return once all of the calls have returned.
+   * fn must not throw.
+   */
+  template <typename Fn>
+  void ParallelFor(std::size_t count, Fn&& fn) {
+    using FnT = std::remove_reference_t<Fn>;
+    Run(count, [](void* ctx, std::size_t i) { (*static_cast<FnT*>(ctx))(i); },
+        const_cast<void*>(static_cast<const void*>(&fn)));
+  }
+
+ private:
+  using Task = void (*)(void* ctx, std::size_t i);
+
+  /** One participant's share of the index range, packed as (begin << 32) | end. */
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> range{};
+  };
+
+  static constexpr uint64_t Pack(uint32_t begin, uint32_t end) {
+    return (uint64_t{begin} << 32) | end;
+  }
+  static constexpr uint32_t Begin(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+  static constexpr uint32_t End(uint64_t range) { return static_cast<uint32_t>(range); }
+
+  // job_state_ layout: generation in the top 32 bits, then the open flag, then the number of
+  // workers currently participating in the job.
+  static constexpr uint64_t kJobOpen = uint64_t{1} << 31;
+  static constexpr uint64_t kActiveMask = kJobOpen - 1;
+
+  void Run(std::size_t count, Task task, void* ctx);
+  void WorkerThread(std::size_t slot_idx);
+
+  /** Run tasks until there's nothing left to claim or steal. */
+  void Work(std::size_t slot_idx);
+  bool Claim(std::size_t slot_idx, uint32_t& i);
+  bool Steal(std::size_t slot_idx, uint32_t& i);
+
+  std::vector<Slot> slots_;
+  std::vector<std::thread> workers_;
+
+  Task task_{};
+  void* ctx_{};
+  alignas(64) std::atomic<std::size_t> remaining_{};
+  alignas(64) std::atomic<uint64_t> job_state_{};
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  uint32_t generation_{};
+  bool stop_{};
+};
+
+}  // namespace wmr
@@ -0,0 +1,140 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "trace.hpp"
+
+#include <spdlog/fmt/fmt.h>
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace wmr {
+
+#if WMR_TRACING
+
+namespace trace {
+
+namespace {
+
+struct ThreadInfo {
+  std::unique_ptr<ThreadBuffer> buffer;
+  std::string name;
+};
+
+/** Every thread buffer ever created, kept after its thread exits so its events can be exported. */
+struct Registry {
+  std::mutex m;
+  std::vector<ThreadInfo> threads;
+
+  // Reference point for converting ticks to time
+  uint64_t base_ticks = Now();
+  std::chrono::steady_clock::time_point base_time = std::chrono::steady_clock::now();
+};
+
+Registry& GetRegistry() {
+  // Never destroyed, since threads may still record while static objects are destructed
+  static auto registry = new Registry;
+  return *registry;
+}
+
+std::string EscapeJson(const std::string& s) {
+  std::string escaped;
+  for (char c : s) {
+    if (c == '"' || c == '\\') escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+}  // namespace
+
+ThreadBuffer& RegisterThread() {
+  auto& registry = GetRegistry();
+  std::lock_guard l{registry.m};
+  auto& info = registry.threads.emplace_back();
+  info.buffer = std::make_unique<ThreadBuffer>();
+  info.name = fmt::format("thread {}", registry.threads.size());
+  return *info.buffer;
+}
+
+void SetThreadName(std::string name) {
+  auto& buffer = LocalBuffer();
+  auto& registry = GetRegistry();
+  std::lock_guard l{registry.m};
+  for (auto& info : registry.threads) {
+    if (info.buffer.get() == &buffer) info.name = std::move(name);
+  }
+}
+
+}  // namespace trace
+
+bool TracingEnabled() { return true; }
+
+bool WriteChromeTrace(const std::string& path) {
+  using namespace trace;
+  auto& registry = GetRegistry();
+
+  // Calibrate ticks against the steady clock over the whole run so far
+  auto ticks = Now() - registry.base_ticks;
+  auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                           registry.base_time);
+  double us_per_tick = ticks > 0 ? elapsed.count() / ticks : 0;
+  auto to_us = [&](uint64_t t) {
+    // A thread's first event may start just before the registry was created
+    return static_cast<double>(static_cast<int64_t>(t - registry.base_ticks)) * us_per_tick;
+  };
+
+  std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+  std::vector<ThreadBuffer::Event> events;
+  {
+    std::lock_guard l{registry.m};
+    for (std::size_t tid = 1; tid <= registry.threads.size(); ++tid) {
+      auto& info = registry.threads[tid - 1];
+      json += fmt::format(
+          "{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":{},"
+          "\"args\":{{\"name\":\"{}\"}}}},\n",
+          tid, EscapeJson(info.name));
+
+      events.clear();
+      info.buffer->Read(events);
+      for (auto& e : events) {
+        if (e.duration == ThreadBuffer::kInstant) {
+          json += fmt::format(
+              "{{\"ph\":\"i\",\"s\":\"t\",\"name\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{:.3f}}},\n",
+              e.name, tid, to_us(e.start));
+        } else {
+          json += fmt::format(
+              "{{\"ph\":\"X\",\"name\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},"
+              "\"dur\":{:.3f}}},\n",
+              e.name, tid, to_us(e.start), e.duration * us_per_tick);
+        }
+      }
+    }
+  }
+
+  // JSON doesn't allow a trailing comma
+  if (json.size() >= 2 && json[json.size() - 2] == ',') json.erase(json.size() - 2, 1);
+  json += "]}\n";
+
+  std::ofstream file(path, std::ios::trunc);
+  file << json;
+  if (!file) throw std::runtime_error("WriteChromeTrace: Failed to write " + path);
+  return true;
+}
+
+#else
+
+bool TracingEnabled() { return false; }
+
+bool WriteChromeTrace(const std::string&) { return false; }
+
+#endif
+
+}  // namespace wmr
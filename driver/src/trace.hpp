@@ -0,0 +1,161 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <wmr/tracing.hpp>
+
+/** Instrumentation macros. Built in with WMR_TRACING, otherwise they expand to nothing.
+ * name must be a string literal, since only the pointer is recorded.
+ * - WMR_TRACE_SCOPE(name) records a span from here to the end of the enclosing scope.
+ * - WMR_TRACE_INSTANT(name) records a point event.
+ * - WMR_TRACE_THREAD_NAME(name) names the calling thread in exported traces. name may be any
+ *   std::string.
+ */
+#if WMR_TRACING
+#define WMR_TRACE_CONCAT_INNER(a, b) a##b
+#define WMR_TRACE_CONCAT(a, b) WMR_TRACE_CONCAT_INNER(a, b)
+#define WMR_TRACE_SCOPE(name) \
+  ::wmr::trace::Scope WMR_TRACE_CONCAT(wmr_trace_scope_, __LINE__)(name)
+#define WMR_TRACE_INSTANT(name) ::wmr::trace::RecordInstant(name)
+#define WMR_TRACE_THREAD_NAME(name) ::wmr::trace::SetThreadName(name)
+#else
+#define WMR_TRACE_SCOPE(name) static_cast<void>(0)
+#define WMR_TRACE_INSTANT(name) static_cast<void>(0)
+#define WMR_TRACE_THREAD_NAME(name) static_cast<void>(0)
+#endif
+
+#if WMR_TRACING
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace wmr::trace {
+
+/** Cheapest monotonic tick count available: the TSC on x86, nanoseconds elsewhere. Ticks are
+ * converted to time when a trace is exported.
+ */
+inline uint64_t Now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/** Ring of the most recent events recorded by one thread.
+ * Only the owning thread writes, and it never waits for readers. A reader copies the ring, then
+ * discards the entries the writer may have overwritten meanwhile, which it can tell from written_.
+ * Fields are relaxed atomics so that this is free of data races; on x86 they compile to plain
+ * moves.
+ */
+class ThreadBuffer {
+ public:
+  static constexpr std::size_t kCapacity = 1 << 14;
+
+  /** Marks an instant event, which has no duration. */
+  static constexpr uint64_t kInstant = UINT64_MAX;
+
+  struct Event {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+  };
+
+  void Record(const char* name, uint64_t start, uint64_t duration) {
+    auto idx = next_++;
+
+    // Announce the overwrite before making it, so a reader can tell its copy may be torn
+    written_.store(idx + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto& slot = events_[idx % kCapacity];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start.store(start, std::memory_order_relaxed);
+    slot.duration.store(duration, std::memory_order_relaxed);
+    published_.store(idx + 1, std::memory_order_release);
+  }
+
+  /** Append the intact events to out, oldest first. Safe from any thread. */
+  template <class Container>
+  void Read(Container& out) const;
+
+ private:
+  struct Slot {
+    std::atomic<const char*> name{};
+    std::atomic<uint64_t> start{};
+    std::atomic<uint64_t> duration{};
+  };
+
+  Slot events_[kCapacity];
+  uint64_t next_{};                   // Owning thread only
+  std::atomic<uint64_t> written_{};   // Events started
+  std::atomic<uint64_t> published_{}; // Events completed
+};
+
+template <class Container>
+void ThreadBuffer::Read(Container& out) const {
+  auto published = published_.load(std::memory_order_acquire);
+  auto first = published > kCapacity ? published - kCapacity : 0;
+
+  auto begin = out.size();
+  for (auto idx = first; idx < published; ++idx) {
+    auto& slot = events_[idx % kCapacity];
+    out.push_back({slot.name.load(std::memory_order_relaxed),
+                   slot.start.load(std::memory_order_relaxed),
+                   slot.duration.load(std::memory_order_relaxed)});
+  }
+
+  // Any event the writer started since then may have overwritten one of ours
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto written = written_.load(std::memory_order_relaxed);
+  if (written > kCapacity && written - kCapacity > first) {
+    auto torn = std::min(written - kCapacity, published) - first;
+    out.erase(out.begin() + begin, out.begin() + begin + torn);
+  }
+}
+
+/** Create and register a buffer for the calling thread. */
+ThreadBuffer& RegisterThread();
+
+/** The calling thread's buffer, created on first use. */
+inline ThreadBuffer& LocalBuffer() {
+  thread_local ThreadBuffer& buffer = RegisterThread();
+  return buffer;
+}
+
+void SetThreadName(std::string name);
+
+inline void RecordInstant(const char* name) {
+  LocalBuffer().Record(name, Now(), ThreadBuffer::kInstant);
+}
+
+class Scope {
+ public:
+  explicit Scope(const char* name) : name_(name), start_(Now()) {}
+  ~Scope() { LocalBuffer().Record(name_, start_, Now() - start_); }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+
+ private:
+  const char* name_;
+  uint64_t start_;
+};
+
+}  // namespace wmr::trace
+
+#endif
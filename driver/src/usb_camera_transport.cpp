@@ -0,0 +1,128 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include "usb_camera_transport.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <stdexcept>
+
+#include <libusbcpp/error.hpp>
+
+namespace wmr {
+
+UsbCameraTransport::UsbCameraTransport(libusbcpp::Device::Pointer dev, std::size_t command_keys)
+    : dev_handle_(dev->Open()) {
+  // Get the config descriptor
+  libusbcpp::Device::ConfigDescriptor config;
+  try {
+    config = dev->GetActiveConfigDescriptor();
+  } catch (libusbcpp::Error<libusbcpp::c::LIBUSB_ERROR_NOT_FOUND>&) {
+    dev_handle_->SetConfiguration(1);
+    config = dev->GetActiveConfigDescriptor();
+  }
+
+  // Find the interface descriptor for kInterfaceNumber
+  const libusbcpp::c::libusb_interface_descriptor* iface_desc = nullptr;
+  for (uint8_t i = 0; i < config->bNumInterfaces; ++i) {
+    auto* d = config->interface[i].altsetting;  // only consider altsetting[0]
+    if (d->bInterfaceNumber == kInterfaceNumber) {
+      iface_desc = d;
+      break;
+    }
+  }
+  if (!iface_desc) {
+    throw std::runtime_error("Device doesn't have interface number kInterfaceNumber");
+  }
+
+  // Search for a read/write pair of bulk endpoints
+  read_ep_ = 0xF0;  // 0xF0 is an invalid address
+  write_ep_ = 0xF0;
+  for (uint8_t j = 0; j < iface_desc->bNumEndpoints; ++j) {
+    auto& ep_desc = iface_desc->endpoint[j];
+    if ((ep_desc.bmAttributes & 0x3) != libusbcpp::c::LIBUSB_TRANSFER_TYPE_BULK) continue;
+
+    if (ep_desc.bEndpointAddress & libusbcpp::c::LIBUSB_ENDPOINT_IN && read_ep_ == 0xF0) {
+      read_ep_ = ep_desc.bEndpointAddress;
+    } else if (write_ep_ == 0xF0) {
+      write_ep_ = ep_desc.bEndpointAddress;
+    } else {
+      throw std::runtime_error("Interface has multiple bulk endpoint pairs");
+    }
+  }
+  if (read_ep_ == 0xF0 || write_ep_ == 0xF0) {
+    throw std::runtime_error("Bulk endpoint pair not found");
+  }
+
+  spdlog::debug("UsbCameraTransport: Found endpoints on interface {}: r:{:x} w::{:x}",
+                kInterfaceNumber, read_ep_, write_ep_);
+
+  iface_claim_hnd_ = dev_handle_->ClaimInterface(kInterfaceNumber);
+
+  // One transfer per key, so that commands for different keys don't wait on each other
+  command_slots_.reserve(command_keys);
+  for (std::size_t key = 0; key < command_keys; ++key) {
+    command_slots_.push_back({this, key, dev_handle_->AllocTransfer()});
+  }
+  command_queue_ = std::make_unique<CommandQueue>(
+      command_keys,
+      [this](std::size_t key, const uint8_t* command, std::size_t size) {
+        auto& slot = command_slots_[key];
+        slot.transfer->FillBulkTransfer(write_ep_, const_cast<uint8_t*>(command),
+                                        static_cast<int>(size), CommandCallback, &slot,
+                                        kCommandTimeoutMs);
+        slot.transfer->AsStruct()->Submit();
+      },
+      [this](std::size_t key) {
+        try {
+          command_slots_[key].transfer->AsStruct()->Cancel();
+        } catch (libusbcpp::Error<libusbcpp::c::LIBUSB_ERROR_NOT_FOUND>&) {
+          // Already complete, its callback just hasn't run yet
+        }
+      });
+}
+
+void UsbCameraTransport::WriteCommand(const void* command, std::size_t size) {
+  int actual_length;
+  dev_handle_->BulkTransfer(write_ep_, static_cast<uint8_t*>(const_cast<void*>(command)),
+                            static_cast<int>(size), &actual_length, kCommandTimeoutMs);
+
+  if (static_cast<std::size_t>(actual_length) != size) {
+    throw std::runtime_error("BulkTransfer didn't consume all bytes");
+  }
+}
+
+void UsbCameraTransport::SendCommand(std::size_t key, const void* command, std::size_t size,
+                                     std::promise<void>* sent) {
+  command_queue_->Send(key, command, size, sent);
+}
+
+void UsbCameraTransport::CommandCallback(libusbcpp::c::libusb_transfer* trans) {
+  auto& slot = *static_cast<CommandSlot*>(trans->user_data);
+  bool ok = trans->status == libusbcpp::c::LIBUSB_TRANSFER_COMPLETED &&
+            trans->actual_length == trans->length;
+  if (!ok) {
+    spdlog::warn("UsbCameraTransport: Command failed (status={}, sent {} of {} bytes)",
+                 static_cast<int>(trans->status), trans->actual_length, trans->length);
+  }
+  slot.transport->command_queue_->OnSent(slot.key, ok);
+}
+
+void UsbCameraTransport::OpenRx(const RxConfig& config) {
+  libusbcpp::TransferRing::Config ring_config{};
+  ring_config.endpoint = read_ep_;
+  ring_config.buffer_size = config.buffer_size;
+  ring_config.capacity = config.capacity;
+  ring_config.depth = config.depth;
+  ring_config.min_depth = config.min_depth;
+  ring_config.max_depth = config.max_depth;
+  ring_config.adaptive = config.adaptive;
+  ring_config.callback = config.callback;
+  ring_config.user_data = config.user_data;
+  ring_config.timeout = 0;
+  rx_ring_ = std::make_unique<libusbcpp::TransferRing>(dev_handle_, ring_config);
+}
+
+}  // namespace wmr
@@ -0,0 +1,67 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <libusbcpp/device.hpp>
+#include <libusbcpp/device_handle.hpp>
+#include <libusbcpp/transfer.hpp>
+#include <libusbcpp/transfer_ring.hpp>
+
+#include "camera_transport.hpp"
+#include "command_queue.hpp"
+
+namespace wmr {
+
+/** CameraTransport backed by the headset's camera device, through libusb.
+ * Receive transfers are completed on the libusb event thread.
+ */
+class UsbCameraTransport : public CameraTransport {
+ public:
+  /** Opens dev and claims its camera interface. Asynchronous commands get a slot for each of
+   * command_keys keys.
+   */
+  UsbCameraTransport(libusbcpp::Device::Pointer dev, std::size_t command_keys);
+
+  void WriteCommand(const void* command, std::size_t size) final;
+  void SendCommand(std::size_t key, const void* command, std::size_t size,
+                   std::promise<void>* sent) final;
+
+  void OpenRx(const RxConfig& config) final;
+  void StartRx() final { rx_ring_->Start(); }
+  void StopRx() final { rx_ring_->Stop(); }
+  void OnRxComplete(Transfer* trans) final { rx_ring_->OnComplete(trans); }
+  void RecycleRx(Transfer* trans) final { rx_ring_->Recycle(trans); }
+  std::size_t RxInFlight() const final { return rx_ring_->InFlight(); }
+  RxStats GetRxStats() const final { return rx_ring_->GetStats(); }
+
+ private:
+  static constexpr uint8_t kInterfaceNumber = 3;
+  static constexpr unsigned int kCommandTimeoutMs = 100;
+
+  /** The transfer command_queue_ sends the commands for one key with. */
+  struct CommandSlot {
+    UsbCameraTransport* transport;
+    std::size_t key;
+    libusbcpp::Transfer::Pointer transfer;
+  };
+
+  static void CommandCallback(libusbcpp::c::libusb_transfer* trans);
+
+  libusbcpp::DeviceHandle::Pointer dev_handle_;
+  std::shared_ptr<void> iface_claim_hnd_;
+  uint8_t read_ep_, write_ep_;
+
+  // After iface_claim_hnd_, so that they're destroyed while the interface is still claimed
+  std::vector<CommandSlot> command_slots_;
+  std::unique_ptr<CommandQueue> command_queue_;  // After command_slots_, which it uses
+  std::unique_ptr<libusbcpp::TransferRing> rx_ring_;
+};
+
+}  // namespace wmr
@@ -0,0 +1,86 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+#include <wmr/headset_options.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace wmr {
+
+/** Hint to the CPU that we're in a spin loop. */
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ volatile("yield");
+#endif
+}
+
+/** Lets one consumer thread wait for a condition that a producer thread makes true without locking,
+ * e.g. a SpscQueue becoming non-empty.
+ * The producer only takes the mutex and signals the condition variable if the consumer has actually
+ * parked, so with kSpinThenPark and kBusyPoll a busy stream costs no syscalls at all.
+ */
+class Waiter {
+ public:
+  Waiter(WaitStrategy strategy, std::size_t spin_iterations)
+      : strategy_(strategy), spin_iterations_(spin_iterations) {}
+
+  /** Return once ready() is true. ready must be safe to call concurrently with the producer. */
+  template <typename Pred>
+  void Wait(Pred ready) {
+    if (ready()) return;
+
+    if (strategy_ == WaitStrategy::kBusyPoll) {
+      while (!ready()) CpuRelax();
+      return;
+    }
+
+    if (strategy_ == WaitStrategy::kSpinThenPark) {
+      for (std::size_t i = 0; i < spin_iterations_; ++i) {
+        CpuRelax();
+        if (ready()) return;
+      }
+    }
+
+    // Announce that we're about to park before checking ready() for the last time. Paired with the
+    // fence in Notify, this guarantees that either we see the producer's update, or it sees us.
+    std::unique_lock l{m_};
+    parked_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv_.wait(l, ready);
+    parked_.store(false, std::memory_order_relaxed);
+  }
+
+  /** Call after making the consumer's condition true. */
+  void Notify() {
+    if (strategy_ == WaitStrategy::kBusyPoll) return;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (parked_.load(std::memory_order_relaxed)) {
+      std::lock_guard l{m_};
+      cv_.notify_one();
+    }
+  }
+
+ private:
+  const WaitStrategy strategy_;
+  const std::size_t spin_iterations_;
+
+  std::atomic<bool> parked_{};
+  std::mutex m_;
+  std::condition_variable cv_;
+};
+
+}  // namespace wmr
@@ -100,6 +100,16 @@ struct FrameBuffer {
   std::condition_variable avail_cv_;
 };
 
+/** Repackage a CV_32FC1 map pair from cv::initUndistortRectifyMap for the driver. */
+static RectificationMap ToRectificationMap(const cv::Mat& map_x, const cv::Mat& map_y) {
+  RectificationMap map{};
+  map.width = static_cast<uint32_t>(map_x.cols);
+  map.height = static_cast<uint32_t>(map_x.rows);
+  map.map_x.assign(map_x.begin<float>(), map_x.end<float>());
+  map.map_y.assign(map_y.begin<float>(), map_y.end<float>());
+  return map;
+}
+
 /** Proof of concept demonstrating headtracking using the front facing cameras. */
 int main(int argc, char** argv) {
   // Catch CTRL-C and other fun signals
@@ -108,7 +118,11 @@ int main(int argc, char** argv) {
 
   spdlog::set_level(spdlog::level::trace);
 
-  auto headset = CreateHeadset(headset_specifications::kHpReverbG2);
+  // Let the driver track room lighting on the front facing cameras
+  HeadsetOptions options;
+  options.camera.auto_exposure.enable = true;
+
+  auto headset = CreateHeadset(headset_specifications::kHpReverbG2, options);
 
   Calibration cal;
   cal.ParseJson(headset->OasisHid().ReadCalibration());
@@ -133,30 +147,34 @@ int main(int argc, char** argv) {
                               proj_right.rowRange(0, 3).colRange(0, 3), cal_right.size, CV_32F,
                               map1_right, map2_right);
 
+  // Have the driver rectify the front facing cameras as it unpacks them
+  headset->Camera().SetRectification(0, ToRectificationMap(map1_left, map2_left));
+  headset->Camera().SetRectification(1, ToRectificationMap(map1_right, map2_right));
+
   headset->Open();
 
   // headset->VendorHid().WakeDisplay();
 
-  headset->Camera().SetExpGain(0, 0x1770, 0x00ff);
-  headset->Camera().SetExpGain(1, 0x1770, 0x00ff);
   headset->Camera().SetExpGain(4, 0x1770, 0x00ff);
   headset->Camera().SetExpGain(5, 0x1770, 0x00ff);
 
   FrameBuffer fb;
-  headset->Camera().RegisterFrameCallback([&fb](auto f) { return fb.CamCallback(f); });
+  // Only the front facing cameras of room frames are used, so don't bother unpacking the rest
+  FrameSubscription subscription;
+  subscription.image_mask = 0b11;
+  subscription.frame_type_mask = FrameSubscription::FrameTypeBit(CameraFrame::Type::kRoom);
+
+  headset->Camera().RegisterFrameCallback([&fb](auto f) { return fb.CamCallback(f); },
+                                          subscription);
   headset->OasisHid().RegisterImuFrameCallback([&fb](auto f) { return fb.ImuCallback(f); });
 
-  cv::Mat img_l, img_r;
   cv::Mat imgrect_l, imgrect_r;
   std::vector<ORB_SLAM3::IMU::Point> imu_frames;
 
   ORB_SLAM3::System SLAM(argv[1], argv[2], ORB_SLAM3::System::STEREO, true);
 
   while (g_signal == 0) {
-    double frame_time = fb.Get(img_l, img_r, imu_frames);
-
-    cv::remap(img_l, imgrect_l, map1_left, map2_left, cv::INTER_LINEAR);
-    cv::remap(img_r, imgrect_r, map1_right, map2_right, cv::INTER_LINEAR);
+    double frame_time = fb.Get(imgrect_l, imgrect_r, imu_frames);
 
     SLAM.TrackStereo(imgrect_l, imgrect_r, frame_time, imu_frames);
   }
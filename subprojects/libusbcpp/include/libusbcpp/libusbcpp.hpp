@@ -12,3 +12,4 @@
 #include "device_list.hpp"
 #include "error.hpp"
 #include "transfer.hpp"
+#include "transfer_ring.hpp"
@@ -0,0 +1,214 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "core.hpp"
+#include "device_handle.hpp"
+#include "error.hpp"
+#include "transfer.hpp"
+
+namespace libusbcpp {
+
+/** A pool of identical transfers, some number of which are kept in flight on one endpoint.
+ * The ring owns capacity transfers and their buffers (allocated with DevMemAlloc). Each transfer is
+ * in one of three states:
+ *  - in flight: submitted, and owned by libusb
+ *  - held: completed, and owned by the caller until it's handed back with Recycle
+ *  - idle: parked in the ring, available to top up the in-flight count
+ *
+ * The ring tries to keep depth transfers in flight. If adaptive is set, it grows depth (up to
+ * max_depth) whenever it starves, i.e. a transfer completes and there's no other transfer in
+ * flight behind it. It shrinks depth (down to min_depth) after a long enough stretch in which it
+ * always had at least two spare transfers in flight.
+ *
+ * OnComplete must be called from the transfer callback, before anything else touches the transfer.
+ * All other member functions may be called from any thread.
+ */
+class TransferRing {
+ public:
+  struct Config {
+    unsigned char endpoint;
+    std::size_t buffer_size;
+    std::size_t capacity;  /**< Total number of transfers owned by the ring. */
+    std::size_t depth;     /**< Initial number of transfers to keep in flight. */
+    std::size_t min_depth;
+    std::size_t max_depth;
+    bool adaptive;
+    c::libusb_transfer_cb_fn callback;
+    void* user_data;
+    unsigned int timeout;
+  };
+
+  struct Stats {
+    std::size_t capacity;
+    std::size_t depth;
+    std::size_t in_flight;
+    std::size_t held;
+    std::size_t idle;
+    /** Lowest in-flight count seen after a completion, or 0 before the first one. */
+    std::size_t min_in_flight;
+    uint64_t completions;
+    uint64_t underruns; /**< Completions that left nothing in flight. */
+    uint64_t submit_errors;
+    uint64_t depth_increases;
+    uint64_t depth_decreases;
+  };
+
+  /** Completions per adaptation window. */
+  static constexpr uint64_t kAdaptWindow = 256;
+
+  TransferRing(const std::shared_ptr<DeviceHandle>& dev_handle, const Config& config)
+      : config_(config) {
+    if (config_.min_depth == 0 || config_.min_depth > config_.max_depth ||
+        config_.max_depth > config_.capacity) {
+      throw std::invalid_argument("TransferRing: need 0 < min_depth <= max_depth <= capacity");
+    }
+    depth_ = std::clamp(config_.depth, config_.min_depth, config_.max_depth);
+
+    for (std::size_t i = 0; i < config_.capacity; ++i) {
+      auto& trans = transfers_.emplace_back(dev_handle->AllocTransfer());
+      auto& buff = buffers_.emplace_back(dev_handle->DevMemAlloc(config_.buffer_size));
+      trans->FillBulkTransfer(config_.endpoint, buff.get(), static_cast<int>(config_.buffer_size),
+                              config_.callback, config_.user_data, config_.timeout);
+      idle_.push_back(trans->AsStruct());
+    }
+  }
+
+  // Not movable or copyable, since transfers point back at user_data
+  TransferRing(const TransferRing&) = delete;
+  TransferRing& operator=(const TransferRing&) = delete;
+
+  /** Begin keeping depth transfers in flight. */
+  void Start() {
+    std::lock_guard l{m_};
+    running_ = true;
+    window_low_water_ = config_.capacity;
+    TopUp(true);
+  }
+
+  /** Stop resubmitting, and cancel every transfer in flight.
+   * Transfers handed back after this are parked.
+   */
+  void Stop() {
+    std::lock_guard l{m_};
+    running_ = false;
+
+    for (auto& trans : transfers_) {
+      try {
+        trans->AsStruct()->Cancel();
+      } catch (Error<c::LIBUSB_ERROR_NOT_FOUND>&) {
+        // Transfer is not in progress, already complete, or already cancelled.
+      }
+    }
+  }
+
+  /** Account for a completed transfer, which is now held by the caller.
+   * If that left the ring short, an idle transfer is submitted in its place.
+   */
+  void OnComplete(TransferStruct*) {
+    std::lock_guard l{m_};
+    auto in_flight = --in_flight_;
+    ++held_;
+    ++stats_.completions;
+
+    if (!running_) return;
+
+    stats_.min_in_flight = std::min(stats_.min_in_flight, in_flight);
+    window_low_water_ = std::min(window_low_water_, in_flight);
+
+    if (in_flight == 0) {
+      ++stats_.underruns;
+      if (config_.adaptive && depth_ < config_.max_depth) {
+        ++depth_;
+        ++stats_.depth_increases;
+      }
+    }
+
+    if (config_.adaptive && stats_.completions % kAdaptWindow == 0) {
+      if (window_low_water_ >= 2 && depth_ > config_.min_depth) {
+        --depth_;
+        ++stats_.depth_decreases;
+      }
+      window_low_water_ = config_.capacity;
+    }
+
+    TopUp(false);
+  }
+
+  /** Hand a held transfer back to the ring, which resubmits or parks it. */
+  void Recycle(TransferStruct* trans) {
+    std::lock_guard l{m_};
+    --held_;
+    idle_.push_back(trans);
+    TopUp(true);
+  }
+
+  /** Change the number of transfers kept in flight, clamped to [min_depth, max_depth].
+   * Excess transfers are parked as they complete.
+   */
+  void SetDepth(std::size_t depth) {
+    std::lock_guard l{m_};
+    depth_ = std::clamp(depth, config_.min_depth, config_.max_depth);
+    if (running_) TopUp(true);
+  }
+
+  std::size_t InFlight() const { return in_flight_.load(std::memory_order_acquire); }
+
+  Stats GetStats() const {
+    std::lock_guard l{m_};
+    Stats stats = stats_;
+    stats.capacity = config_.capacity;
+    stats.depth = depth_;
+    stats.in_flight = in_flight_;
+    stats.held = held_;
+    stats.idle = idle_.size();
+    if (stats.min_in_flight == SIZE_MAX) stats.min_in_flight = 0;
+    return stats;
+  }
+
+ private:
+  /** Submit idle transfers until depth_ are in flight. Must hold m_. */
+  void TopUp(bool rethrow) {
+    while (running_ && in_flight_ < depth_ && !idle_.empty()) {
+      auto trans = idle_.back();
+      ++in_flight_;
+      try {
+        trans->Submit();
+        idle_.pop_back();
+      } catch (...) {
+        --in_flight_;
+        ++stats_.submit_errors;
+        if (rethrow) throw;
+        return;
+      }
+    }
+  }
+
+  Config config_;
+  std::vector<Transfer::Pointer> transfers_;
+  std::vector<std::shared_ptr<unsigned char>> buffers_;
+
+  mutable std::mutex m_;
+  bool running_{};
+  std::size_t depth_;
+  std::atomic<std::size_t> in_flight_{};
+  std::size_t held_{};
+  std::vector<TransferStruct*> idle_;
+  std::size_t window_low_water_{};
+  // min_in_flight stays at SIZE_MAX until the first completion, and GetStats reports 0 till then
+  Stats stats_{0, 0, 0, 0, 0, SIZE_MAX, 0, 0, 0, 0, 0};
+};
+
+}  // namespace libusbcpp
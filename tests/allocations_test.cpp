@@ -0,0 +1,262 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+
+#include "camera.hpp"
+#include "check.hpp"
+#include "clock_sync.hpp"
+#include "fake_camera_device.hpp"
+#include "metrics_registry.hpp"
+#include "oasis_hid.hpp"
+#include "soft_camera_transport.hpp"
+#include "soft_hid_device.hpp"
+
+using namespace wmr;
+
+namespace {
+
+/** Heap allocations made by any thread so far. */
+std::atomic<uint64_t> allocations{};
+
+void* Allocate(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void* AllocateAligned(std::size_t size, std::align_val_t align) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  auto alignment = static_cast<std::size_t>(align);
+  if (auto p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) { return Allocate(size); }
+void* operator new[](std::size_t size) { return Allocate(size); }
+void* operator new(std::size_t size, std::align_val_t align) {
+  return AllocateAligned(size, align);
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return AllocateAligned(size, align);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return Allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+
+/** Frames to push through before counting, for pools, rings and queues to reach their size. */
+constexpr std::size_t kWarmUpFrames = 200;
+
+/** Frames to count allocations over. */
+constexpr std::size_t kFrames = 1000;
+
+constexpr uint32_t kMagic = 0x2b6f6c44;
+
+// Raw layouts, as read by OasisHid
+constexpr std::size_t kImuReportSize = 381;
+constexpr std::size_t kImuGyroTimestampOffset = 0x009;
+constexpr std::size_t kImuAccelTimestampOffset = 0x0E9;
+constexpr std::size_t kImuMagicOffset = 0x179;
+constexpr uint8_t kFwReportId = 0x02;
+constexpr std::size_t kFwReportSize = 64;
+
+/** Wait up to a few seconds for count to reach n. */
+bool WaitFor(const std::atomic<uint64_t>& count, uint64_t n) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (count.load(std::memory_order_acquire) < n) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+/** Push frames from a FakeCameraDevice through a Camera, to a subscriber on the dispatching thread
+ * and one with a queue of its own, with auto-exposure sending commands as it goes. Check that
+ * once warmed up, none of it allocates.
+ */
+void TestCameraFrames(const std::string& name, FrameDispatch dispatch, bool zero_copy) {
+  const auto& spec = headset_specifications::kHpReverbG2;
+  CameraOptions options;
+  options.dispatch = dispatch;
+  options.zero_copy = zero_copy;
+  options.auto_exposure.enable = true;
+  // Fixed, so that the ring doesn't resize mid-count
+  options.rx_adaptive_depth = false;
+
+  auto transport_ptr = std::make_unique<SoftCameraTransport>();
+  auto& transport = *transport_ptr;
+  FakeCameraDevice device(spec, transport, {});
+  Camera camera(spec, options, std::move(transport_ptr), std::make_shared<ClockSync>(),
+                std::make_shared<MetricsRegistry>());
+  CameraInterface& cam = camera;
+
+  std::atomic<uint64_t> delivered{};
+  std::atomic<uint64_t> queued{};
+  cam.RegisterFrameCallback([&](const auto&) {
+    delivered.fetch_add(1, std::memory_order_release);
+    return true;
+  });
+  FrameSubscription async;
+  async.queue.async = true;
+  async.queue.on_overflow = QueueOverflow::kBlock;
+  async.queue.block_timeout = std::chrono::seconds(1);
+  cam.RegisterFrameCallback(
+      [&](const auto&) {
+        queued.fetch_add(1, std::memory_order_release);
+        return true;
+      },
+      async);
+
+  cam.StartStream();
+  uint64_t sent = 0;
+  auto push = [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) device.Send(true);
+    sent += n;
+    bool done = WaitFor(delivered, sent) && WaitFor(queued, sent);
+    WMR_CHECK(done);
+    return done;
+  };
+
+  if (push(kWarmUpFrames)) {
+    auto before = allocations.load();
+    push(kFrames);
+    auto counted = allocations.load() - before;
+    if (!WMR_CHECK(counted == 0)) {
+      std::cerr << name << ": " << counted << " allocations over " << kFrames << " frames"
+                << std::endl;
+    }
+  }
+  cam.StopStream();
+}
+
+/** HidDevice that reports are dispatched to synchronously, on the calling thread. Firmware
+ * commands are acknowledged right away.
+ */
+class DirectHidDevice : public SoftHidDevice {
+ public:
+  DirectHidDevice()
+      : SoftHidDevice(std::make_shared<MetricsRegistry>(), "test", [](auto& dev, auto report) {
+          if (report.size() < 2 || report[0] != kFwReportId) return;
+          std::array<uint8_t, kFwReportSize> ack{kFwReportId, report[1]};
+          dev.Inject({ack.data(), ack.size()});
+        }) {}
+
+  using HidDevice::DispatchReport;
+};
+
+/** Decode IMU reports and deliver their frames to a subscriber on the reading thread and one with
+ * a queue of its own. Check that once warmed up, none of it allocates.
+ */
+void TestImuFrames() {
+  auto device = std::make_unique<DirectHidDevice>();
+  auto direct = device.get();
+  OasisHid oasis(std::move(device), {}, std::make_shared<ClockSync>(),
+                 std::make_shared<MetricsRegistry>());
+  OasisHidInterface& imu = oasis;
+
+  std::atomic<uint64_t> delivered{};
+  std::atomic<uint64_t> queued{};
+  imu.RegisterImuFrameCallback([&](const auto&) {
+    delivered.fetch_add(1, std::memory_order_release);
+    return true;
+  });
+  CallbackQueueOptions async;
+  async.async = true;
+  async.on_overflow = QueueOverflow::kBlock;
+  async.block_timeout = std::chrono::seconds(1);
+  imu.RegisterImuFrameCallback(
+      [&](const auto&) {
+        queued.fetch_add(1, std::memory_order_release);
+        return true;
+      },
+      async);
+  imu.StartImu();
+
+  std::array<uint8_t, kImuReportSize> report{};
+  report[0] = 0x01;
+  std::memcpy(report.data() + kImuMagicOffset, &kMagic, sizeof(kMagic));
+  uint64_t sample = 0;
+  auto push = [&](uint64_t n) {
+    for (uint64_t i = 0; i < n; ++i) {
+      for (std::size_t k = 0; k < 4; ++k) {
+        uint64_t timestamp = 10000 * ++sample;
+        std::memcpy(report.data() + kImuAccelTimestampOffset + 8 * k, &timestamp,
+                    sizeof(timestamp));
+        std::memcpy(report.data() + kImuGyroTimestampOffset + 8 * k, &timestamp,
+                    sizeof(timestamp));
+      }
+      direct->DispatchReport({report.data(), report.size()}, std::chrono::steady_clock::now());
+    }
+    // The first few reports are discarded, so go by what was delivered synchronously
+    bool done = delivered > 0 && WaitFor(queued, delivered);
+    WMR_CHECK(done);
+    return done;
+  };
+
+  if (push(kWarmUpFrames)) {
+    auto before = allocations.load();
+    push(kFrames);
+    auto counted = allocations.load() - before;
+    if (!WMR_CHECK(counted == 0)) {
+      std::cerr << "imu: " << counted << " allocations over " << kFrames << " frames"
+                << std::endl;
+    }
+  }
+  imu.StopImu();
+}
+
+}  // namespace
+
+/** Frames are delivered without allocating, however they're dispatched. */
+int main() {
+  spdlog::set_level(spdlog::level::off);
+
+  TestCameraFrames("stream_thread", FrameDispatch::kStreamThread, false);
+  TestCameraFrames("stream_thread/zero_copy", FrameDispatch::kStreamThread, true);
+  TestCameraFrames("inline", FrameDispatch::kInline, false);
+  TestCameraFrames("inline/zero_copy", FrameDispatch::kInline, true);
+  TestImuFrames();
+
+  return test::Result();
+}
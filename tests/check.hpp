@@ -0,0 +1,36 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <iostream>
+
+namespace wmr::test {
+
+/** Checks that failed so far. */
+inline int& Failures() {
+  static int failures = 0;
+  return failures;
+}
+
+inline bool Check(bool ok, const char* what, const char* file, int line) {
+  if (!ok) {
+    std::cerr << file << ":" << line << ": FAILED " << what << std::endl;
+    ++Failures();
+  }
+  return ok;
+}
+
+/** What main should return. */
+inline int Result() {
+  if (Failures() == 0) return 0;
+  std::cerr << Failures() << " checks failed" << std::endl;
+  return 1;
+}
+
+}  // namespace wmr::test
+
+/** Report cond if it's false, and carry on. Evaluates to cond. */
+#define WMR_CHECK(cond) ::wmr::test::Check(static_cast<bool>(cond), #cond, __FILE__, __LINE__)
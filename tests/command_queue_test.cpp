@@ -0,0 +1,189 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "check.hpp"
+#include "command_queue.hpp"
+
+using namespace wmr;
+
+namespace {
+
+/** Stands in for the transfers a CommandQueue sends with, recording what it's asked to do. */
+struct Sink {
+  CommandQueue::SubmitFn Submit() {
+    return [this](std::size_t key, const uint8_t* command, std::size_t size) {
+      if (fail_submit) throw std::runtime_error("Sink: Submit failed");
+      submitted.emplace_back(key, std::string(command, command + size));
+    };
+  }
+
+  std::vector<std::pair<std::size_t, std::string>> submitted;
+  bool fail_submit = false;
+};
+
+void Send(CommandQueue& queue, std::size_t key, const std::string& command) {
+  queue.Send(key, command.data(), command.size());
+}
+
+std::future<void> SendAndNotify(CommandQueue& queue, std::size_t key, const std::string& command) {
+  std::promise<void> sent;
+  auto future = sent.get_future();
+  queue.Send(key, command.data(), command.size(), &sent);
+  return future;
+}
+
+bool Ready(std::future<void>& future) {
+  return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+/** Get a ready future, and return whether it holds an exception of type E. */
+template <class E>
+bool Throws(std::future<void>& future) {
+  try {
+    future.get();
+  } catch (E&) {
+    return true;
+  } catch (...) {
+  }
+  return false;
+}
+
+/** Commands for different keys go out back to back. Those for a busy key are coalesced. */
+void TestCoalescing() {
+  Sink sink;
+  CommandQueue queue(3, sink.Submit(), [](std::size_t) {});
+
+  auto a0 = SendAndNotify(queue, 0, "a0");
+  Send(queue, 1, "a1");
+  WMR_CHECK(sink.submitted.size() == 2);
+  WMR_CHECK(sink.submitted[0] == std::make_pair(std::size_t{0}, std::string("a0")));
+  WMR_CHECK(sink.submitted[1] == std::make_pair(std::size_t{1}, std::string("a1")));
+
+  // Key 0 is busy, so these wait, and only the latest is sent
+  auto b0 = SendAndNotify(queue, 0, "b0");
+  auto c0 = SendAndNotify(queue, 0, "c0");
+  WMR_CHECK(sink.submitted.size() == 2);
+  WMR_CHECK(!Ready(a0));
+
+  queue.OnSent(0, true);
+  WMR_CHECK(Ready(a0));
+  WMR_CHECK(!Ready(b0) && !Ready(c0));
+  WMR_CHECK(sink.submitted.size() == 3);
+  WMR_CHECK(sink.submitted[2] == std::make_pair(std::size_t{0}, std::string("c0")));
+
+  // The replaced command is done when the one that replaced it is
+  queue.OnSent(0, true);
+  WMR_CHECK(Ready(b0) && Ready(c0));
+  b0.get();
+  c0.get();
+
+  queue.OnSent(1, true);
+}
+
+/** Failed sends fail their futures, without holding up the next command. */
+void TestFailures() {
+  Sink sink;
+  CommandQueue queue(2, sink.Submit(), [](std::size_t) {});
+
+  auto a0 = SendAndNotify(queue, 0, "a0");
+  auto b0 = SendAndNotify(queue, 0, "b0");
+  queue.OnSent(0, false);
+  WMR_CHECK(Ready(a0) && Throws<std::runtime_error>(a0));
+  WMR_CHECK(sink.submitted.size() == 2);
+  queue.OnSent(0, true);
+  WMR_CHECK(Ready(b0));
+  b0.get();
+
+  // A command that can't be submitted fails right away, and leaves the key free
+  sink.fail_submit = true;
+  auto a1 = SendAndNotify(queue, 1, "a1");
+  WMR_CHECK(Ready(a1) && Throws<std::runtime_error>(a1));
+  sink.fail_submit = false;
+  Send(queue, 1, "b1");
+  WMR_CHECK(sink.submitted.size() == 3 && sink.submitted[2].second == "b1");
+  queue.OnSent(1, true);
+
+  bool threw = false;
+  try {
+    Send(queue, 2, "a2");
+  } catch (std::out_of_range&) {
+    threw = true;
+  }
+  WMR_CHECK(threw);
+
+  threw = false;
+  try {
+    Send(queue, 0, std::string(CommandQueue::kMaxCommandSize + 1, 'x'));
+  } catch (std::out_of_range&) {
+    threw = true;
+  }
+  WMR_CHECK(threw);
+}
+
+/** The destructor cancels what's in flight and waits for it, even if cancelling throws. */
+void TestDestruction() {
+  Sink sink;
+  CommandQueue* queue_ptr = nullptr;
+  std::thread completer;
+  std::vector<std::size_t> cancelled;
+
+  auto queue = new CommandQueue(
+      3, sink.Submit(), [&](std::size_t key) {
+        cancelled.push_back(key);
+        switch (key) {
+          case 0:
+            // Completes right away
+            queue_ptr->OnSent(key, false);
+            break;
+          case 1:
+            // Completes later, on another thread, like a transfer reaped by the event thread
+            completer = std::thread([queue_ptr, key]() {
+              std::this_thread::sleep_for(std::chrono::milliseconds(20));
+              queue_ptr->OnSent(key, false);
+            });
+            throw std::runtime_error("Sink: Cancel failed");
+        }
+      });
+  queue_ptr = queue;
+
+  auto a0 = SendAndNotify(*queue, 0, "a0");
+  auto a1 = SendAndNotify(*queue, 1, "a1");
+  auto b1 = SendAndNotify(*queue, 1, "b1");
+  Send(*queue, 2, "a2");
+  queue->OnSent(2, true);
+
+  delete queue;
+  completer.join();
+
+  WMR_CHECK(cancelled == std::vector<std::size_t>({0, 1}));
+  WMR_CHECK(Ready(a0) && Throws<std::runtime_error>(a0));
+  WMR_CHECK(Ready(a1) && Throws<std::runtime_error>(a1));
+
+  // Never sent
+  WMR_CHECK(Ready(b1) && Throws<std::future_error>(b1));
+}
+
+}  // namespace
+
+int main() {
+  spdlog::set_level(spdlog::level::off);
+
+  TestCoalescing();
+  TestFailures();
+  TestDestruction();
+
+  return test::Result();
+}
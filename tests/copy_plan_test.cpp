@@ -0,0 +1,180 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+#include <wmr/types.hpp>
+
+#include "check.hpp"
+#include "copy_plan.hpp"
+#include "frame_unpacker.hpp"
+#include "thread_pool.hpp"
+
+using namespace wmr;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x2b6f6c44;
+
+using Images = std::vector<std::vector<uint8_t>>;
+
+/** A raw frame full of noise, with valid segment headers. */
+std::vector<uint8_t> MakeRawFrame(const HeadsetSpec& spec) {
+  std::vector<uint8_t> frame(spec.camera_xfer_size);
+  std::mt19937 rng(1234);
+  std::generate(frame.begin(), frame.end(), [&]() { return static_cast<uint8_t>(rng()); });
+
+  for (std::size_t i = 0; i < spec.camera_segment_count; ++i) {
+    uint32_t header[3] = {kMagic, 1, static_cast<uint32_t>(i)};
+    std::memcpy(frame.data() + i * spec.camera_segment_size, header, sizeof(header));
+  }
+  return frame;
+}
+
+/** Unpack frame the way Camera::CopyFrame did before CopyPlan, working out the layout as it goes.
+ */
+Images ReferenceCopyFrame(const HeadsetSpec& spec, const uint8_t* frame) {
+  Images images(spec.n_cameras, std::vector<uint8_t>(spec.camera_width * spec.camera_height));
+
+  std::vector<std::size_t> bytes_copied_per_image(spec.n_cameras, 0);
+  std::size_t frame_offset = CopyPlan::kSegmentHeaderSize;
+  std::size_t cam_idx = 0;
+
+  // The first row of each image contains metadata
+  for (; cam_idx < spec.n_cameras; ++cam_idx) frame_offset += spec.camera_width;
+  cam_idx = 0;
+
+  while (true) {
+    while (frame_offset % spec.camera_segment_size) {
+      auto block_size =
+          std::min(spec.camera_segment_size - frame_offset % spec.camera_segment_size,
+                   spec.camera_width - bytes_copied_per_image[cam_idx] % spec.camera_width);
+
+      if (frame_offset + block_size >= spec.camera_frame_size) {
+        throw std::runtime_error("ReferenceCopyFrame: Ran out of bytes in raw frame");
+      }
+
+      std::copy_n(frame + frame_offset, block_size,
+                  images[cam_idx].data() + bytes_copied_per_image[cam_idx]);
+
+      frame_offset += block_size;
+      bytes_copied_per_image[cam_idx] += block_size;
+
+      // If we finished reading a row, move to the next camera
+      if (block_size && bytes_copied_per_image[cam_idx] % spec.camera_width == 0) {
+        cam_idx = (cam_idx + 1) % spec.n_cameras;
+
+        // If the image for the next camera is already complete, we're done
+        if (bytes_copied_per_image[cam_idx] == spec.camera_width * spec.camera_height) {
+          return images;
+        }
+      }
+    }
+
+    // Seek past the segment header
+    frame_offset += CopyPlan::kSegmentHeaderSize;
+  }
+}
+
+/** The segments sit where the spec puts them, in order, and their spans stay clear of headers. */
+void TestSegments(const HeadsetSpec& spec, const CopyPlan& plan) {
+  auto& segments = plan.Segments();
+  WMR_CHECK(segments.size() == spec.camera_segment_count);
+
+  uint32_t span_begin = 0;
+  for (std::size_t i = 0; i < segments.size(); ++i) {
+    auto& segment = segments[i];
+    WMR_CHECK(segment.header_offset == i * spec.camera_segment_size);
+    WMR_CHECK(segment.span_begin == span_begin && segment.span_end >= segment.span_begin);
+    span_begin = segment.span_end;
+
+    for (auto s = segment.span_begin; s < segment.span_end; ++s) {
+      auto& span = plan.Spans()[s];
+      WMR_CHECK(span.src_offset >= segment.header_offset + CopyPlan::kSegmentHeaderSize &&
+                span.src_offset + span.length <= segment.header_offset + spec.camera_segment_size);
+    }
+  }
+  WMR_CHECK(span_begin == plan.Spans().size());
+}
+
+/** Copying span by span writes every pixel exactly once, with what the old arithmetic did. */
+void TestSpans(const HeadsetSpec& spec, const CopyPlan& plan, const std::vector<uint8_t>& frame,
+               const Images& expected) {
+  WMR_CHECK(plan.ImageCount() == spec.n_cameras);
+  WMR_CHECK(plan.ImageWidth() == spec.camera_width);
+  WMR_CHECK(plan.ImageSize() == spec.camera_width * spec.camera_height);
+
+  Images images(spec.n_cameras, std::vector<uint8_t>(plan.ImageSize()));
+  std::vector<std::vector<uint8_t>> writes(spec.n_cameras,
+                                           std::vector<uint8_t>(plan.ImageSize()));
+  for (auto& span : plan.Spans()) {
+    if (!WMR_CHECK(span.dst_image < spec.n_cameras &&
+                   span.dst_offset + span.length <= plan.ImageSize() &&
+                   span.dst_offset % spec.camera_width + span.length <= spec.camera_width)) {
+      return;
+    }
+    std::copy_n(frame.data() + span.src_offset, span.length,
+                images[span.dst_image].data() + span.dst_offset);
+    for (std::size_t i = 0; i < span.length; ++i) ++writes[span.dst_image][span.dst_offset + i];
+  }
+
+  for (std::size_t n = 0; n < spec.n_cameras; ++n) {
+    WMR_CHECK(std::all_of(writes[n].begin(), writes[n].end(), [](auto w) { return w == 1; }));
+    WMR_CHECK(images[n] == expected[n]);
+  }
+}
+
+/** FrameUnpacker, which executes the plan for Camera, gets the same images, with or without a
+ * pool.
+ */
+void TestUnpacker(const HeadsetSpec& spec, const CopyPlan& plan,
+                  const std::vector<uint8_t>& frame, const Images& expected) {
+  auto validator = [&](const uint8_t* raw, std::size_t segment_idx) {
+    uint32_t header[3];
+    std::memcpy(header, raw + plan.Segments()[segment_idx].header_offset, sizeof(header));
+    return header[0] == kMagic && header[2] == segment_idx;
+  };
+
+  ThreadPool pool(3);
+  for (auto non_temporal : {false, true}) {
+    for (auto pool_ptr : {static_cast<ThreadPool*>(nullptr), &pool}) {
+      FrameUnpacker unpacker(plan, non_temporal, pool_ptr, 64 * 1024, validator);
+      CameraFrame dst(spec.camera_width, spec.camera_height, spec.n_cameras);
+      if (!WMR_CHECK(unpacker.Unpack(frame.data(), dst))) continue;
+
+      for (uint8_t n = 0; n < spec.n_cameras; ++n) {
+        WMR_CHECK(std::equal(expected[n].begin(), expected[n].end(), dst.GetImage(n)));
+      }
+    }
+  }
+}
+
+}  // namespace
+
+/** The CopyPlan for the HP Reverb G2 unpacks a frame bit-for-bit the same as working out the
+ * layout frame by frame did.
+ */
+int main() {
+  spdlog::set_level(spdlog::level::off);
+
+  const auto& spec = headset_specifications::kHpReverbG2;
+  CopyPlan plan(spec);
+  auto frame = MakeRawFrame(spec);
+  auto expected = ReferenceCopyFrame(spec, frame.data());
+
+  TestSegments(spec, plan);
+  TestSpans(spec, plan, frame, expected);
+  TestUnpacker(spec, plan, frame, expected);
+
+  return test::Result();
+}
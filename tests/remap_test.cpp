@@ -0,0 +1,145 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <wmr/calibration.hpp>
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+#include <wmr/types.hpp>
+
+#include "check.hpp"
+#include "copy_plan.hpp"
+#include "frame_unpacker.hpp"
+#include "remap_table.hpp"
+#include "thread_pool.hpp"
+
+using namespace wmr;
+
+namespace {
+
+constexpr uint32_t kMagic = 0x2b6f6c44;
+
+/** A raw frame full of noise, with valid segment headers. */
+std::vector<uint8_t> MakeRawFrame(const HeadsetSpec& spec) {
+  std::vector<uint8_t> frame(spec.camera_xfer_size);
+  std::mt19937 rng(1234);
+  std::generate(frame.begin(), frame.end(), [&]() { return static_cast<uint8_t>(rng()); });
+
+  for (std::size_t i = 0; i < spec.camera_segment_count; ++i) {
+    uint32_t header[3] = {kMagic, 1, static_cast<uint32_t>(i)};
+    std::memcpy(frame.data() + i * spec.camera_segment_size, header, sizeof(header));
+  }
+  return frame;
+}
+
+/** Calibration JSON shaped like the headset's, with strongly distorted lenses, and rotations that
+ * take the edges of each rectified image outside the sensor.
+ */
+std::string MakeCalibrationJson(const HeadsetSpec& spec) {
+  std::ostringstream json;
+  json << R"({"CalibrationInformation":{"Cameras":[)";
+  for (std::size_t i = 0; i < spec.n_cameras; ++i) {
+    auto skew = 0.01 * static_cast<double>(i);
+    // Normalized cx, cy, fx and fy, then k1-k6, two unused, p2, p1 and another unused
+    const double params[] = {0.5 + skew, 0.5 - skew, 0.45, 0.6, 0.9,   0.2, 0.01, 1.2,
+                             0.35,       0.03,       0,    0,   1e-4, -2e-4, 0};
+    if (i > 0) json << ",";
+    json << R"({"Location":"CALIBRATION_CameraLocationHT)" << i << R"(","Purpose":"Tracking",)"
+         << R"("SensorWidth":)" << spec.camera_width << R"(,"SensorHeight":)"
+         << spec.camera_height << ","
+         << R"("Intrinsics":{"ModelType":"CALIBRATION_LensDistortionModelRational6KT",)"
+         << R"("ModelParameterCount":15,"ModelParameters":[)";
+    for (std::size_t p = 0; p < std::size(params); ++p) json << (p > 0 ? "," : "") << params[p];
+    json << R"(]},"Rt":{"Rotation":[0.9998,-0.0123,0.0156,0.0122,0.9999,0.0034,-0.0156,)"
+         << R"(-0.0032,0.9998],"Translation":[)" << 0.05 * static_cast<double>(i)
+         << R"(,-0.0012,0.0034]}})";
+  }
+  json << "]}}";
+  return json.str();
+}
+
+/** Repackage a CV_32FC1 map pair from cv::initUndistortRectifyMap for the driver. */
+RectificationMap ToRectificationMap(const cv::Mat& map_x, const cv::Mat& map_y) {
+  RectificationMap map{};
+  map.width = static_cast<uint32_t>(map_x.cols);
+  map.height = static_cast<uint32_t>(map_x.rows);
+  map.map_x.assign(map_x.begin<float>(), map_x.end<float>());
+  map.map_y.assign(map_y.begin<float>(), map_y.end<float>());
+  return map;
+}
+
+}  // namespace
+
+/** Rectifying each camera of the HP Reverb G2 while unpacking gives what cv::remap does with the
+ * same maps, give or take 1 for rounding, with and without an unpack pool.
+ */
+int main() {
+  spdlog::set_level(spdlog::level::off);
+
+  const auto& spec = headset_specifications::kHpReverbG2;
+  CopyPlan plan(spec);
+  auto frame = MakeRawFrame(spec);
+  auto validator = [](const uint8_t*, std::size_t) { return true; };
+
+  // What the cameras saw, to rectify with OpenCV
+  CameraFrame plain(spec.camera_width, spec.camera_height, spec.n_cameras);
+  WMR_CHECK(FrameUnpacker(plan, false, nullptr, 64 * 1024, validator).Unpack(frame.data(), plain));
+
+  Calibration calibration;
+  calibration.ParseJson(MakeCalibrationJson(spec));
+  if (!WMR_CHECK(calibration.cameras().size() == spec.n_cameras)) return test::Result();
+
+  std::vector<cv::Mat> expected;
+  std::vector<RectificationMap> maps;
+  for (uint8_t n = 0; n < spec.n_cameras; ++n) {
+    auto& cal = calibration.cameras()[n];
+    cv::Mat map_x, map_y;
+    cv::initUndistortRectifyMap(cal.camera_mat, cal.dist_coeffs, cal.rotation, cal.camera_mat,
+                                cal.size, CV_32FC1, map_x, map_y);
+    maps.push_back(ToRectificationMap(map_x, map_y));
+
+    cv::Mat src(static_cast<int>(spec.camera_height), static_cast<int>(spec.camera_width),
+                CV_8UC1, plain.GetImage(n));
+    expected.emplace_back();
+    cv::remap(src, expected.back(), map_x, map_y, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+  }
+
+  ThreadPool pool(3);
+  for (auto pool_ptr : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    FrameUnpacker unpacker(plan, false, pool_ptr, 64 * 1024, validator);
+    for (uint8_t n = 0; n < spec.n_cameras; ++n) {
+      unpacker.SetRemap(n, std::make_unique<RemapTable>(spec, plan, n, maps[n]));
+    }
+
+    CameraFrame rectified(spec.camera_width, spec.camera_height, spec.n_cameras);
+    if (!WMR_CHECK(unpacker.Unpack(frame.data(), rectified))) continue;
+
+    for (uint8_t n = 0; n < spec.n_cameras; ++n) {
+      cv::Mat actual(static_cast<int>(spec.camera_height), static_cast<int>(spec.camera_width),
+                     CV_8UC1, rectified.GetImage(n));
+      auto max_diff = cv::norm(actual, expected[n], cv::NORM_INF);
+      if (!WMR_CHECK(max_diff <= 1)) {
+        std::cerr << "camera " << int{n} << (pool_ptr ? " on a pool" : "")
+                  << ": max difference " << max_diff << std::endl;
+      }
+    }
+  }
+
+  return test::Result();
+}
@@ -0,0 +1,60 @@
+// Copyright Mark H. Spatz 2021-present
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE or copy at
+// https://www.boost.org/LICENSE_1_0.txt)
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <map>
+#include <string>
+#include <thread>
+
+#include <wmr/create_headset.hpp>
+#include <wmr/headset_interface.hpp>
+#include <wmr/headset_specifications/hp_reverb_g2.hpp>
+#include <wmr/metrics.hpp>
+
+using namespace wmr;
+
+static std::atomic_int g_signal = 0;
+static void SignalHandler(int which) { g_signal = which; }
+
+/** Record the raw camera and HID traffic of the headset to a capture file, for replaying with
+ * WMR_REPLAY=<file> (see ReplayOptions). Usage: capture [file], which defaults to capture.wmrcap.
+ */
+int main(int argc, char** argv) {
+  // Catch CTRL-C and other fun signals
+  std::signal(SIGINT, SignalHandler);
+  std::signal(SIGTERM, SignalHandler);
+
+  HeadsetOptions options;
+  options.capture.file = argc > 1 ? argv[1] : "capture.wmrcap";
+
+  auto headset = CreateHeadset(headset_specifications::kHpReverbG2, options);
+
+  // The firmware payloads go into the capture too, so that a replay can serve them
+  headset->OasisHid().ReadDeviceInfo();
+  headset->OasisHid().ReadCalibration();
+
+  headset->Open();
+
+  while (g_signal == 0) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    std::map<std::string, double> capture_metrics;
+    for (const auto& metric : headset->GetMetrics()) {
+      if (metric.name.rfind("wmr_capture_", 0) == 0) capture_metrics[metric.name] = metric.value;
+    }
+    spdlog::info("capture: {} records, {} MB written, {} dropped",
+                 capture_metrics["wmr_capture_records_total"],
+                 capture_metrics["wmr_capture_bytes_total"] / 1e6,
+                 capture_metrics["wmr_capture_records_dropped_total"]);
+  }
+
+  headset->Close();
+
+  return 0;
+}
@@ -37,7 +37,12 @@ int main(int argc, char** argv) {
 
   spdlog::set_level(spdlog::level::trace);
 
-  auto headset = CreateHeadset(headset_specifications::kHpReverbG2);
+  // PNG encoding is slow, so images are written on a thread of their own. Each frame queued for
+  // it holds a pool frame, on top of the one being written.
+  HeadsetOptions options;
+  options.camera.frame_pool.size = 8;
+
+  auto headset = CreateHeadset(headset_specifications::kHpReverbG2, options);
 
   headset->Open();
 
@@ -46,23 +51,30 @@ int main(int argc, char** argv) {
   headset->Camera().SetExpGain(4, 0x1770, 0xFF);
   headset->Camera().SetExpGain(5, 0x1770, 0xFF);
 
-  headset->Camera().RegisterFrameCallback([](auto f) {
-    if (f->type == CameraFrame::Type::kRoom) {
-      cv::Mat_<uint8_t> left(f->image_height, f->image_width, const_cast<uint8_t*>(f->GetImage(0)));
+  FrameSubscription subscription;
+  subscription.image_mask = 0b11;
+  subscription.frame_type_mask = FrameSubscription::FrameTypeBit(CameraFrame::Type::kRoom);
+  subscription.queue.async = true;
+  subscription.queue.depth = 6;
 
-      cv::Mat_<uint8_t> right(f->image_height, f->image_width,
-                              const_cast<uint8_t*>(f->GetImage(1)));
+  headset->Camera().RegisterFrameCallback(
+      [](auto f) {
+        cv::Mat_<uint8_t> left(f->image_height, f->image_width,
+                               const_cast<uint8_t*>(f->GetImage(0)));
 
-      auto time = std::to_string(
-          std::chrono::duration_cast<std::chrono::nanoseconds>(f->timestamp).count());
+        cv::Mat_<uint8_t> right(f->image_height, f->image_width,
+                                const_cast<uint8_t*>(f->GetImage(1)));
 
-      // NOTE: cam0 & cam1 dirs must already exist
-      cv::imwrite("cam0/" + time + ".png", left);
-      cv::imwrite("cam1/" + time + ".png", right);
-    }
+        auto time = std::to_string(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(f->timestamp).count());
 
-    return true;
-  });
+        // NOTE: cam0 & cam1 dirs must already exist
+        cv::imwrite("cam0/" + time + ".png", left);
+        cv::imwrite("cam1/" + time + ".png", right);
+
+        return true;
+      },
+      subscription);
 
   std::ofstream csv;
   csv.open("imu0.csv");